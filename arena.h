@@ -0,0 +1,176 @@
+#ifndef PNGFUSE_ARENA_H
+#define PNGFUSE_ARENA_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * A recycler of the large buffers repeatedly allocated and freed while compressing and decompressing subfiles.
+ * @details
+ *     Buffers of @c BufferArena::MIN_RECYCLED to @c BufferArena::MAX_RECYCLED bytes are rounded up to one of a few size classes per power of two,
+ *     and when released, are kept by the releasing thread to be handed out again by its next allocation of the same class,
+ *     rather than being returned to the heap. The same few (often @c mmap()-backed) block sizes otherwise recur for every subfile,
+ *     such as LodePNG's hash tables and the buffers holding compressed segments, so a batch of small files spends most of its time allocating.\n
+ *     Each thread keeps at most @c BufferArena::CACHE_LIMIT bytes, without any locking, and frees the rest of its buffers when it exits.
+ *     Smaller and larger buffers are passed straight through to @c std::malloc() and @c std::free().\n
+ *     Every buffer records its capacity ahead of its data, so it can only be released or reallocated through @c BufferArena.
+ */
+class BufferArena {
+public:
+    /**
+     * The size of the smallest buffers that are recycled.
+     */
+    static constexpr std::size_t MIN_RECYCLED = 1 << 16;
+    /**
+     * The size of the largest buffers that are recycled.
+     */
+    static constexpr std::size_t MAX_RECYCLED = 1 << 23;
+    /**
+     * The total capacity of the buffers each thread holds on to for reuse.
+     */
+    static constexpr std::size_t CACHE_LIMIT = 1 << 25;
+
+    /**
+     * Allocates a buffer, reusing one the calling thread released earlier if there is one of the same size class.
+     * @param size The number of bytes to allocate
+     * @return A pointer to at least @p size bytes, aligned as by @c std::malloc(), or @c nullptr if the allocation failed
+     */
+    [[nodiscard]] static void *allocate(std::size_t size) {
+        if (const auto index = class_index(size); index < CLASS_COUNT) {
+            auto &cache = local();
+            if (auto &bin = cache.bins[index]; bin.count > 0) {
+                cache.bytes -= class_size(index);
+                return bin.blocks[--bin.count];
+            }
+            size = class_size(index);
+        }
+        if (size > static_cast<std::size_t>(-1) - HEADER_SIZE)
+            return nullptr;
+        auto *const block = static_cast<unsigned char *>(std::malloc(HEADER_SIZE + size));
+        if (!block)
+            return nullptr;
+        std::memcpy(block, &size, sizeof(size));
+        return block + HEADER_SIZE;
+    }
+
+    /**
+     * Resizes a buffer, keeping it in place if it already has the capacity, as with @c std::realloc().
+     * @param buffer A buffer returned by @c BufferArena::allocate(), or @c nullptr to allocate a new one
+     * @param size The number of bytes the buffer must hold
+     * @return A pointer to the resized buffer, holding the contents of @p buffer up to @p size bytes,
+     *     or @c nullptr if the allocation failed, in which case @p buffer is left unchanged
+     */
+    [[nodiscard]] static void *reallocate(void *buffer, std::size_t size) {
+        if (!buffer)
+            return allocate(size);
+        const auto old_capacity = capacity(buffer);
+        if (size <= old_capacity)
+            return buffer;
+        auto *const resized = allocate(size);
+        if (resized) {
+            std::memcpy(resized, buffer, old_capacity);
+            release(buffer);
+        }
+        return resized;
+    }
+
+    /**
+     * Releases a buffer, keeping it for reuse by the calling thread if it is of a recycled size class and the thread has room for it.
+     * @param buffer A buffer returned by @c BufferArena::allocate() or @c BufferArena::reallocate(), or @c nullptr
+     */
+    static void release(void *buffer) {
+        if (!buffer)
+            return;
+        const auto size = capacity(buffer);
+        // Threads that have exited, or are exiting, no longer have a cache to return buffers to
+        if (const auto index = class_index(size); index < CLASS_COUNT && class_size(index) == size && !exited) {
+            auto &cache = local();
+            if (auto &bin = cache.bins[index]; bin.count < bin.blocks.size() && cache.bytes + size <= CACHE_LIMIT) {
+                bin.blocks[bin.count++] = buffer;
+                cache.bytes += size;
+                return;
+            }
+        }
+        std::free(static_cast<unsigned char *>(buffer) - HEADER_SIZE);
+    }
+
+private:
+    /**
+     * The size of the capacity recorded ahead of each buffer, padded to keep the buffer aligned as by @c std::malloc().
+     */
+    static constexpr std::size_t HEADER_SIZE = alignof(std::max_align_t);
+    /**
+     * The number of size classes for each power of two, bounding the space wasted by rounding up a buffer to a quarter of its size.
+     */
+    static constexpr std::size_t CLASSES_PER_DOUBLING = 4;
+    static constexpr std::size_t CLASS_COUNT = (std::bit_width(MAX_RECYCLED) - std::bit_width(MIN_RECYCLED)) * CLASSES_PER_DOUBLING + 1;
+
+    struct Bin {
+        std::array<void *, 4> blocks;
+        std::size_t count = 0;
+    };
+
+    struct Cache {
+        std::array<Bin, CLASS_COUNT> bins;
+        std::size_t bytes = 0;
+
+        Cache() = default;
+        Cache(const Cache &) = delete;
+        Cache &operator=(const Cache &) = delete;
+
+        ~Cache() {
+            exited = true;
+            for (auto &bin : bins)
+                for (std::size_t i = 0; i < bin.count; ++i)
+                    std::free(static_cast<unsigned char *>(bin.blocks[i]) - HEADER_SIZE);
+        }
+    };
+
+    /**
+     * Whether the calling thread's cache has been destroyed, so that buffers released during thread or program exit are freed instead.
+     */
+    static inline thread_local bool exited = false;
+
+    static Cache &local() {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    static std::size_t capacity(void *buffer) {
+        std::size_t size;
+        std::memcpy(&size, static_cast<unsigned char *>(buffer) - HEADER_SIZE, sizeof(size));
+        return size;
+    }
+
+    /**
+     * The size of the buffers in a size class.
+     * @param index The index of the size class, less than @c CLASS_COUNT
+     * @return The capacity of every buffer in the class
+     */
+    static constexpr std::size_t class_size(std::size_t index) {
+        return (MIN_RECYCLED << index / CLASSES_PER_DOUBLING) / CLASSES_PER_DOUBLING * (CLASSES_PER_DOUBLING + index % CLASSES_PER_DOUBLING);
+    }
+
+    /**
+     * Finds the smallest size class that holds a buffer.
+     * @param size The number of bytes the buffer must hold
+     * @return The index of the size class, or @c CLASS_COUNT or more if buffers of @p size bytes are not recycled
+     */
+    static constexpr std::size_t class_index(std::size_t size) {
+        if (size < MIN_RECYCLED)
+            return CLASS_COUNT;
+        if (size == MIN_RECYCLED)
+            return 0;
+        if (size > MAX_RECYCLED)
+            return CLASS_COUNT;
+        const auto doubling = static_cast<std::size_t>(std::bit_width(size - 1) - 1);
+        const auto step = (std::size_t{1} << doubling) / CLASSES_PER_DOUBLING;
+        const auto offset = (size - 1 - (std::size_t{1} << doubling)) / step + 1;
+        return (doubling - (std::bit_width(MIN_RECYCLED) - 1)) * CLASSES_PER_DOUBLING + offset;
+    }
+};
+
+#endif //PNGFUSE_ARENA_H
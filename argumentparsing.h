@@ -7,6 +7,7 @@
 #include <filesystem>
 #include <optional>
 #include <exception>
+#include <limits>
 
 #include "nativeunicode.h"
 
@@ -21,10 +22,23 @@ struct Flags {
     bool list : 1 = false;
     bool clean : 1 = false;
     bool overwrite : 1 = false;
+    bool stream : 1 = false;
+    bool solid : 1 = false;
+    bool verify : 1 = false;
+    bool stats : 1 = false;
+    bool repack : 1 = false;
+    bool indexed : 1 = false;
 private:
     bool _ignore_rest : 1 = false;
 public:
     std::optional<path> output;
+    std::optional<path> extract;
+    std::optional<path> cache;
+    std::optional<path> trace;
+    std::optional<unsigned> jobs;
+    std::optional<std::string> codec;
+    std::optional<unsigned> level;
+    std::optional<unsigned> in_flight;
 
     /**
      * Permissively parse command line flags.
@@ -53,7 +67,20 @@ public:
         // list flags = "-l", "--list"
         // clean flags = "-c", "-r", "--clean", "--remove"
         // overwrite flags = "-m", "--overwrite", "--modify"
+        // stream flags = "-s", "--stream"
+        // solid flags = "--solid"
+        // verify flags = "--verify"
         // output flags = "-o", "--out.*"
+        // extract flags = "-x", "--extract"
+        // jobs flags = "-j", "--jobs"
+        // codec flags = "--codec"
+        // level flags = "--level"
+        // cache flags = "--cache"
+        // stats flags = "--stats"
+        // repack flags = "--repack"
+        // index flags = "--index"
+        // trace flags = "--trace"
+        // in-flight flags = "--in-flight"
 
         if (arg.starts_with(NATIVE_WIDTH("--"))) {
             arg = arg.substr(2);
@@ -63,13 +90,32 @@ public:
                 list_flag        = NATIVE_WIDTH("list"),
                 clean_flag_1     = NATIVE_WIDTH("clean"),     clean_flag_2     = NATIVE_WIDTH("remove"),
                 overwrite_flag_1 = NATIVE_WIDTH("overwrite"), overwrite_flag_2 = NATIVE_WIDTH("modify"),
-                output_flag      = NATIVE_WIDTH("out");
+                stream_flag      = NATIVE_WIDTH("stream"),
+                solid_flag       = NATIVE_WIDTH("solid"),
+                verify_flag      = NATIVE_WIDTH("verify"),
+                output_flag      = NATIVE_WIDTH("out"),
+                extract_flag     = NATIVE_WIDTH("extract"),
+                jobs_flag        = NATIVE_WIDTH("jobs"),
+                codec_flag       = NATIVE_WIDTH("codec"),
+                level_flag       = NATIVE_WIDTH("level"),
+                cache_flag       = NATIVE_WIDTH("cache"),
+                stats_flag       = NATIVE_WIDTH("stats"),
+                repack_flag      = NATIVE_WIDTH("repack"),
+                index_flag       = NATIVE_WIDTH("index"),
+                trace_flag       = NATIVE_WIDTH("trace"),
+                in_flight_flag   = NATIVE_WIDTH("in-flight");
             if      (help_flag       .starts_with(arg)) help = true;
             else if (list_flag       .starts_with(arg)) list = true;
             else if (clean_flag_1    .starts_with(arg)
                      || clean_flag_2 .starts_with(arg)) clean = true;
             else if (overwrite_flag_2.starts_with(arg)
                      || (arg.size() > 1 && overwrite_flag_1.starts_with(arg))) overwrite = true;
+            else if (stream_flag     .starts_with(arg)) stream = true;
+            else if (solid_flag      .starts_with(arg)) solid = true;
+            else if (verify_flag     .starts_with(arg)) verify = true;
+            else if (stats_flag      .starts_with(arg)) stats = true;
+            else if (arg.size() > 2 && repack_flag.starts_with(arg)) repack = true;
+            else if (arg.size() > 2 && index_flag.starts_with(arg)) indexed = true;
 
             // Since an equals-separator possibly being included would mess up matching, match on just the prefix before any equals
             else if (const auto arg_prefix = FlagValue::split_prefix(arg); output_flag.starts_with(arg_prefix) || arg_prefix.starts_with(output_flag)) {
@@ -78,6 +124,43 @@ public:
                     extra_value_consumed |= reached_ahead;
                 } else
                     throw std::runtime_error("Custom output flag was specified, but no path was given.");
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && extract_flag.starts_with(arg_prefix)) {
+                if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
+                    extract.emplace(arg_value.value());
+                    extra_value_consumed |= reached_ahead;
+                } else
+                    throw std::runtime_error("Extract flag was specified, but no filename or pattern was given.");
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && jobs_flag.starts_with(arg_prefix)) {
+                const auto [arg_value, reached_ahead] = FlagValue(args, index);
+                jobs.emplace(parse_number(arg_value, "Jobs", 1, std::numeric_limits<unsigned>::max()));
+                extra_value_consumed |= reached_ahead;
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && codec_flag.starts_with(arg_prefix)) {
+                if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
+                    // Codec names are ASCII, so converting through a path is lossless on every platform
+                    codec.emplace(path(string_to_lowercase(native_string(arg_value.value()))).string());
+                    extra_value_consumed |= reached_ahead;
+                } else
+                    throw std::runtime_error("Codec flag was specified, but no codec was given.");
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && level_flag.starts_with(arg_prefix)) {
+                const auto [arg_value, reached_ahead] = FlagValue(args, index);
+                level.emplace(parse_number(arg_value, "Level", 0, 9));
+                extra_value_consumed |= reached_ahead;
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && cache_flag.starts_with(arg_prefix)) {
+                if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
+                    cache.emplace(arg_value.value());
+                    extra_value_consumed |= reached_ahead;
+                } else
+                    throw std::runtime_error("Cache flag was specified, but no directory was given.");
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && trace_flag.starts_with(arg_prefix)) {
+                if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
+                    trace.emplace(arg_value.value());
+                    extra_value_consumed |= reached_ahead;
+                } else
+                    throw std::runtime_error("Trace flag was specified, but no path was given.");
+            } else if (const auto arg_prefix = FlagValue::split_prefix(arg); !arg_prefix.empty() && in_flight_flag.starts_with(arg_prefix)) {
+                const auto [arg_value, reached_ahead] = FlagValue(args, index);
+                in_flight.emplace(parse_number(arg_value, "In-flight", 1, 1 << 20));
+                extra_value_consumed |= reached_ahead;
             } else
                 throw native_runtime_error(NATIVE_WIDTH("Unknown flag specified: ") + arg);
         }
@@ -86,7 +169,7 @@ public:
             arg = arg.substr(1);
             // Handle grouped short flags
             bool equals_encountered = false;
-            for (const auto short_flag : arg) {
+            for (const auto &short_flag : arg) {
                 if (equals_encountered)
                     break;
                 switch (short_flag) {
@@ -96,6 +179,7 @@ public:
                     case NATIVE_WIDTH('c'):
                     case NATIVE_WIDTH('r'): clean = true; break;
                     case NATIVE_WIDTH('m'): overwrite = true; break;
+                    case NATIVE_WIDTH('s'): stream = true; break;
                     case NATIVE_WIDTH('o'):
                         if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
                             output.emplace(arg_value.value());
@@ -103,6 +187,25 @@ public:
                         } else
                             throw std::runtime_error("Custom output flag was specified, but no path was given.");
                         break;
+                    case NATIVE_WIDTH('x'):
+                        if (const auto [arg_value, reached_ahead] = FlagValue(args, index); arg_value.has_value()) {
+                            extract.emplace(arg_value.value());
+                            extra_value_consumed |= reached_ahead;
+                        } else
+                            throw std::runtime_error("Extract flag was specified, but no filename or pattern was given.");
+                        break;
+                    case NATIVE_WIDTH('j'):
+                        // Also accept a number attached directly to the flag, as in -j4
+                        if (const auto attached = native_string_view(arg).substr(&short_flag - arg.data() + 1);
+                            !attached.empty() && attached.front() != NATIVE_WIDTH('=')) {
+                            jobs.emplace(parse_number(attached, "Jobs", 1, std::numeric_limits<unsigned>::max()));
+                            equals_encountered = true;
+                        } else {
+                            const auto [arg_value, reached_ahead] = FlagValue(args, index);
+                            jobs.emplace(parse_number(arg_value, "Jobs", 1, std::numeric_limits<unsigned>::max()));
+                            extra_value_consumed |= reached_ahead;
+                        }
+                        break;
                     default:
                         throw native_runtime_error(NATIVE_WIDTH("Unknown flag specified: ") + native_string(1, short_flag));
                 }
@@ -116,6 +219,27 @@ public:
 private:
     using native_string_view = std::basic_string_view<native_string::value_type>;
 
+    /**
+     * Parses the value of a numeric flag, e.g. a number of jobs.
+     * @param value The value given with the flag, if any
+     * @param name The name of the flag, for error messages
+     * @param min The least value allowed
+     * @param max The greatest value allowed
+     * @return The number specified by @p value
+     */
+    static unsigned parse_number(std::optional<native_string_view> value, const std::string &name, unsigned min, unsigned max) {
+        if (!value.has_value())
+            throw std::runtime_error(name + " flag was specified, but no value was given.");
+        std::size_t parsed_size = 0;
+        std::optional<unsigned long> number;
+        try {
+            number = std::stoul(native_string(value.value()), &parsed_size);
+        } catch (const std::exception &) {}
+        if (!number.has_value() || number.value() < min || number.value() > max || parsed_size != value->size())
+            throw std::runtime_error(name + " flag must be an integer from " + std::to_string(min) + " to " + std::to_string(max) + '.');
+        return static_cast<unsigned>(number.value());
+    }
+
     /**
      * A class that extracts the value associated with a flag.
      */
@@ -183,7 +307,8 @@ struct Arguments {
         auto unprocessed_args = native_argv(argc, argv);
         Arguments::program_path.emplace(unprocessed_args.front());
         for (int i = 1; i < unprocessed_args.size(); ++i) {
-            if (unprocessed_args[i].front() == NATIVE_WIDTH('-'))
+            // A lone - stands for standard input or output rather than a flag
+            if (unprocessed_args[i].front() == NATIVE_WIDTH('-') && unprocessed_args[i].size() > 1)
                 i += flags.process_flag(unprocessed_args, i);
             else
                 args.emplace_back(unprocessed_args[i]);
@@ -191,6 +316,9 @@ struct Arguments {
         if (flags.overwrite && flags.output.has_value()) {
             throw std::runtime_error("Cannot specify both overwrite mode and a custom output path.");
         }
+        if (flags.solid && flags.stream) {
+            throw std::runtime_error("Cannot specify both solid mode and stream mode.");
+        }
     }
 
     [[nodiscard]] inline std::size_t num_args() const { return args.size(); }
@@ -0,0 +1,543 @@
+/**
+ * Author: Eta
+ * pngfuse_bench measures PNGFuse's top-level operations on reproducible synthetic corpora, for tracking performance regressions.
+ *
+ * Copyright (c) 2021 Eta, offered under the zlib license: https://opensource.org/licenses/Zlib
+ */
+
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <optional>
+#include <algorithm>
+#include <charconv>
+
+#include "subfileimage.h"
+
+#ifdef _WINDOWS
+// Required for peak_memory()
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi")
+#endif
+#elif !defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+using std::filesystem::path;
+
+/**
+ * The type of @c native_out and @c native_err, either @c std::ostream or @c std::wostream.
+ */
+using native_ostream = std::remove_reference_t<decltype(native_out)>;
+
+/**
+ * The seed from which every corpus is generated, so that runs on any machine measure identical inputs.
+ */
+constexpr static std::uint64_t CORPUS_SEED = 0x504E4746757365;
+
+
+/**
+ * Resets the peak memory usage reported by @c peak_memory() to the current usage, where the platform supports it.
+ * @details This is only supported on Linux, where peak memory usage can then be measured per phase rather than per process.
+ */
+static void reset_peak_memory() {
+#ifdef __linux__
+    // Writing 5 to clear_refs resets the peak resident set size reported in /proc/self/status
+    std::ofstream("/proc/self/clear_refs") << '5';
+#endif
+}
+
+
+/**
+ * Measures the peak physical memory usage of the process.
+ * @return The peak resident set size in bytes since the last call to @c reset_peak_memory(), or since the process started
+ *     on platforms that cannot reset it, or 0 if it could not be measured
+ */
+static std::uint64_t peak_memory() {
+#if defined(_WINDOWS)
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);)
+        if (line.starts_with("VmHWM:"))
+            return std::stoull(line.substr(6)) * 1024;
+    return 0;
+#else
+    struct rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+
+/**
+ * A set of synthetic files to be fused into a host PNG, and the measurements taken on it.
+ */
+struct Corpus {
+    /**
+     * The name identifying the corpus in the results.
+     */
+    std::string name;
+    /**
+     * The PNG into which the files are fused.
+     */
+    path host;
+    /**
+     * The files to be fused, in order.
+     */
+    std::vector<path> files;
+    /**
+     * The total size of the files, in bytes.
+     */
+    std::uint64_t size = 0;
+};
+
+
+/**
+ * One top-level operation being measured on a corpus, made up of one or more timed phases.
+ * @details
+ *     Each phase is printed as soon as it finishes, as one JSON object per line, and @c finish() prints the operation's total.
+ *     Throughput is reported relative to the total size of the corpus' files, whatever the operation reads or writes.
+ */
+class Operation {
+public:
+    /**
+     * Begins measuring an operation.
+     * @param stream The stream to which to print the results
+     * @param corpus The corpus on which the operation is performed
+     * @param name The name identifying the operation in the results
+     */
+    Operation(native_ostream &stream, const Corpus &corpus, std::string name) : stream(stream), corpus(corpus), name(std::move(name)) {}
+
+    /**
+     * Runs and measures one phase of the operation.
+     * @param phase The name identifying the phase in the results
+     * @param task The work making up the phase
+     */
+    template <std::invocable Task>
+    void phase(std::string_view phase, Task &&task) {
+        reset_peak_memory();
+        const auto start = std::chrono::steady_clock::now();
+        task();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const auto peak = peak_memory();
+        seconds += elapsed.count();
+        peak_bytes = std::max(peak_bytes, peak);
+        print(phase, elapsed.count(), peak);
+    }
+
+    /**
+     * Prints the total time and peak memory usage of every phase of the operation.
+     */
+    void finish() const {
+        print("total", seconds, peak_bytes);
+    }
+
+private:
+    native_ostream &stream;
+    const Corpus &corpus;
+    std::string name;
+    double seconds = 0;
+    std::uint64_t peak_bytes = 0;
+
+    void print(std::string_view phase, double elapsed, std::uint64_t peak) const {
+        std::ostringstream line;
+        line << R"({"corpus":")" << corpus.name << R"(","operation":")" << name << R"(","phase":")" << phase
+             << R"(","seconds":)" << elapsed << R"(,"bytes":)" << corpus.size
+             << R"(,"mb_per_s":)" << (elapsed > 0 ? static_cast<double>(corpus.size) / elapsed / 1e6 : 0.0)
+             << R"(,"peak_rss_bytes":)" << peak << '}';
+        stream << line.str().c_str() << std::endl;
+    }
+};
+
+
+/**
+ * Generates pseudorandom text from a small vocabulary, which compresses about as well as typical source code or logs.
+ * @param random The generator from which to draw words
+ * @param size The number of bytes of text to generate
+ * @return The generated text
+ */
+static std::vector<unsigned char> generate_text(std::mt19937_64 &random, std::size_t size) {
+    static constexpr std::string_view words[] {
+        "the", "fuse", "chunk", "image", "segment", "index", "compress", "stream", "return", "const", "value", "size",
+        "header", "for", "while", "if", "else", "struct", "class", "auto", "static", "inline", "void", "unsigned",
+        "{", "}", "(", ")", ";", "=", "+=", "0", "1", "42", "0xFF", "//", "std::vector", "std::span", "png", "data"
+    };
+    std::uniform_int_distribution<std::size_t> pick(0, std::size(words) - 1), line_length(4, 16);
+    std::vector<unsigned char> text;
+    text.reserve(size);
+    while (text.size() < size) {
+        for (auto n = line_length(random); n > 0 && text.size() < size; --n) {
+            const auto word = words[pick(random)];
+            text.insert(text.end(), word.begin(), word.end());
+            text.push_back(' ');
+        }
+        text.back() = '\n';
+    }
+    text.resize(size);
+    return text;
+}
+
+
+/**
+ * Generates pseudorandom bytes, which cannot be compressed.
+ * @param random The generator from which to draw bytes
+ * @param size The number of bytes to generate
+ * @return The generated bytes
+ */
+static std::vector<unsigned char> generate_noise(std::mt19937_64 &random, std::size_t size) {
+    std::vector<unsigned char> noise(size);
+    for (std::size_t i = 0; i < size; i += 8) {
+        const auto word = random();
+        for (std::size_t j = 0; j < 8 && i + j < size; ++j)
+            noise[i + j] = static_cast<unsigned char>(word >> (8 * j));
+    }
+    return noise;
+}
+
+
+/**
+ * Writes a small RGB PNG to use as a fusion host.
+ * @param file The path at which to write the PNG
+ * @param text_chunks The number of @c tEXt chunks to include, split evenly before and after the @c IDAT chunk
+ */
+static void write_host(const path &file, std::size_t text_chunks) {
+    using namespace ImageImplementation;
+    constexpr std::uint32_t WIDTH = 256, HEIGHT = 256;
+    std::array<unsigned char, 13> header{};
+    auto *end = write_big_endian(header.data(), WIDTH);
+    end = write_big_endian(end, HEIGHT);
+    // 8 bits per channel, truecolor, and the standard compression, filter, and interlace methods
+    *end++ = 8;
+    *end++ = 2;
+    std::vector<unsigned char> scanlines;
+    scanlines.reserve(HEIGHT * (1 + WIDTH * 3));
+    for (std::uint32_t y = 0; y < HEIGHT; ++y) {
+        scanlines.push_back(0);
+        for (std::uint32_t x = 0; x < WIDTH; ++x)
+            scanlines.insert(scanlines.end(), {static_cast<unsigned char>(x), static_cast<unsigned char>(y), static_cast<unsigned char>(x ^ y)});
+    }
+
+    std::vector<ManagedByteSpan> chunks;
+    const auto add_text = [&chunks] (std::size_t i) {
+        const auto text = "Comment" + std::string(1, '\0') + "Benchmark filler chunk " + std::to_string(i);
+        chunks.push_back(chunk_encode(std::span(reinterpret_cast<const unsigned char *>(text.data()), text.size()), "tEXt"));
+    };
+    chunks.push_back(chunk_encode(header, "IHDR"));
+    for (std::size_t i = 0; i < text_chunks / 2; ++i)
+        add_text(i);
+    chunks.push_back(chunk_encode(compress(scanlines).data(), "IDAT"));
+    for (std::size_t i = text_chunks / 2; i < text_chunks; ++i)
+        add_text(i);
+    chunks.push_back(chunk_encode(std::span<const unsigned char>{}, "IEND"));
+
+    std::vector<std::span<const unsigned char>> parts {PNG_SIGNATURE};
+    for (const auto &chunk : chunks)
+        parts.push_back(chunk.data());
+    write(file, parts);
+}
+
+
+/**
+ * Corrupts the first DEFLATE block header of a subfile fused without an index, then repairs its chunk's CRC,
+ * so that only the subfile's own checks can find the damage.
+ * @param file The fused PNG to corrupt in place
+ * @param index The index of the subfile to corrupt, counting runs of @c fuSe chunks
+ */
+static void corrupt_sub_file(const path &file, std::size_t index) {
+    using namespace ImageImplementation;
+    auto data = read(file);
+    for (std::size_t offset = 8; offset + 12 <= data.size(); offset += 12 + read_big_endian<std::uint32_t>(&data[offset])) {
+        auto *const chunk = &data[offset];
+        if (!FuseChunk::is_valid(chunk) || !FuseChunk::is_sequence_start(chunk) || index-- != 0)
+            continue;
+        const auto header = FuseChunk::read_header(chunk);
+        if (header.info.has_value() || header.compressed.size() < 3)
+            throw std::runtime_error("Subfile to corrupt is not fused without an index.");
+        // A BTYPE of 3 is reserved, so no DEFLATE decoder accepts the block
+        data[static_cast<std::size_t>(header.compressed.data() - data.data()) + 2] |= 0x06;
+        const auto length = read_big_endian<std::uint32_t>(chunk);
+        write_big_endian(chunk + 8 + length, crc32(std::span<const unsigned char>(chunk + 4, length + 4)));
+        write(file, std::span<const unsigned char>(data));
+        return;
+    }
+    throw std::runtime_error("Subfile to corrupt was not found.");
+}
+
+
+/**
+ * Generates every corpus into a directory.
+ * @param directory The directory in which to write the corpora
+ * @param scale The factor by which to scale the number and size of files from the defaults
+ * @return The generated corpora
+ * @details
+ *     - "tiny": several thousand text files of up to a few KiB each\n
+ *     - "huge": a few text files of tens of MiB each, spanning several segments\n
+ *     - "noise": one incompressible file of tens of MiB\n
+ *     - "chunky": a few hundred small text files fused into a host with thousands of other chunks
+ */
+static std::vector<Corpus> generate_corpora(const path &directory, double scale) {
+    std::mt19937_64 random(CORPUS_SEED);
+    const auto scaled = [scale] (std::size_t n) { return std::max<std::size_t>(static_cast<std::size_t>(static_cast<double>(n) * scale), 1); };
+    const path host = directory / "host.png", chunky_host = directory / "chunky-host.png";
+    write_host(host, 0);
+    write_host(chunky_host, scaled(4000));
+
+    std::vector<Corpus> corpora;
+    const auto add_corpus = [&] (std::string name, const path &host, std::size_t count, auto &&generate) {
+        auto &corpus = corpora.emplace_back(Corpus{name, host, {}, 0});
+        const auto corpus_directory = directory / name;
+        std::filesystem::create_directories(corpus_directory);
+        for (std::size_t i = 0; i < count; ++i) {
+            const auto contents = generate();
+            corpus.files.push_back(corpus_directory / (name + '-' + std::to_string(i) + ".bin"));
+            write(corpus.files.back(), contents);
+            corpus.size += contents.size();
+        }
+    };
+    std::uniform_int_distribution<std::size_t> tiny_size(64, 4096);
+    add_corpus("tiny", host, scaled(5000), [&] { return generate_text(random, tiny_size(random)); });
+    add_corpus("huge", host, 2, [&] { return generate_text(random, scaled(std::size_t{48} << 20)); });
+    add_corpus("noise", host, 1, [&] { return generate_noise(random, scaled(std::size_t{32} << 20)); });
+    add_corpus("chunky", chunky_host, scaled(200), [&] { return generate_text(random, tiny_size(random)); });
+    return corpora;
+}
+
+
+/**
+ * Measures each top-level operation of PNGFuse on a corpus, as performed by the functions in main.cpp.
+ * @param corpus The corpus to fuse, list, verify, extract, and clean
+ * @param directory A scratch directory for the results of each operation
+ * @param compression The settings with which to compress the corpus
+ * @param stream The stream to which to print the results
+ */
+static void measure(const Corpus &corpus, const path &directory, const Compression &compression, native_ostream &stream=native_out) {
+    const auto scratch = directory / (corpus.name + "-out");
+    std::filesystem::create_directories(scratch);
+    const path fused = scratch / "fused.png", solid = scratch / "solid.png", streamed = scratch / "streamed.png",
+               cleaned = scratch / "cleaned.png", appended = scratch / "appended.png";
+    std::optional<SubFileImage> image;
+
+    for (const auto &codec : Codec::all()) {
+        Operation operation(stream, corpus, "codec:" + std::string(codec.name));
+        std::vector<ImageImplementation::ManagedByteSpan> compressed;
+        std::vector<std::vector<unsigned char>> contents;
+        for (const auto &file : corpus.files)
+            contents.push_back(read(file));
+        operation.phase("compress", [&] {
+            for (const auto &file : contents) {
+                const std::span<const unsigned char> data = file;
+                compressed.push_back(codec.compress(ImageImplementation::ByteParts(&data, 1), compression.level));
+            }
+        });
+        operation.phase("decompress", [&] {
+            for (const auto &segment : compressed)
+                codec.decompress(segment.data());
+        });
+        operation.finish();
+    }
+
+    const auto fuse = [&] (std::string name, const path &out, bool packed) {
+        Operation operation(stream, corpus, std::move(name));
+        operation.phase("load", [&] { image.emplace(corpus.host); });
+        operation.phase("encode", [&] {
+            if (packed)
+                image->add_solid_sub_files(corpus.files, compression);
+            else
+                image->add_sub_file(corpus.files, compression);
+        });
+        operation.phase("save", [&] { image->save(out); });
+        operation.finish();
+    };
+    fuse("fuse", fused, false);
+    fuse("fuse_solid", solid, true);
+    {
+        Operation operation(stream, corpus, "fuse_stream");
+        operation.phase("stream", [&] { SubFileImage::fuse_stream(corpus.host, corpus.files, streamed, compression); });
+        operation.finish();
+    }
+    {
+        std::filesystem::copy_file(corpus.host, appended, std::filesystem::copy_options::overwrite_existing);
+        Operation operation(stream, corpus, "append_in_place");
+        operation.phase("append", [&] { SubFileImage::append_sub_files(appended, corpus.files, compression); });
+        operation.finish();
+    }
+
+    for (const auto &[name, file] : {std::pair{"", fused}, std::pair{"_solid", solid}}) {
+        {
+            Operation operation(stream, corpus, std::string("list") + name);
+            operation.phase("load", [&] { image.emplace(file); });
+            operation.phase("list", [&] { static_cast<void>(image->get_sub_file_info()); });
+            operation.finish();
+        }
+        {
+            Operation operation(stream, corpus, std::string("verify") + name);
+            operation.phase("load", [&] { image.emplace(file); });
+            operation.phase("chunks", [&] { static_cast<void>(image->find_corrupt_chunks()); });
+            operation.phase("subfiles", [&] { static_cast<void>(image->verify_sub_files()); });
+            operation.finish();
+        }
+        if (file == fused && !FuseChunk::records_index(compression)) {
+            // One damaged subfile must be reported as corrupt without keeping the others from being checked
+            const auto corrupt = scratch / "corrupt.png";
+            const auto index = corpus.files.size() / 2;
+            std::filesystem::copy_file(fused, corrupt, std::filesystem::copy_options::overwrite_existing);
+            corrupt_sub_file(corrupt, index);
+            Operation operation(stream, corpus, "verify_corrupt");
+            std::vector<SubFileCheck> checks;
+            operation.phase("load", [&] { image.emplace(corrupt); });
+            operation.phase("subfiles", [&] { checks = image->verify_sub_files(); });
+            operation.finish();
+            if (checks.size() != corpus.files.size() || !checks[index].error.has_value()
+                || std::ranges::count_if(checks, [] (const SubFileCheck &check) { return check.error.has_value(); }) != 1)
+                throw std::runtime_error("Verifying did not single out the corrupt subfile in corpus " + corpus.name + '.');
+        }
+        // Subfiles are extracted to the working directory, as by main.cpp
+        const auto extracted = scratch / "extracted";
+        std::filesystem::create_directories(extracted);
+        const auto working_directory = std::filesystem::current_path();
+        std::filesystem::current_path(extracted);
+        try {
+            {
+                Operation operation(stream, corpus, std::string("extract") + name);
+                operation.phase("load", [&] { image.emplace(file); });
+                operation.phase("extract", [&] { image->save_sub_files(); });
+                operation.finish();
+            }
+            {
+                Operation operation(stream, corpus, std::string("extract_one") + name);
+                operation.phase("load", [&] { image.emplace(file); });
+                operation.phase("extract", [&] { image->save_sub_files(corpus.files[corpus.files.size() / 2].filename().u8string()); });
+                operation.finish();
+            }
+        } catch (...) {
+            std::filesystem::current_path(working_directory);
+            throw;
+        }
+        std::filesystem::current_path(working_directory);
+        std::filesystem::remove_all(extracted);
+    }
+
+    {
+        Operation operation(stream, corpus, "clean");
+        operation.phase("load", [&] { image.emplace(fused); });
+        operation.phase("clear", [&] { image->clear_sub_files(); });
+        operation.phase("save", [&] { image->save(cleaned); });
+        operation.finish();
+    }
+    {
+        Operation operation(stream, corpus, "clean_in_place");
+        operation.phase("load", [&] { image.emplace(appended); });
+        operation.phase("clear", [&] { image->clear_sub_files_in_place(); });
+        operation.finish();
+    }
+    image.reset();
+    std::filesystem::remove_all(scratch);
+}
+
+
+/**
+ * Prints the usage information for the program to the specified output stream.
+ * @param program_path The path to the program executable, i.e. @c argv[0]
+ * @param stream The stream to which to print usage info
+ */
+void print_usage(const path &program_path, native_ostream &stream=native_out) {
+    const native_string program_name = program_path.filename().native();
+    stream << "usage: " << program_name << " [-h] [--scale <F>] [--corpus <NAME>] [--dir <PATH>] [--jobs <N>] [--codec <NAME>] [--level <0-9>]" << std::endl
+           << std::endl
+           << "measure PNGFuse operations on synthetic corpora, printing one JSON object per line." << std::endl
+           << std::endl
+           << "optional arguments:" << std::endl
+           << "  -h, --help            show this help message and exit" << std::endl
+           << "      --scale <F>       factor by which to scale the number and size of files (default: 1)" << std::endl
+           << "      --corpus <NAME>   measure only one corpus (tiny, huge, noise, or chunky)" << std::endl
+           << "      --dir <PATH>      directory in which to generate the corpora (default: the system temporary directory)" << std::endl
+           << "  -j, --jobs <N>        number of files and blocks to process at once (default: one per CPU core)" << std::endl
+           << "      --codec <NAME>    compression codec for fused files (default: zlib; available: " << Codec::names() << ")" << std::endl
+           << "      --level <0-9>     compression level for fused files, from 0 (store only) to 9 (smallest, the default)" << std::endl;
+}
+
+
+int main(int argc, char **argv) try {
+    init_unicode();
+    const auto args = native_argv(argc, argv);
+    double scale = 1;
+    std::optional<std::string> only;
+    path root = std::filesystem::temp_directory_path();
+    Compression compression;
+    for (std::size_t i = 1; i < args.size(); ++i) {
+        const native_string &arg = args[i];
+        if (arg == NATIVE_WIDTH("-h") || arg == NATIVE_WIDTH("--help")) {
+            print_usage(args.front());
+            return 0;
+        }
+        if (i + 1 == args.size())
+            throw native_runtime_error(NATIVE_WIDTH("Unknown flag or missing value: ") + arg);
+        const auto value = path(args[++i]).string();
+        const auto integer = [&value, &arg] (unsigned min, unsigned max) {
+            unsigned result;
+            if (const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+                error != std::errc{} || end != value.data() + value.size() || result < min || result > max)
+                throw std::runtime_error("Flag " + path(arg).string() + " must be an integer from " + std::to_string(min) + " to " + std::to_string(max) + '.');
+            return result;
+        };
+        if (arg == NATIVE_WIDTH("--scale")) {
+            // std::from_chars() for floating point is missing from older standard libraries
+            std::istringstream parse(value);
+            if (!(parse >> scale) || !parse.eof() || scale <= 0)
+                throw std::runtime_error("Scale flag must be a positive number.");
+        } else if (arg == NATIVE_WIDTH("--corpus"))
+            only = value;
+        else if (arg == NATIVE_WIDTH("--dir"))
+            root = args[i];
+        else if (arg == NATIVE_WIDTH("-j") || arg == NATIVE_WIDTH("--jobs"))
+            ThreadPool::configure(integer(1, 1024));
+        else if (arg == NATIVE_WIDTH("--codec")) {
+            if (!(compression.codec = Codec::find(value)))
+                throw std::runtime_error("Unknown codec specified: " + value + ". Available codecs: " + Codec::names());
+        } else if (arg == NATIVE_WIDTH("--level"))
+            compression.level = integer(ImageImplementation::STORE_LEVEL, ImageImplementation::MAX_LEVEL);
+        else
+            throw native_runtime_error(NATIVE_WIDTH("Unknown flag specified: ") + arg);
+    }
+
+    // Work in a directory of our own, so that cleaning up never touches anything else in --dir
+    const auto directory = root / ("pngfuse-bench-" + std::to_string(std::random_device{}()));
+    std::filesystem::create_directories(directory);
+    try {
+        std::ostringstream codecs;
+        for (const auto &codec : Codec::all())
+            codecs << (codecs.tellp() > 0 ? "," : "") << '"' << codec.name << '"';
+        std::ostringstream header;
+        header << R"({"benchmark":"pngfuse","jobs":)" << ThreadPool::shared().jobs() << R"(,"scale":)" << scale
+               << R"(,"codec":")" << compression.codec->name << R"(","level":)" << compression.level << R"(,"codecs":[)" << codecs.str() << "]}";
+        native_out << header.str().c_str() << std::endl;
+
+        for (const auto &corpus : generate_corpora(directory, scale))
+            if (!only.has_value() || only.value() == corpus.name)
+                measure(corpus, directory, compression);
+    } catch (...) {
+        std::filesystem::remove_all(directory);
+        throw;
+    }
+    std::filesystem::remove_all(directory);
+    return 0;
+} catch (const native_runtime_error &e) {
+    native_err << "Error: " << e.native_what() << std::endl;
+    return -1;
+} catch (const std::exception &e) {
+    native_err << "Error: " << e.what() << std::endl;
+    return -1;
+}
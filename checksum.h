@@ -0,0 +1,452 @@
+#ifndef PNGFUSE_CHECKSUM_H
+#define PNGFUSE_CHECKSUM_H
+
+/**
+ * Checksums used by PNG chunks and zlib streams, with vectorized kernels selected by the CPU they run on.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PNGFUSE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#if defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64)
+#define PNGFUSE_ARM_CRC32
+#include <arm_acle.h>
+#endif
+#define PNGFUSE_NEON
+#include <arm_neon.h>
+#endif
+
+// MSVC compiles any intrinsic for any target, while GCC and Clang require functions using them to opt in
+#if defined(__GNUC__) || defined(__clang__)
+#define PNGFUSE_TARGET(features) __attribute__((target(features)))
+#else
+#define PNGFUSE_TARGET(features)
+#endif
+
+namespace ImageImplementation {
+    /**
+     * A function that continues a running checksum over more data.
+     */
+    using ChecksumKernel = std::uint32_t (*)(std::span<const unsigned char> data, std::uint32_t checksum);
+
+    /**
+     * The modulus of the Adler-32 sums.
+     */
+    constexpr std::uint32_t ADLER32_BASE = 65521;
+    /**
+     * The largest run of bytes whose Adler-32 sums cannot overflow 32 bits before being reduced.
+     */
+    constexpr std::size_t ADLER32_MAX_RUN = 5552;
+
+    /**
+     * Computes the Adler-32 checksum of @p data one byte at a time, on any CPU.
+     * @param data Bytes to be checksummed
+     * @param adler A running checksum to continue from, or 1 to start a new checksum
+     * @return The Adler-32 checksum of @p data, continued from @p adler
+     */
+    constexpr std::uint32_t adler32_portable(std::span<const unsigned char> data, std::uint32_t adler=1) {
+        std::uint32_t a = adler & 0xFFFF, b = adler >> 16;
+        while (!data.empty()) {
+            const auto run = data.first(std::min(data.size(), ADLER32_MAX_RUN));
+            for (const auto byte : run) {
+                a += byte;
+                b += a;
+            }
+            a %= ADLER32_BASE;
+            b %= ADLER32_BASE;
+            data = data.subspan(run.size());
+        }
+        return (b << 16) | a;
+    }
+
+    /**
+     * A lookup table for the CRC-32 used by PNG chunks and zlib, for the reflected polynomial @c 0xEDB88320.
+     */
+    constexpr std::array<std::uint32_t, 256> CRC32_TABLE = [] {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    /**
+     * Computes the CRC-32 of @p data one byte at a time using @c CRC32_TABLE, on any CPU.
+     * @param data Bytes to be checksummed
+     * @param crc A running checksum to continue from, or 0 to start a new checksum
+     * @return The CRC-32 of @p data, continued from @p crc
+     */
+    constexpr std::uint32_t crc32_portable(std::span<const unsigned char> data, std::uint32_t crc=0) {
+        crc = ~crc;
+        for (const auto byte : data)
+            crc = CRC32_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+#ifdef PNGFUSE_X86
+    /**
+     * Loads 16 bytes from any address into a vector.
+     * @param bytes A pointer to the bytes to be loaded
+     * @return A vector holding the 16 bytes at @p bytes
+     */
+    inline __m128i load_128(const unsigned char *bytes) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+    }
+
+    /**
+     * Multiplies the halves of a 128-bit CRC remainder by a pair of folding constants, moving it along the input, and adds the next block.
+     * @param x The remainder to be folded
+     * @param k The folding constants for the distance moved, in the low and high halves
+     * @param next The block of input at the destination of the fold
+     * @return The folded remainder
+     */
+    PNGFUSE_TARGET("pclmul,sse4.1")
+    inline __m128i crc32_fold(__m128i x, __m128i k, __m128i next) {
+        return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00)), next);
+    }
+
+    /**
+     * Computes the CRC-32 of @p data by folding 64 bytes at a time with carry-less multiplication.
+     * @param data Bytes to be checksummed
+     * @param crc A running checksum to continue from, or 0 to start a new checksum
+     * @return The CRC-32 of @p data, continued from @p crc
+     * @details
+     *     Follows "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal et al., Intel, 2009),
+     *     with the constants for the bit-reflected polynomial given at its end.
+     *     Inputs shorter than 64 bytes, and the last few bytes of any input, are finished by @c crc32_portable().
+     */
+    PNGFUSE_TARGET("pclmul,sse4.1")
+    inline std::uint32_t crc32_pclmul(std::span<const unsigned char> data, std::uint32_t crc=0) {
+        if (data.size() < 64)
+            return crc32_portable(data, crc);
+        const auto *bytes = data.data();
+        auto remaining = data.size();
+
+        __m128i x1 = _mm_xor_si128(load_128(bytes), _mm_cvtsi32_si128(static_cast<int>(~crc)));
+        __m128i x2 = load_128(bytes + 16), x3 = load_128(bytes + 32), x4 = load_128(bytes + 48);
+        bytes += 64;
+        remaining -= 64;
+
+        // Fold four independent 128-bit remainders in parallel, each 512 bits along the input per step
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+        for (; remaining >= 64; bytes += 64, remaining -= 64) {
+            x1 = crc32_fold(x1, k1k2, load_128(bytes));
+            x2 = crc32_fold(x2, k1k2, load_128(bytes + 16));
+            x3 = crc32_fold(x3, k1k2, load_128(bytes + 32));
+            x4 = crc32_fold(x4, k1k2, load_128(bytes + 48));
+        }
+
+        // Fold the four remainders into one, and then any remaining 16-byte blocks into it
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+        x1 = crc32_fold(crc32_fold(crc32_fold(x1, k3k4, x2), k3k4, x3), k3k4, x4);
+        for (; remaining >= 16; bytes += 16, remaining -= 16)
+            x1 = crc32_fold(x1, k3k4, load_128(bytes));
+
+        // Fold 128 bits down to 64
+        const __m128i low_32 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+        const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+        x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low_32), k5, 0x00), _mm_srli_si128(x1, 4));
+
+        // Barrett reduction to 32 bits
+        const __m128i polynomial = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+        __m128i reduced = _mm_clmulepi64_si128(_mm_and_si128(x1, low_32), polynomial, 0x10);
+        reduced = _mm_clmulepi64_si128(_mm_and_si128(reduced, low_32), polynomial, 0x00);
+        crc = ~static_cast<std::uint32_t>(_mm_extract_epi32(_mm_xor_si128(x1, reduced), 1));
+        return crc32_portable({bytes, remaining}, crc);
+    }
+
+    /**
+     * Adds up the eight 32-bit lanes of an AVX2 vector.
+     * @param v The vector to be summed
+     * @return The sum of the lanes of @p v, modulo 2^32
+     */
+    PNGFUSE_TARGET("avx2")
+    inline std::uint32_t sum_lanes_avx2(__m256i v) {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<std::uint32_t>(_mm_cvtsi128_si32(sum));
+    }
+
+    /**
+     * Computes the Adler-32 checksum of @p data 32 bytes at a time with AVX2.
+     * @param data Bytes to be checksummed
+     * @param adler A running checksum to continue from, or 1 to start a new checksum
+     * @return The Adler-32 checksum of @p data, continued from @p adler
+     * @details
+     *     Each 32-byte block adds the sum of its bytes to @c a, and to @c b both 32 times the prior @c a
+     *     and its bytes weighted by their distance from the end of the block.
+     *     Both sums are kept in vector lanes for as many blocks as fit in @c ADLER32_MAX_RUN, and reduced once per run.
+     */
+    PNGFUSE_TARGET("avx2")
+    inline std::uint32_t adler32_avx2(std::span<const unsigned char> data, std::uint32_t adler=1) {
+        constexpr std::size_t BLOCK_SIZE = 32;
+        std::uint32_t a = adler & 0xFFFF, b = adler >> 16;
+        const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                                 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+        const __m256i ones = _mm256_set1_epi16(1);
+        const __m256i zero = _mm256_setzero_si256();
+
+        const auto *bytes = data.data();
+        for (auto blocks = data.size() / BLOCK_SIZE; blocks > 0; ) {
+            const auto run = std::min(blocks, ADLER32_MAX_RUN / BLOCK_SIZE);
+            blocks -= run;
+            // The sum of a before each block of the run, multiplied by the block size once the run is done
+            __m256i prior_a = _mm256_setr_epi32(static_cast<int>(a * run), 0, 0, 0, 0, 0, 0, 0);
+            __m256i block_a = zero, block_b = _mm256_setr_epi32(static_cast<int>(b), 0, 0, 0, 0, 0, 0, 0);
+            for (std::size_t i = 0; i < run; ++i, bytes += BLOCK_SIZE) {
+                const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes));
+                prior_a = _mm256_add_epi32(prior_a, block_a);
+                block_a = _mm256_add_epi32(block_a, _mm256_sad_epu8(block, zero));
+                block_b = _mm256_add_epi32(block_b, _mm256_madd_epi16(_mm256_maddubs_epi16(block, weights), ones));
+            }
+            block_b = _mm256_add_epi32(block_b, _mm256_slli_epi32(prior_a, 5));
+            a = (a + sum_lanes_avx2(block_a)) % ADLER32_BASE;
+            b = sum_lanes_avx2(block_b) % ADLER32_BASE;
+        }
+        return adler32_portable({bytes, data.size() % BLOCK_SIZE}, (b << 16) | a);
+    }
+
+    /**
+     * Determines which vectorized checksum instructions the CPU and operating system support.
+     * @return Whether PCLMULQDQ with SSE4.1 and AVX2 are available, in that order
+     */
+    inline std::pair<bool, bool> x86_checksum_features() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        const auto max_leaf = info[0];
+        __cpuid(info, 1);
+        const bool pclmul = info[2] & (1 << 1) && info[2] & (1 << 19);
+        // AVX2 also requires the operating system to save the upper halves of the vector registers
+        const bool avx_os = info[2] & (1 << 27) && info[2] & (1 << 28) && (_xgetbv(0) & 6) == 6;
+        if (max_leaf < 7)
+            return {pclmul, false};
+        __cpuidex(info, 7, 0);
+        return {pclmul, avx_os && info[1] & (1 << 5)};
+#else
+        __builtin_cpu_init();
+        return {__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"), __builtin_cpu_supports("avx2")};
+#endif
+    }
+#endif
+
+#ifdef PNGFUSE_ARM_CRC32
+    /**
+     * Computes the CRC-32 of @p data 8 bytes at a time using the ARMv8 CRC32 instructions.
+     * @param data Bytes to be checksummed
+     * @param crc A running checksum to continue from, or 0 to start a new checksum
+     * @return The CRC-32 of @p data, continued from @p crc
+     */
+    inline std::uint32_t crc32_armv8(std::span<const unsigned char> data, std::uint32_t crc=0) {
+        crc = ~crc;
+        auto *bytes = data.data();
+        auto remaining = data.size();
+        for (; remaining >= 8; bytes += 8, remaining -= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, bytes, sizeof(word));
+            crc = __crc32d(crc, word);
+        }
+        for (; remaining > 0; ++bytes, --remaining)
+            crc = __crc32b(crc, *bytes);
+        return ~crc;
+    }
+#endif
+
+#ifdef PNGFUSE_NEON
+    /**
+     * Computes the Adler-32 checksum of @p data 32 bytes at a time with NEON.
+     * @param data Bytes to be checksummed
+     * @param adler A running checksum to continue from, or 1 to start a new checksum
+     * @return The Adler-32 checksum of @p data, continued from @p adler
+     * @details
+     *     As in @c adler32_avx2(), but the bytes at each position of a block are summed into 16-bit columns over the run,
+     *     and only weighted by their distance from the end of the block once the run is done.
+     */
+    inline std::uint32_t adler32_neon(std::span<const unsigned char> data, std::uint32_t adler=1) {
+        constexpr std::size_t BLOCK_SIZE = 32;
+        static constexpr std::uint16_t WEIGHTS[BLOCK_SIZE] {32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                                            16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+        std::uint32_t a = adler & 0xFFFF, b = adler >> 16;
+        const auto *bytes = data.data();
+        for (auto blocks = data.size() / BLOCK_SIZE; blocks > 0; ) {
+            const auto run = std::min(blocks, ADLER32_MAX_RUN / BLOCK_SIZE);
+            blocks -= run;
+            uint32x4_t prior_a = vsetq_lane_u32(static_cast<std::uint32_t>(a * run), vdupq_n_u32(0), 0);
+            uint32x4_t block_a = vdupq_n_u32(0);
+            uint16x8_t columns[4] {vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0)};
+            for (std::size_t i = 0; i < run; ++i, bytes += BLOCK_SIZE) {
+                const uint8x16_t low = vld1q_u8(bytes), high = vld1q_u8(bytes + 16);
+                prior_a = vaddq_u32(prior_a, block_a);
+                block_a = vpadalq_u16(block_a, vpadalq_u8(vpaddlq_u8(low), high));
+                columns[0] = vaddw_u8(columns[0], vget_low_u8(low));
+                columns[1] = vaddw_u8(columns[1], vget_high_u8(low));
+                columns[2] = vaddw_u8(columns[2], vget_low_u8(high));
+                columns[3] = vaddw_u8(columns[3], vget_high_u8(high));
+            }
+            uint32x4_t block_b = vshlq_n_u32(prior_a, 5);
+            for (std::size_t i = 0; i < 4; ++i) {
+                block_b = vmlal_u16(block_b, vget_low_u16(columns[i]), vld1_u16(WEIGHTS + 8 * i));
+                block_b = vmlal_u16(block_b, vget_high_u16(columns[i]), vld1_u16(WEIGHTS + 8 * i + 4));
+            }
+            a = (a + vaddvq_u32(block_a)) % ADLER32_BASE;
+            b = (b + vaddvq_u32(block_b)) % ADLER32_BASE;
+        }
+        return adler32_portable({bytes, data.size() % BLOCK_SIZE}, (b << 16) | a);
+    }
+#endif
+
+    /**
+     * Selects the fastest CRC-32 kernel supported by the CPU running the program.
+     * @return A kernel equivalent to @c crc32_portable()
+     */
+    inline ChecksumKernel select_crc32_kernel() {
+#if defined(PNGFUSE_X86)
+        if (x86_checksum_features().first)
+            return &crc32_pclmul;
+#elif defined(PNGFUSE_ARM_CRC32)
+        return &crc32_armv8;
+#endif
+        return [] (std::span<const unsigned char> data, std::uint32_t crc) { return crc32_portable(data, crc); };
+    }
+
+    /**
+     * Selects the fastest Adler-32 kernel supported by the CPU running the program.
+     * @return A kernel equivalent to @c adler32_portable()
+     */
+    inline ChecksumKernel select_adler32_kernel() {
+#if defined(PNGFUSE_X86)
+        if (x86_checksum_features().second)
+            return &adler32_avx2;
+#elif defined(PNGFUSE_NEON)
+        return &adler32_neon;
+#endif
+        return [] (std::span<const unsigned char> data, std::uint32_t adler) { return adler32_portable(data, adler); };
+    }
+
+    /**
+     * Computes the Adler-32 checksum of @p data, as used in the zlib stream trailer.
+     * @param data Bytes to be checksummed
+     * @param adler A running checksum to continue from, or 1 to start a new checksum
+     * @return The Adler-32 checksum of @p data, continued from @p adler
+     * @details Uses the fastest kernel the CPU supports, selected on first use.
+     */
+    inline std::uint32_t adler32(std::span<const unsigned char> data, std::uint32_t adler=1) {
+        static const auto kernel = select_adler32_kernel();
+        return kernel(data, adler);
+    }
+
+    /**
+     * Computes the CRC-32 of @p data with the fastest kernel the CPU supports, selected on first use.
+     * @param data Bytes to be checksummed
+     * @param crc A running checksum to continue from, or 0 to start a new checksum
+     * @return The CRC-32 of @p data, continued from @p crc
+     */
+    inline std::uint32_t crc32_dispatch(std::span<const unsigned char> data, std::uint32_t crc) {
+        static const auto kernel = select_crc32_kernel();
+        return kernel(data, crc);
+    }
+
+    /**
+     * Computes the CRC-32 of @p data, as used for PNG chunks, such that it may be computed incrementally.
+     * @param data Bytes to be checksummed
+     * @param crc A running checksum to continue from, or 0 to start a new checksum
+     * @return The CRC-32 of @p data, continued from @p crc
+     * @details At run time, uses the fastest kernel the CPU supports, selected on first use.
+     */
+    constexpr std::uint32_t crc32(std::span<const unsigned char> data, std::uint32_t crc=0) {
+        if (std::is_constant_evaluated())
+            return crc32_portable(data, crc);
+        return crc32_dispatch(data, crc);
+    }
+
+    /**
+     * Multiplies two polynomials modulo the CRC-32 polynomial, in the bit-reflected representation of @c CRC32_TABLE.
+     * @param a A polynomial, which must be nonzero
+     * @param b A polynomial
+     * @return The product of @p a and @p b modulo the CRC-32 polynomial
+     */
+    constexpr std::uint32_t crc32_multiply(std::uint32_t a, std::uint32_t b) {
+        // via zlib's multmodp()
+        std::uint32_t m = 1u << 31, product = 0;
+        while (true) {
+            if (a & m) {
+                product ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ 0xEDB88320u : b >> 1;
+        }
+        return product;
+    }
+
+    /**
+     * Powers of two of x modulo the CRC-32 polynomial, where entry @c k is <tt>x^(2^k)</tt>.
+     */
+    constexpr std::array<std::uint32_t, 32> CRC32_POWERS = [] {
+        std::array<std::uint32_t, 32> powers{};
+        powers[0] = 1u << 30;
+        for (std::size_t k = 1; k < powers.size(); ++k)
+            powers[k] = crc32_multiply(powers[k - 1], powers[k - 1]);
+        return powers;
+    }();
+
+    /**
+     * Combines the CRC-32s of two adjacent byte sequences into the CRC-32 of their concatenation.
+     * @param crc_1 The CRC-32 of the first sequence
+     * @param crc_2 The CRC-32 of the second sequence
+     * @param length_2 The length of the second sequence in bytes
+     * @return The CRC-32 of the first sequence followed by the second
+     */
+    constexpr std::uint32_t crc32_combine(std::uint32_t crc_1, std::uint32_t crc_2, std::uint64_t length_2) {
+        // via zlib's crc32_combine64(), shifting crc_1 past length_2 bytes by multiplying it by x^(8 * length_2)
+        std::uint32_t shift = 1u << 31;
+        for (std::size_t k = 3; length_2 != 0; length_2 >>= 1, ++k)
+            if (length_2 & 1)
+                shift = crc32_multiply(CRC32_POWERS[k % 32], shift);
+        return crc32_multiply(shift, crc_1) ^ crc_2;
+    }
+
+    /**
+     * Combines the Adler-32 checksums of two adjacent byte sequences into the checksum of their concatenation.
+     * @param adler_1 The Adler-32 checksum of the first sequence
+     * @param adler_2 The Adler-32 checksum of the second sequence
+     * @param length_2 The length of the second sequence in bytes
+     * @return The Adler-32 checksum of the first sequence followed by the second
+     */
+    constexpr std::uint32_t adler32_combine(std::uint32_t adler_1, std::uint32_t adler_2, std::size_t length_2) {
+        // via zlib's adler32_combine_()
+        constexpr std::uint32_t BASE = ADLER32_BASE;
+        const auto remainder = static_cast<std::uint32_t>(length_2 % BASE);
+        std::uint32_t sum_1 = adler_1 & 0xFFFF;
+        std::uint32_t sum_2 = static_cast<std::uint32_t>((static_cast<std::uint64_t>(remainder) * sum_1) % BASE);
+        sum_1 += (adler_2 & 0xFFFF) + BASE - 1;
+        sum_2 += (adler_1 >> 16) + (adler_2 >> 16) + BASE - remainder;
+        if (sum_1 >= BASE) sum_1 -= BASE;
+        if (sum_1 >= BASE) sum_1 -= BASE;
+        if (sum_2 >= BASE << 1) sum_2 -= BASE << 1;
+        if (sum_2 >= BASE) sum_2 -= BASE;
+        return (sum_2 << 16) | sum_1;
+    }
+}
+
+#endif //PNGFUSE_CHECKSUM_H
@@ -0,0 +1,135 @@
+#ifndef PNGFUSE_CHUNKCACHE_H
+#define PNGFUSE_CHUNKCACHE_H
+
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "codec.h"
+
+/**
+ * A persistent on-disk cache of encoded runs of @c fuSe chunks, keyed by the contents and filename of a subfile and the settings it was compressed with.
+ * @details
+ *     Fusing the same file again, as when a pipeline embeds one license bundle into thousands of PNGs,
+ *     then reuses the chunks encoded the first time instead of compressing the file again.\n
+ *     Each entry is a file in the cache directory named after its key:
+ *     the size, CRC-32, and Adler-32 of the subfile's contents, the CRC-32 of its filename, the codec and level, and whether an index is recorded.
+ *     These checksums are not cryptographic, so a cache directory should only be shared between trusted writers.
+ *     Entries are written to a temporary file that is then renamed into place, so that several processes may share a cache,
+ *     and every chunk CRC of an entry is checked before it is used.
+ */
+class ChunkCache {
+public:
+    /**
+     * Opens a cache stored in @p directory, creating the directory if it does not exist.
+     * @param directory The directory in which cache entries are stored
+     * @throw @c native_runtime_error if @p directory could not be created
+     */
+    explicit ChunkCache(std::filesystem::path directory) : directory(std::move(directory)) {
+        std::error_code error;
+        std::filesystem::create_directories(this->directory, error);
+        if (error)
+            throw native_runtime_error(NATIVE_WIDTH("Could not create cache directory ") + this->directory.native() + NATIVE_WIDTH('.'));
+    }
+
+    /**
+     * Determines the path of the cache entry for a subfile from its key.
+     * @param filename The UTF-8 encoded filename of the subfile
+     * @param contents The contents of the subfile
+     * @param checksum The CRC-32 of @p contents
+     * @param compression The settings with which the subfile is compressed
+     * @return The path within the cache directory at which the subfile's entry is stored, for @c find() and @c store()
+     */
+    [[nodiscard]] std::filesystem::path entry(std::u8string_view filename, std::span<const unsigned char> contents,
+                                              std::uint32_t checksum, const Compression &compression) const {
+        using namespace ImageImplementation;
+        const auto append_hex = [] (std::string &out, std::uint64_t value, int digits) {
+            for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4)
+                out.push_back("0123456789abcdef"[(value >> shift) & 0xF]);
+        };
+        std::string name;
+        append_hex(name, contents.size(), 16);
+        name.push_back('-');
+        append_hex(name, checksum, 8);
+        append_hex(name, adler32(contents), 8);
+        name.push_back('-');
+        append_hex(name, crc32(std::span(reinterpret_cast<const unsigned char *>(filename.data()), filename.size())), 8);
+        name.append("-").append(compression.codec->name).append("-").append(std::to_string(compression.level));
+        if (compression.index)
+            name.append("-indexed");
+        name.append(".fuse");
+        return directory / name;
+    }
+
+    /**
+     * Looks up the encoded chunks of a subfile in the cache.
+     * @param file The path of the subfile's cache entry, as returned by @c entry()
+     * @return The cached run of PNG chunks, or @c std::nullopt if there is no intact entry for the subfile
+     * @details The caller should still check that the chunks hold the subfile, since the key does not identify it with certainty.
+     */
+    [[nodiscard]] std::optional<ImageImplementation::ManagedByteSpan> find(const std::filesystem::path &file) const {
+        using namespace ImageImplementation;
+        std::error_code error;
+        if (!std::filesystem::exists(file, error))
+            return std::nullopt;
+        try {
+            const MappedFile mapped(file);
+            const auto data = mapped.data();
+            // Check that the entry is a complete run of intact fuSe chunks, in case it was damaged or only partly written
+            for (std::size_t offset = 0; offset < data.size();) {
+                if (data.size() - offset < 12 || std::memcmp(&data[offset + 4], "fuSe", 4) != 0)
+                    return std::nullopt;
+                const std::size_t length = read_big_endian<std::uint32_t>(&data[offset]);
+                if (length > data.size() - offset - 12
+                    || crc32(data.subspan(offset + 4, length + 4)) != read_big_endian<std::uint32_t>(&data[offset + 8 + length]))
+                    return std::nullopt;
+                offset += length + 12;
+            }
+            if (data.empty())
+                return std::nullopt;
+            auto chunks = ManagedByteSpan::allocate(data.size());
+            std::ranges::copy(data, chunks.data().begin());
+            return chunks;
+        } catch (const native_runtime_error &) {
+            // Thrown by MappedFile, which is not a std::exception
+            return std::nullopt;
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+    }
+
+    /**
+     * Stores the encoded chunks of a subfile in the cache, replacing any existing entry for it.
+     * @param file The path of the subfile's cache entry, as returned by @c entry()
+     * @param chunks The run of PNG chunks encoding the subfile
+     * @details The cache is only an optimization, so failing to write an entry is not an error.
+     */
+    void store(const std::filesystem::path &file, std::span<const unsigned char> chunks) const {
+        auto temporary = file;
+        temporary += ".tmp" + std::to_string(std::random_device{}());
+        try {
+            write(temporary, chunks);
+            std::filesystem::rename(temporary, file);
+        } catch (const native_runtime_error &) {
+            // Thrown by write(), which is not a std::exception
+            std::error_code ignored;
+            std::filesystem::remove(temporary, ignored);
+        } catch (const std::exception &) {
+            std::error_code ignored;
+            std::filesystem::remove(temporary, ignored);
+        }
+    }
+
+private:
+    /**
+     * The directory in which cache entries are stored.
+     */
+    std::filesystem::path directory;
+};
+
+#endif //PNGFUSE_CHUNKCACHE_H
@@ -0,0 +1,464 @@
+#ifndef PNGFUSE_CODEC_H
+#define PNGFUSE_CODEC_H
+
+#include <array>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "image.h"
+
+#ifdef PNGFUSE_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef PNGFUSE_USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef PNGFUSE_USE_LZ4
+#include <lz4frame.h>
+#endif
+
+/**
+ * A compression backend for the segments of @c fuSe chunks, identified by the compression method byte in their header.
+ * @details
+ *     The zlib codec (method 0) is always available and is the default, keeping @c fuSe chunks readable by any inflater.
+ *     Other backends are opt-in, and are only registered when PNGFuse is built against their library
+ *     by defining the corresponding macro:\n
+ *     - @c PNGFUSE_USE_LIBDEFLATE: "libdeflate", a faster implementation of the zlib codec that writes method 0 and reads it in turn\n
+ *     - @c PNGFUSE_USE_ZSTD: "zstd", method 1\n
+ *     - @c PNGFUSE_USE_LZ4: "lz4", method 2, stored as LZ4 frames\n
+ *     When reading, chunks are decompressed with the first registered codec for their method byte.
+ */
+struct Codec {
+    /**
+     * The compression method byte written into the @c fuSe chunk header.
+     */
+    unsigned char method;
+    /**
+     * The name used to select this codec on the command line.
+     */
+    std::string_view name;
+    /**
+     * Compresses a segment, gathered from the concatenation of several buffers,
+     * at a level from 1 to @c ImageImplementation::MAX_LEVEL, mapped onto the backend's own range of levels.
+     * The output must be decompressible by any codec registered for the same @c method.
+     */
+    ImageImplementation::ManagedByteSpan (*compress)(ImageImplementation::ByteParts parts, unsigned level);
+    /**
+     * Decompresses a segment written by @c compress.
+     */
+    ImageImplementation::ManagedByteSpan (*decompress)(std::span<const unsigned char> compressed);
+    /**
+     * Decompresses a segment written by @c compress only to measure and checksum it, through a fixed-size buffer,
+     * excluding the first @c skip bytes of decompressed data. Throws @c std::runtime_error if the segment is corrupt.
+     */
+    ImageImplementation::StreamDigest (*digest)(std::span<const unsigned char> compressed, std::uint64_t skip);
+
+    static constexpr unsigned char ZLIB_METHOD = 0;
+    static constexpr unsigned char ZSTD_METHOD = 1;
+    static constexpr unsigned char LZ4_METHOD = 2;
+
+    /**
+     * Enumerates every codec PNGFuse was built with.
+     * @return The registered codecs, in order of preference for decompression
+     */
+    static std::span<const Codec> all();
+
+    /**
+     * The default codec, which writes @c zTXt-compatible zlib streams using LodePNG.
+     * @return The zlib codec
+     */
+    static const Codec &standard() { return all().back(); }
+
+    /**
+     * Finds the codec used to decompress segments with the compression method byte @p method.
+     * @param method A compression method byte read from a @c fuSe chunk header
+     * @return The preferred codec for @p method, or @c nullptr if PNGFuse was built without one
+     */
+    static const Codec *find(unsigned char method) {
+        for (const auto &codec : all())
+            if (codec.method == method)
+                return &codec;
+        return nullptr;
+    }
+
+    /**
+     * Finds a codec by its command line name.
+     * @param name The name of the codec, e.g. "zlib"
+     * @return The codec named @p name, or @c nullptr if PNGFuse was built without one
+     */
+    static const Codec *find(std::string_view name) {
+        for (const auto &codec : all())
+            if (codec.name == name)
+                return &codec;
+        return nullptr;
+    }
+
+    /**
+     * Lists the names of every codec PNGFuse was built with, for messages.
+     * @return The codec names, separated by commas
+     */
+    static std::string names() {
+        std::string joined;
+        for (const auto &codec : all())
+            joined.append(joined.empty() ? "" : ", ").append(codec.name);
+        return joined;
+    }
+};
+
+class ChunkCache;
+
+/**
+ * The settings with which the segments of fused subfiles are compressed.
+ */
+struct Compression {
+    /**
+     * The codec with which to compress segments.
+     */
+    const Codec *codec = &Codec::standard();
+    /**
+     * The compression level, from @c ImageImplementation::STORE_LEVEL to @c ImageImplementation::MAX_LEVEL.
+     */
+    unsigned level = ImageImplementation::MAX_LEVEL;
+    /**
+     * Whether to record an index of each subfile's name, size, and checksum even when it is compressed with zlib,
+     * so that it can be listed and verified without decompressing it, at the cost of versions of PNGFuse that predate the index being unable to read it.
+     */
+    bool index = false;
+    /**
+     * A cache of previously encoded subfiles to reuse instead of compressing them again, if any.
+     */
+    const ChunkCache *cache = nullptr;
+
+    /**
+     * Compresses one segment, storing it without compression instead if it is incompressible.
+     * @param segment The buffers whose concatenation forms the bytes to be compressed
+     * @return The compression method byte to record for the segment, and its compressed form
+     * @details
+     *     Segments are stored as zlib streams of uncompressed DEFLATE blocks, which any reader can decode,
+     *     whenever the level is @c ImageImplementation::STORE_LEVEL, the segment's entropy is too high to gain from compressing it,
+     *     or compressing it turned out not to make it any smaller.
+     */
+    [[nodiscard]] std::pair<unsigned char, ImageImplementation::ManagedByteSpan> compress(ImageImplementation::ByteParts segment) const {
+        PNGFUSE_TRACE_SCOPE("compress", ImageImplementation::total_size(segment));
+        using namespace ImageImplementation;
+        if (level != STORE_LEVEL && !is_incompressible(segment)) {
+            auto compressed = codec->compress(segment, level);
+            const auto size = total_size(segment);
+            // A stored zlib stream adds 5 bytes per 64 KiB block, plus a 2-byte header and 4-byte checksum
+            if (compressed.size() < size + size / 65535 * 5 + 11)
+                return {codec->method, std::move(compressed)};
+        }
+        return {Codec::ZLIB_METHOD, ImageImplementation::compress(segment, STORE_LEVEL)};
+    }
+};
+
+namespace ImageImplementation {
+#ifdef PNGFUSE_USE_LIBDEFLATE
+    /**
+     * Compresses @p parts into a zlib stream using libdeflate.
+     * @param parts The buffers whose concatenation forms the bytes to be compressed
+     * @param level The compression level, from 1 to @c MAX_LEVEL
+     * @return A @c ManagedByteSpan holding a zlib stream containing a compressed form of @p parts
+     * @details
+     *     libdeflate has no streaming interface, so several parts are first joined in a buffer reused by each thread.
+     *     Each thread also keeps a compressor for every level it has used, since allocating one costs far more than compressing a small file.
+     */
+    inline ManagedByteSpan libdeflate_compress(ByteParts parts, unsigned level) {
+        static thread_local std::vector<unsigned char> scratch;
+        const auto data = gather(parts, 0, total_size(parts), scratch);
+        // libdeflate levels range from 1 to 12
+        const auto libdeflate_level = static_cast<int>((level * 12 + MAX_LEVEL - 1) / MAX_LEVEL);
+        struct FreeCompressor {
+            void operator()(libdeflate_compressor *compressor) const { libdeflate_free_compressor(compressor); }
+        };
+        static thread_local std::array<std::unique_ptr<libdeflate_compressor, FreeCompressor>, 13> compressors;
+        auto &compressor = compressors[libdeflate_level];
+        if (!compressor)
+            compressor.reset(libdeflate_alloc_compressor(libdeflate_level));
+        if (!compressor)
+            throw std::bad_alloc();
+        const auto bound = libdeflate_zlib_compress_bound(compressor.get(), data.size());
+        auto buffer = ManagedByteSpan::allocate(bound);
+        buffer.shrink(libdeflate_zlib_compress(compressor.get(), data.data(), data.size(), buffer.data().data(), bound));
+        return buffer;
+    }
+
+    /**
+     * Decompresses the zlib stream in @p compressed using libdeflate, growing the output buffer until it fits.
+     * @param compressed zlib-compressed bytes to be decompressed
+     * @return A @c ManagedByteSpan holding uncompressed data extracted from @p compressed
+     */
+    inline ManagedByteSpan libdeflate_decompress(std::span<const unsigned char> compressed) {
+        // Reused by every segment decompressed on this thread
+        static thread_local const std::unique_ptr<libdeflate_decompressor, decltype(&libdeflate_free_decompressor)> decompressor(libdeflate_alloc_decompressor(), &libdeflate_free_decompressor);
+        if (!decompressor)
+            throw std::bad_alloc();
+        for (std::size_t capacity = std::max<std::size_t>(compressed.size() * 4, 4096); ; capacity *= 2) {
+            auto buffer = ManagedByteSpan::allocate(capacity);
+            std::size_t size = 0;
+            const auto result = libdeflate_zlib_decompress(decompressor.get(), compressed.data(), compressed.size(),
+                                                           buffer.data().data(), capacity, &size);
+            if (result == LIBDEFLATE_SUCCESS) {
+                buffer.shrink(size);
+                return buffer;
+            }
+            if (result != LIBDEFLATE_INSUFFICIENT_SPACE)
+                throw std::runtime_error("Encountered corrupt zlib stream");
+        }
+    }
+#endif
+
+#if defined(PNGFUSE_USE_ZSTD) || defined(PNGFUSE_USE_LZ4)
+    /**
+     * The most output allocated up front on the strength of the content size a frame declares, which is as much as one segment written by this version holds.
+     * A frame declaring more only gets a larger buffer as its decompressed output actually arrives.
+     */
+    constexpr std::size_t MAX_DECLARED_CAPACITY = std::size_t{1} << 25;
+#endif
+
+#ifdef PNGFUSE_USE_ZSTD
+    /**
+     * Compresses @p parts into a zstd frame that records its uncompressed size.
+     * @param parts The buffers whose concatenation forms the bytes to be compressed
+     * @param level The compression level, from 1 to @c MAX_LEVEL
+     * @return A @c ManagedByteSpan holding a compressed form of @p parts
+     */
+    inline ManagedByteSpan zstd_compress(ByteParts parts, unsigned level) {
+        // zstd levels range from 1 to 19 without --ultra
+        constexpr int ZSTD_LEVELS[MAX_LEVEL + 1] {0, 1, 2, 3, 5, 7, 9, 12, 16, 19};
+        // Reused by every segment compressed on this thread, keeping its tables allocated between frames
+        static thread_local const std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+        if (!context)
+            throw std::bad_alloc();
+        const auto size = total_size(parts);
+        ZSTD_CCtx_reset(context.get(), ZSTD_reset_session_and_parameters);
+        ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel, ZSTD_LEVELS[std::min(level, MAX_LEVEL)]);
+        ZSTD_CCtx_setPledgedSrcSize(context.get(), size);
+        const auto bound = ZSTD_compressBound(size);
+        auto buffer = ManagedByteSpan::allocate(bound);
+        ZSTD_outBuffer output{buffer.data().data(), bound, 0};
+        for (std::size_t i = 0; i <= parts.size(); ++i) {
+            // An empty final input ends the frame once everything before it has been consumed
+            const auto part = i < parts.size() ? parts[i] : std::span<const unsigned char>{};
+            const auto directive = i < parts.size() ? ZSTD_e_continue : ZSTD_e_end;
+            ZSTD_inBuffer input{part.data(), part.size(), 0};
+            std::size_t remaining;
+            do {
+                remaining = ZSTD_compressStream2(context.get(), &output, &input, directive);
+                if (ZSTD_isError(remaining))
+                    throw std::runtime_error(ZSTD_getErrorName(remaining));
+            } while (directive == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+        }
+        buffer.shrink(output.pos);
+        return buffer;
+    }
+
+    /**
+     * Decompresses the zstd frame in @p compressed.
+     * @param compressed zstd-compressed bytes to be decompressed
+     * @return A @c ManagedByteSpan holding uncompressed data extracted from @p compressed
+     * @details
+     *     The output buffer is first allocated at the content size the frame declares, up to @c MAX_DECLARED_CAPACITY,
+     *     and doubled whenever it fills before the frame ends. zstd itself checks that the output matches the declared size.
+     */
+    inline ManagedByteSpan zstd_decompress(std::span<const unsigned char> compressed) {
+        const auto declared = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+        if (declared == ZSTD_CONTENTSIZE_ERROR || declared == ZSTD_CONTENTSIZE_UNKNOWN)
+            throw std::runtime_error("Encountered corrupt zstd frame");
+        static thread_local const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!context)
+            throw std::bad_alloc();
+        // A frame left unfinished by an earlier corrupt segment must not carry over into this one
+        ZSTD_DCtx_reset(context.get(), ZSTD_reset_session_only);
+        auto buffer = ManagedByteSpan::allocate(static_cast<std::size_t>(std::min<unsigned long long>(std::max<unsigned long long>(declared, 1), MAX_DECLARED_CAPACITY)));
+        ZSTD_inBuffer input{compressed.data(), compressed.size(), 0};
+        ZSTD_outBuffer output{buffer.data().data(), buffer.size(), 0};
+        for (std::size_t remaining = 1; remaining != 0; ) {
+            if (output.pos == output.size) {
+                buffer.grow(2 * buffer.size());
+                output.dst = buffer.data().data();
+                output.size = buffer.size();
+            }
+            const auto consumed = input.pos, written = output.pos;
+            remaining = ZSTD_decompressStream(context.get(), &output, &input);
+            if (ZSTD_isError(remaining))
+                throw std::runtime_error(ZSTD_getErrorName(remaining));
+            if (remaining != 0 && output.pos == written && input.pos == consumed)
+                throw std::runtime_error("Encountered truncated zstd frame");
+        }
+        if (input.pos != input.size)
+            throw std::runtime_error("Encountered corrupt zstd frame");
+        buffer.shrink(output.pos);
+        return buffer;
+    }
+
+    /**
+     * Decompresses the zstd frame in @p compressed only to checksum its contents, without holding them in memory.
+     * @param compressed zstd-compressed bytes to be checked
+     * @param skip The number of leading bytes of decompressed data to exclude from the result
+     * @return The size and CRC-32 of the decompressed data following the first @p skip bytes
+     */
+    inline StreamDigest zstd_digest(std::span<const unsigned char> compressed, std::uint64_t skip) {
+        static thread_local const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        if (!context)
+            throw std::bad_alloc();
+        // A frame left unfinished by an earlier corrupt segment must not carry over into this one
+        ZSTD_DCtx_reset(context.get(), ZSTD_reset_session_only);
+        static thread_local std::vector<unsigned char> buffer(ZSTD_DStreamOutSize());
+        DigestWindow window(skip);
+        ZSTD_inBuffer input{compressed.data(), compressed.size(), 0};
+        for (std::size_t remaining = 1; remaining != 0; ) {
+            ZSTD_outBuffer output{buffer.data(), buffer.size(), 0};
+            const auto consumed = input.pos;
+            remaining = ZSTD_decompressStream(context.get(), &output, &input);
+            if (ZSTD_isError(remaining))
+                throw std::runtime_error(ZSTD_getErrorName(remaining));
+            window.append(std::span(buffer).first(output.pos));
+            if (remaining != 0 && output.pos == 0 && input.pos == consumed)
+                throw std::runtime_error("Encountered truncated zstd frame");
+        }
+        if (input.pos != input.size)
+            throw std::runtime_error("Encountered corrupt zstd frame");
+        return window.finish();
+    }
+#endif
+
+#ifdef PNGFUSE_USE_LZ4
+    /**
+     * Creates an LZ4 frame compression or decompression context.
+     * @tparam Context @c LZ4F_cctx or @c LZ4F_dctx
+     * @tparam Create The function that creates the context
+     * @tparam Free The function that frees the context
+     * @return The owned context
+     * @throw @c std::bad_alloc if the context could not be created
+     */
+    template <typename Context, auto Create, auto Free>
+    std::unique_ptr<Context, decltype(Free)> lz4_context() {
+        Context *context = nullptr;
+        if (LZ4F_isError(Create(&context, LZ4F_VERSION)))
+            throw std::bad_alloc();
+        return {context, Free};
+    }
+
+    /**
+     * Compresses @p parts into an LZ4 frame that records its uncompressed size.
+     * @param parts The buffers whose concatenation forms the bytes to be compressed
+     * @param level The compression level, from 1 to @c MAX_LEVEL
+     * @return A @c ManagedByteSpan holding a compressed form of @p parts
+     */
+    inline ManagedByteSpan lz4_compress(ByteParts parts, unsigned level) {
+        // Reused by every segment compressed on this thread, since LZ4F_compressBegin() starts each frame afresh
+        static thread_local const auto guard = lz4_context<LZ4F_cctx, LZ4F_createCompressionContext, LZ4F_freeCompressionContext>();
+        auto *const context = guard.get();
+        LZ4F_preferences_t preferences{};
+        // The lowest levels use LZ4's fast compressor, and the rest its high compression levels 3 to 12
+        preferences.compressionLevel = level <= 3 ? 0 : static_cast<int>(3 + (level - 4) * 9 / (MAX_LEVEL - 4));
+        preferences.frameInfo.contentSize = total_size(parts);
+        // Each update may flush previously buffered input, which its own bound already accounts for
+        auto bound = LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(0, &preferences);
+        for (const auto &part : parts)
+            bound += LZ4F_compressBound(part.size(), &preferences);
+        auto buffer = ManagedByteSpan::allocate(bound);
+        auto *const out = buffer.data().data();
+        auto written = LZ4F_compressBegin(context, out, bound, &preferences);
+        for (std::size_t i = 0; !LZ4F_isError(written) && i <= parts.size(); ++i) {
+            const auto result = i < parts.size()
+                                ? LZ4F_compressUpdate(context, out + written, bound - written, parts[i].data(), parts[i].size(), nullptr)
+                                : LZ4F_compressEnd(context, out + written, bound - written, nullptr);
+            written = LZ4F_isError(result) ? result : written + result;
+        }
+        if (LZ4F_isError(written))
+            throw std::runtime_error(LZ4F_getErrorName(written));
+        buffer.shrink(written);
+        return buffer;
+    }
+
+    /**
+     * Decompresses the LZ4 frame in @p compressed.
+     * @param compressed LZ4-compressed bytes to be decompressed
+     * @return A @c ManagedByteSpan holding uncompressed data extracted from @p compressed
+     * @details As with @c zstd_decompress(), the output buffer is allocated at the declared content size up to @c MAX_DECLARED_CAPACITY, and grows from there.
+     */
+    inline ManagedByteSpan lz4_decompress(std::span<const unsigned char> compressed) {
+        static thread_local const auto guard = lz4_context<LZ4F_dctx, LZ4F_createDecompressionContext, LZ4F_freeDecompressionContext>();
+        auto *const context = guard.get();
+        // A frame left unfinished by an earlier corrupt segment must not carry over into this one
+        LZ4F_resetDecompressionContext(context);
+        LZ4F_frameInfo_t info{};
+        std::size_t consumed = compressed.size();
+        // Frames are always written with their content size, so the output buffer can be allocated up front, as far as the size can be trusted
+        if (LZ4F_isError(LZ4F_getFrameInfo(context, &info, compressed.data(), &consumed)))
+            throw std::runtime_error("Encountered corrupt LZ4 frame");
+        auto buffer = ManagedByteSpan::allocate(static_cast<std::size_t>(std::min<unsigned long long>(std::max<unsigned long long>(info.contentSize, 1), MAX_DECLARED_CAPACITY)));
+        std::size_t written = 0;
+        for (auto input = compressed.subspan(consumed); ; ) {
+            // LZ4 itself checks that the output matches the declared size, so the buffer only grows as real output fills it
+            if (written == buffer.size())
+                buffer.grow(2 * buffer.size());
+            std::size_t output_size = buffer.size() - written, input_size = input.size();
+            const auto hint = LZ4F_decompress(context, buffer.data().data() + written, &output_size, input.data(), &input_size, nullptr);
+            if (LZ4F_isError(hint))
+                throw std::runtime_error(LZ4F_getErrorName(hint));
+            written += output_size;
+            input = input.subspan(input_size);
+            if (hint == 0)
+                break;
+            if (output_size == 0 && input_size == 0)
+                throw std::runtime_error("Encountered corrupt LZ4 frame");
+        }
+        buffer.shrink(written);
+        return buffer;
+    }
+
+    /**
+     * Decompresses the LZ4 frame in @p compressed only to checksum its contents, without holding them in memory.
+     * @param compressed LZ4-compressed bytes to be checked
+     * @param skip The number of leading bytes of decompressed data to exclude from the result
+     * @return The size and CRC-32 of the decompressed data following the first @p skip bytes
+     */
+    inline StreamDigest lz4_digest(std::span<const unsigned char> compressed, std::uint64_t skip) {
+        static thread_local const auto guard = lz4_context<LZ4F_dctx, LZ4F_createDecompressionContext, LZ4F_freeDecompressionContext>();
+        auto *const context = guard.get();
+        LZ4F_resetDecompressionContext(context);
+        static thread_local std::vector<unsigned char> buffer(DigestWindow::WINDOW_SIZE * 2);
+        DigestWindow window(skip);
+        for (auto input = compressed; ; ) {
+            std::size_t output_size = buffer.size(), input_size = input.size();
+            const auto hint = LZ4F_decompress(context, buffer.data(), &output_size, input.data(), &input_size, nullptr);
+            if (LZ4F_isError(hint))
+                throw std::runtime_error(LZ4F_getErrorName(hint));
+            window.append(std::span(buffer).first(output_size));
+            input = input.subspan(input_size);
+            if (hint == 0)
+                break;
+            if (output_size == 0 && input_size == 0)
+                throw std::runtime_error("Encountered corrupt LZ4 frame");
+        }
+        return window.finish();
+    }
+#endif
+}
+
+inline std::span<const Codec> Codec::all() {
+    static constexpr std::array codecs {
+#ifdef PNGFUSE_USE_LIBDEFLATE
+        Codec{ZLIB_METHOD, "libdeflate", &ImageImplementation::libdeflate_compress, &ImageImplementation::libdeflate_decompress,
+              &ImageImplementation::digest_zlib},
+#endif
+#ifdef PNGFUSE_USE_ZSTD
+        Codec{ZSTD_METHOD, "zstd", &ImageImplementation::zstd_compress, &ImageImplementation::zstd_decompress, &ImageImplementation::zstd_digest},
+#endif
+#ifdef PNGFUSE_USE_LZ4
+        Codec{LZ4_METHOD, "lz4", &ImageImplementation::lz4_compress, &ImageImplementation::lz4_decompress, &ImageImplementation::lz4_digest},
+#endif
+        // The standard codec is always last, so that faster implementations of the same method take precedence when reading
+        Codec{ZLIB_METHOD, "zlib", [] (ImageImplementation::ByteParts parts, unsigned level) { return ImageImplementation::compress(parts, level); },
+              &ImageImplementation::decompress, &ImageImplementation::digest_zlib},
+    };
+    return codecs;
+}
+
+#endif //PNGFUSE_CODEC_H
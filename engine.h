@@ -0,0 +1,205 @@
+#ifndef PNGFUSE_ENGINE_H
+#define PNGFUSE_ENGINE_H
+
+#include <cstddef>
+#include <istream>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "subfileimage.h"
+
+/**
+ * A long-lived entry point for embedding PNGFuse in another program, such as a service that fuses files into uploaded images.
+ * @details
+ *     Every operation takes its host image from memory, as a span viewed in place or a stream read whole, and returns its results in memory,
+ *     so that nothing is read from or written to the filesystem unless @c Compression::cache is set.\n
+ *     An engine keeps its compression settings across calls, and shares the process-wide @c ThreadPool,
+ *     which is sized by the first engine that is created before the pool is first used.
+ *     Codec contexts and large buffers are kept by each thread of the pool between calls, as described by @c BufferArena,
+ *     so a long-lived engine stops allocating them once it has warmed up.
+ *     Operations are safe to run concurrently from several threads on the same engine.
+ */
+class Engine {
+public:
+    /**
+     * The result of removing the subfiles from an image.
+     */
+    struct CleanResult {
+        /**
+         * The raw PNG image data with every @c fuSe chunk removed.
+         */
+        std::vector<unsigned char> image;
+
+        /**
+         * The number of subfiles removed, counting each run of segmented chunks once.
+         */
+        std::size_t removed;
+    };
+
+    /**
+     * Creates an engine.
+     * @param compression The settings with which to compress fused subfiles
+     * @param jobs The number of jobs with which to run the shared @c ThreadPool, or @c std::nullopt to use the hardware concurrency
+     * @details @p jobs has no effect if the shared pool has already been started.
+     */
+    explicit Engine(Compression compression={}, std::optional<std::size_t> jobs=std::nullopt) : compression(compression), pool([&] () -> ThreadPool & {
+        if (jobs.has_value())
+            ThreadPool::configure(*jobs);
+        return ThreadPool::shared();
+    }()) {}
+
+    /**
+     * The settings with which the engine compresses fused subfiles.
+     */
+    [[nodiscard]] const Compression &settings() const { return compression; }
+
+    /**
+     * The number of jobs the engine runs in parallel.
+     */
+    [[nodiscard]] std::size_t jobs() const { return pool.jobs(); }
+
+    /**
+     * Fuses subfiles into a copy of a PNG image.
+     * @param host The raw PNG image data into which to fuse the subfiles
+     * @param sub_files The subfiles to fuse, in order
+     * @param solid Whether to pack the subfiles together into one solid run, as with @c SubFileImage::add_solid_sub_files()
+     * @return The raw PNG image data with the subfiles fused in
+     * @throw @c std::runtime_error if @p host is not a valid PNG image
+     */
+    [[nodiscard]] std::vector<unsigned char> fuse(std::span<const unsigned char> host, std::vector<SubFile> sub_files, bool solid=false) const {
+        SubFileImage image(host);
+        if (solid)
+            image.add_solid_sub_files(std::span<const SubFile>(sub_files), compression);
+        else
+            image.add_sub_files(std::move(sub_files), compression);
+        return std::move(image).release();
+    }
+
+    /**
+     * Fuses subfiles into a copy of a PNG image read from a stream, writing the result to another stream.
+     * @param host The stream from which to read the raw PNG image data, to its end
+     * @param sub_files The subfiles to fuse, in order
+     * @param out The stream to which to write the raw PNG image data with the subfiles fused in
+     * @param solid Whether to pack the subfiles together into one solid run
+     * @throw @c std::runtime_error if @p host could not be read or is not a valid PNG image, or if @p out could not be written to
+     */
+    void fuse(std::istream &host, std::vector<SubFile> sub_files, std::ostream &out, bool solid=false) const {
+        SubFileImage image(read_all(host));
+        if (solid)
+            image.add_solid_sub_files(std::span<const SubFile>(sub_files), compression);
+        else
+            image.add_sub_files(std::move(sub_files), compression);
+        image.save(out);
+    }
+
+    /**
+     * Lists the subfiles fused into a PNG image, without decompressing them.
+     * @param image The raw PNG image data
+     * @return Summary information about each subfile, in order
+     * @throw @c std::runtime_error if @p image is not a valid PNG image
+     */
+    [[nodiscard]] std::vector<SubFileInfo> list(std::span<const unsigned char> image) const {
+        return SubFileImage(image).get_sub_file_info();
+    }
+
+    /**
+     * Lists the subfiles fused into a PNG image read from a stream, without decompressing them.
+     * @param image The stream from which to read the raw PNG image data, to its end
+     * @return Summary information about each subfile, in order
+     */
+    [[nodiscard]] std::vector<SubFileInfo> list(std::istream &image) const {
+        return list(read_all(image));
+    }
+
+    /**
+     * Decompresses the subfiles fused into a PNG image.
+     * @param image The raw PNG image data
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match to be extracted, or @c std::nullopt to extract all of them
+     * @return The matching subfiles, in order
+     * @throw @c std::runtime_error if @p image is not a valid PNG image or a subfile could not be decompressed
+     * @see @c SubFileImage::matches_pattern()
+     */
+    [[nodiscard]] std::vector<SubFile> extract(std::span<const unsigned char> image, std::optional<std::u8string_view> pattern=std::nullopt) const {
+        const SubFileImage fused(image);
+        return pattern.has_value() ? fused.get_sub_files(*pattern) : fused.get_sub_files();
+    }
+
+    /**
+     * Decompresses the subfiles fused into a PNG image read from a stream.
+     * @param image The stream from which to read the raw PNG image data, to its end
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match to be extracted, or @c std::nullopt to extract all of them
+     * @return The matching subfiles, in order
+     */
+    [[nodiscard]] std::vector<SubFile> extract(std::istream &image, std::optional<std::u8string_view> pattern=std::nullopt) const {
+        return extract(read_all(image), pattern);
+    }
+
+    /**
+     * Checks the integrity of every subfile fused into a PNG image, without keeping any decompressed data.
+     * @param image The raw PNG image data
+     * @return The result of checking each subfile, in order
+     * @throw @c std::runtime_error if @p image is not a valid PNG image
+     * @see @c SubFileImage::verify_sub_files()
+     */
+    [[nodiscard]] std::vector<SubFileCheck> verify(std::span<const unsigned char> image) const {
+        return SubFileImage(image).verify_sub_files();
+    }
+
+    /**
+     * Checks the integrity of every subfile fused into a PNG image read from a stream.
+     * @param image The stream from which to read the raw PNG image data, to its end
+     * @return The result of checking each subfile, in order
+     */
+    [[nodiscard]] std::vector<SubFileCheck> verify(std::istream &image) const {
+        return verify(read_all(image));
+    }
+
+    /**
+     * Removes every subfile from a copy of a PNG image.
+     * @param image The raw PNG image data
+     * @return The image data without its @c fuSe chunks, and the number of subfiles removed
+     * @throw @c std::runtime_error if @p image is not a valid PNG image
+     */
+    [[nodiscard]] CleanResult clean(std::span<const unsigned char> image) const {
+        SubFileImage fused(image);
+        const auto removed = fused.clear_sub_files();
+        return {std::move(fused).release(), removed};
+    }
+
+    /**
+     * Removes every subfile from a copy of a PNG image read from a stream, writing the result to another stream.
+     * @param image The stream from which to read the raw PNG image data, to its end
+     * @param out The stream to which to write the image data without its @c fuSe chunks
+     * @return The number of subfiles removed
+     */
+    std::size_t clean(std::istream &image, std::ostream &out) const {
+        SubFileImage fused(read_all(image));
+        const auto removed = fused.clear_sub_files();
+        fused.save(out);
+        return removed;
+    }
+
+private:
+    Compression compression;
+    ThreadPool &pool;
+
+    /**
+     * Reads the rest of a stream into memory.
+     * @param in The stream from which to read
+     * @return The bytes read
+     * @throw @c std::runtime_error if @p in could not be read
+     */
+    static std::vector<unsigned char> read_all(std::istream &in) {
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (in.bad())
+            throw std::runtime_error("Failed to read image data from stream.");
+        return data;
+    }
+};
+
+#endif //PNGFUSE_ENGINE_H
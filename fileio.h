@@ -3,34 +3,130 @@
 
 #include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <span>
+#include <utility>
 
 #include "nativeunicode.h"
+#include "trace.h"
+
+#ifndef _WINDOWS
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A read-only view of the contents of a file mapped into memory,
+ * allowing the file to be read straight out of the page cache without copying it.
+ * @details
+ *     This uses @c mmap() on Unix and @c CreateFileMapping() on Windows.
+ *     The file should not be truncated or modified by other processes while it is mapped.
+ */
+class MappedFile {
+public:
+    /**
+     * Maps the contents of the file at @p file into memory.
+     * @param file Path to a file whose contents are to be mapped
+     * @throw @c native_runtime_error if @p file could not be opened or mapped
+     */
+    explicit MappedFile(const std::filesystem::path &file) {
+#ifdef _WINDOWS
+        const HANDLE handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            throw native_runtime_error(NATIVE_WIDTH("Could not open input file ") + file.native() + NATIVE_WIDTH('.'));
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(handle, &file_size)) {
+            CloseHandle(handle);
+            throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + file.native() + NATIVE_WIDTH('.'));
+        }
+        length = static_cast<std::size_t>(file_size.QuadPart);
+        if (length > 0) {
+            const HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                address = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(handle);
+#else
+        const int descriptor = open(file.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            throw native_runtime_error(NATIVE_WIDTH("Could not open input file ") + file.native() + NATIVE_WIDTH('.'));
+        struct stat status{};
+        if (fstat(descriptor, &status) != 0) {
+            close(descriptor);
+            throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + file.native() + NATIVE_WIDTH('.'));
+        }
+        length = static_cast<std::size_t>(status.st_size);
+        if (length > 0) {
+            void *const mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            address = mapped == MAP_FAILED ? nullptr : static_cast<const unsigned char *>(mapped);
+        }
+        close(descriptor);
+#endif
+        if (length > 0 && !address)
+            throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + file.native() + NATIVE_WIDTH('.'));
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept : address(other.address), length(other.length) {
+        other.address = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            address = std::exchange(other.address, nullptr);
+            length = std::exchange(other.length, 0);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { unmap(); }
+
+    [[nodiscard]] std::span<const unsigned char> data() const { return {address, length}; }
+    [[nodiscard]] auto begin() const { return data().begin(); }
+    [[nodiscard]] auto end()   const { return data().end(); }
+    [[nodiscard]] std::size_t size() const { return length; }
+
+private:
+    const unsigned char *address = nullptr;
+    std::size_t length = 0;
+
+    void unmap() noexcept {
+        if (!address)
+            return;
+#ifdef _WINDOWS
+        UnmapViewOfFile(address);
+#else
+        munmap(const_cast<unsigned char *>(address), length);
+#endif
+        address = nullptr;
+    }
+};
 
 /**
  * Reads the contents of the file at @p in as <tt>unsigned char</tt>s.
  * @param in Path to a file whose contents are to be read
  * @return The binary contents of the file, in the form of <tt>unsigned char</tt>s
  * @throw @c native_runtime_error if @p in could not be read
+ * @details The file is copied out of a @c MappedFile, avoiding an intermediate copy through a stream buffer.
  */
 static std::vector<unsigned char> read(const std::filesystem::path &in) {
-    // std::basic_ifstream<unsigned char> is not guaranteed to exist, and compiles on MSVC but not GCC
-    // So instead std::ifstream is used alongside reinterpret_cast, which yields equivalent results
-    std::ifstream input_file(in, std::ios::in | std::ios::binary);
-    if (input_file) {
-        std::vector<unsigned char> contents;
-        input_file.seekg(0, std::ios::end);
-        const auto size = input_file.tellg();
-        input_file.seekg(0, std::ios::beg);
-        contents.resize(static_cast<decltype(contents)::size_type>(size));
-        input_file.read(reinterpret_cast<char *>(contents.data()), static_cast<std::streamsize>(size));
-        if (input_file)
-            return contents;
-        else
-            throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + in.native() + NATIVE_WIDTH('.'));
-    } else
-        throw native_runtime_error(NATIVE_WIDTH("Could not open input file ") + in.native() + NATIVE_WIDTH('.'));
+    const MappedFile mapped(in);
+    PNGFUSE_TRACE_SCOPE("read", mapped.size());
+    return {mapped.begin(), mapped.end()};
 }
 
 /**
@@ -40,6 +136,7 @@ static std::vector<unsigned char> read(const std::filesystem::path &in) {
  * @throw @c native_runtime_error if @p out could not be written to
  */
 static void write(const std::filesystem::path &out, const std::span<const unsigned char> contents) {
+    PNGFUSE_TRACE_SCOPE("write", contents.size());
     std::ofstream output_file(out, std::ios::out | std::ios::binary);
     if (output_file) {
         output_file.write(reinterpret_cast<const char *>(contents.data()), static_cast<std::streamsize>(contents.size()));
@@ -49,4 +146,220 @@ static void write(const std::filesystem::path &out, const std::span<const unsign
         throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + out.native() + NATIVE_WIDTH('.'));
 }
 
+/**
+ * Writes the concatenation of several buffers to the file at @p out in one pass, without first joining them in memory.
+ * @param out Path to a file to which to write the buffers
+ * @param parts The buffers to write into @c out, in order
+ * @throw @c native_runtime_error if @p out could not be written to
+ * @details
+ *     On Unix, the buffers are written with vectored I/O via @c writev().
+ *     On Windows, @c WriteFileGather() requires page-aligned unbuffered I/O, so each buffer is instead written in turn with @c WriteFile().
+ */
+static void write(const std::filesystem::path &out, std::span<const std::span<const unsigned char>> parts) {
+    PNGFUSE_TRACE_SCOPE("write", [parts] { std::size_t size = 0; for (const auto &part : parts) size += part.size(); return size; }());
+#ifdef _WINDOWS
+    const HANDLE handle = CreateFileW(out.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + out.native() + NATIVE_WIDTH('.'));
+    bool success = true;
+    for (auto part : parts) {
+        while (success && !part.empty()) {
+            // WriteFile() takes a 32-bit length, so write large buffers in pieces
+            const auto piece = static_cast<DWORD>(std::min<std::size_t>(part.size(), 1 << 30));
+            DWORD written = 0;
+            success = WriteFile(handle, part.data(), piece, &written, nullptr) && written > 0;
+            part = part.subspan(written);
+        }
+    }
+    success &= CloseHandle(handle) != 0;
+#else
+    const int descriptor = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (descriptor < 0)
+        throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + out.native() + NATIVE_WIDTH('.'));
+    std::vector<iovec> vectors;
+    vectors.reserve(parts.size());
+    for (const auto &part : parts)
+        if (!part.empty())
+            vectors.push_back({const_cast<unsigned char *>(part.data()), part.size()});
+    bool success = true;
+    for (std::size_t first = 0; success && first < vectors.size();) {
+        const auto count = static_cast<int>(std::min<std::size_t>(vectors.size() - first, IOV_MAX));
+        auto written = writev(descriptor, &vectors[first], count);
+        if (written < 0) {
+            success = errno == EINTR;
+            continue;
+        }
+        // Skip past fully written buffers, and advance into the first partially written one
+        for (; first < vectors.size() && static_cast<std::size_t>(written) >= vectors[first].iov_len; ++first)
+            written -= static_cast<ssize_t>(vectors[first].iov_len);
+        if (written > 0) {
+            vectors[first].iov_base = static_cast<unsigned char *>(vectors[first].iov_base) + written;
+            vectors[first].iov_len -= static_cast<std::size_t>(written);
+        }
+    }
+    success &= close(descriptor) == 0;
+#endif
+    if (!success)
+        throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + out.native() + NATIVE_WIDTH('.'));
+}
+
+/**
+ * The size of the intermediate buffer used when copying data between streams.
+ */
+constexpr std::size_t COPY_BUFFER_SIZE = 1 << 20;
+
+/**
+ * Opens the file at @p in for reading binary data.
+ * @param in Path to a file to be opened
+ * @return A binary input stream positioned at the beginning of the file
+ * @throw @c native_runtime_error if @p in could not be opened
+ */
+static std::ifstream open_input(const std::filesystem::path &in) {
+    std::ifstream input_file(in, std::ios::in | std::ios::binary);
+    if (!input_file)
+        throw native_runtime_error(NATIVE_WIDTH("Could not open input file ") + in.native() + NATIVE_WIDTH('.'));
+    return input_file;
+}
+
+/**
+ * Opens the file at @p out for writing binary data, replacing any existing contents.
+ * @param out Path to a file to be opened
+ * @return A binary output stream positioned at the beginning of the file
+ * @throw @c native_runtime_error if @p out could not be opened
+ */
+static std::ofstream open_output(const std::filesystem::path &out) {
+    std::ofstream output_file(out, std::ios::out | std::ios::binary);
+    if (!output_file)
+        throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + out.native() + NATIVE_WIDTH('.'));
+    return output_file;
+}
+
+/**
+ * Determines if a path given on the command line stands for standard input or standard output, as @c - does in Unix pipelines.
+ * @param file A path given on the command line
+ * @return @c true if @p file is exactly @c -, @c false otherwise
+ */
+[[maybe_unused]] static bool is_standard_stream(const std::filesystem::path &file) {
+    return file.native() == NATIVE_WIDTH("-");
+}
+
+/**
+ * Prepares standard input for reading binary data, such as an image piped in from another program.
+ * @return @c std::cin
+ * @details On Windows, standard input is switched to binary mode, which would otherwise translate line endings and stop at the first ^Z.
+ */
+[[maybe_unused]] static std::istream &standard_input() {
+#ifdef _WINDOWS
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    return std::cin;
+}
+
+/**
+ * Prepares standard output for writing binary data, such as an image piped out to another program.
+ * @return @c std::cout
+ * @details
+ *     On Windows, standard output is switched to binary mode, which would otherwise translate line endings,
+ *     after which @c native_out can no longer be used, so messages must then be printed to @c native_err.
+ */
+[[maybe_unused]] static std::ostream &standard_output() {
+#ifdef _WINDOWS
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    return std::cout;
+}
+
+/**
+ * Determines the number of bytes remaining in @p in, leaving its read position unchanged.
+ * @param in A seekable input stream
+ * @return The number of bytes between the current read position of @p in and the end of the stream
+ */
+static std::uint64_t remaining_size(std::istream &in) {
+    const auto position = in.tellg();
+    in.seekg(0, std::ios::end);
+    const auto end = in.tellg();
+    in.seekg(position);
+    return static_cast<std::uint64_t>(end - position);
+}
+
+/**
+ * Copies @p count bytes from @p in to @p out through a fixed-size buffer.
+ * @param in The stream from which to read
+ * @param out The stream to which to write
+ * @param count The number of bytes to copy
+ * @throw @c std::runtime_error if fewer than @p count bytes could be read or written
+ */
+static void copy_stream(std::istream &in, std::ostream &out, std::uint64_t count) {
+    PNGFUSE_TRACE_SCOPE("copy", count);
+    std::vector<char> buffer(static_cast<std::size_t>(std::min<std::uint64_t>(count, COPY_BUFFER_SIZE)));
+    while (count > 0) {
+        const auto block = static_cast<std::streamsize>(std::min<std::uint64_t>(count, buffer.size()));
+        if (!in.read(buffer.data(), block) || !out.write(buffer.data(), block))
+            throw std::runtime_error("Failed to copy file data.");
+        count -= static_cast<std::uint64_t>(block);
+    }
+}
+
+/**
+ * Reads the rest of @p in as <tt>unsigned char</tt>s, through a fixed-size buffer.
+ * @param in A stream to be read to its end, which need not be seekable, such as standard input
+ * @return The binary contents read from @p in
+ * @throw @c std::runtime_error if @p in could not be read
+ */
+[[maybe_unused]] static std::vector<unsigned char> read(std::istream &in) {
+    PNGFUSE_TRACE_SCOPE("read", 0);
+    std::vector<unsigned char> contents;
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    while (in.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || in.gcount() > 0)
+        contents.insert(contents.end(), buffer.data(), buffer.data() + in.gcount());
+    if (in.bad())
+        throw std::runtime_error("Failed to read from stream.");
+    return contents;
+}
+
+/**
+ * Removes several ranges of bytes from the file at @p file in place, shifting the data after each range back over it and truncating the file.
+ * @param file Path to a file from which to remove data
+ * @param ranges The <tt>[begin, end)</tt> offsets of the ranges to remove, sorted and not overlapping
+ * @throw @c native_runtime_error if @p file could not be modified
+ * @details
+ *     Only the data following the first removed range is moved, through a fixed-size buffer,
+ *     so removing ranges near the end of a file takes time proportional to what follows them rather than to the size of the file.\n
+ *     The file is left partially compacted if an error occurs while data is being moved.
+ */
+static void erase_ranges(const std::filesystem::path &file, std::span<const std::pair<std::uint64_t, std::uint64_t>> ranges) {
+    if (ranges.empty())
+        return;
+    PNGFUSE_TRACE_SCOPE("erase", 0);
+    std::uint64_t write_position = ranges.front().first;
+    {
+        std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+        if (!stream)
+            throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + file.native() + NATIVE_WIDTH('.'));
+        const auto size = remaining_size(stream);
+        std::vector<char> buffer;
+        for (std::size_t i = 0; i < ranges.size(); ++i) {
+            const auto kept_end = i + 1 < ranges.size() ? ranges[i + 1].first : size;
+            for (auto read_position = ranges[i].second; read_position < kept_end;) {
+                buffer.resize(static_cast<std::size_t>(std::min<std::uint64_t>(kept_end - read_position, COPY_BUFFER_SIZE)));
+                const auto block = static_cast<std::streamsize>(buffer.size());
+                stream.seekg(static_cast<std::streamoff>(read_position));
+                if (!stream.read(buffer.data(), block))
+                    throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + file.native() + NATIVE_WIDTH('.'));
+                stream.seekp(static_cast<std::streamoff>(write_position));
+                if (!stream.write(buffer.data(), block))
+                    throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + file.native() + NATIVE_WIDTH('.'));
+                read_position += static_cast<std::uint64_t>(block);
+                write_position += static_cast<std::uint64_t>(block);
+            }
+        }
+        if (!stream.flush())
+            throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + file.native() + NATIVE_WIDTH('.'));
+    }
+    std::error_code error;
+    std::filesystem::resize_file(file, write_position, error);
+    if (error)
+        throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + file.native() + NATIVE_WIDTH('.'));
+}
+
 #endif //PNGFUSE_FILEIO_H
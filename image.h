@@ -4,53 +4,178 @@
 #define LODEPNG_NO_COMPILE_DISK
 #include "lodepng.h"
 #include <cstring>
+#include <cstdint>
 #include <string>
+#include <array>
+#include <algorithm>
+#include <concepts>
+#include <optional>
+#include <initializer_list>
 #include <span>
 #include <ranges>
-#include <thread>
+#include <cmath>
+#include <utility>
+#include <variant>
+#include <vector>
 #include <future>
 
+#include "arena.h"
+#include "checksum.h"
 #include "fileio.h"
+#include "threadpool.h"
 #include "nativeunicode.h"
 
 using std::filesystem::path;
 
+#if defined(PNGFUSE_LODEPNG_ALLOCATORS) && !defined(PNGFUSE_EXTERN_LODEPNG_ALLOCATORS)
+// LodePNG compiled with LODEPNG_NO_COMPILE_ALLOCATORS leaves these to be defined by the program, exactly once,
+// so a program of several translation units defines PNGFUSE_EXTERN_LODEPNG_ALLOCATORS in all but one of them
+void *lodepng_malloc(std::size_t size) { return BufferArena::allocate(size); }
+void *lodepng_realloc(void *ptr, std::size_t new_size) { return BufferArena::reallocate(ptr, new_size); }
+void lodepng_free(void *ptr) { BufferArena::release(ptr); }
+#endif
+
 namespace ImageImplementation {
     /**
-     * A wrapper that takes ownership of an external array allocated via malloc().
+     * A wrapper that takes ownership of an external array allocated via malloc() or a @c BufferArena.
      * This is used to interface with LodePNG's functions that return malloc()-ed C arrays.
      * @tparam T The type of data stored in the array
      */
     template <typename T>
     struct ManagedSpan {
 
-        inline ManagedSpan(T *buffer, std::size_t size) : buffer(buffer), _data(buffer, size) {}
-        inline ~ManagedSpan() { free(buffer); }
+        /**
+         * Takes ownership of an array.
+         * @param buffer The array, or @c nullptr
+         * @param size The number of elements in the array
+         * @param deallocate The function with which to free the array, matching the way it was allocated
+         */
+        inline ManagedSpan(T *buffer, std::size_t size, void (*deallocate)(void *)=&std::free) : buffer(buffer), _data(buffer, size), deallocate(deallocate) {}
+        inline ~ManagedSpan() { deallocate(buffer); }
 
         ManagedSpan() = default;
 
         ManagedSpan& operator=(ManagedSpan &&other) noexcept {
+            deallocate(buffer);
             buffer = other.buffer;
             _data = std::move(other._data);
+            deallocate = other.deallocate;
             other.buffer = nullptr;
             return *this;
         }
 
-        ManagedSpan(ManagedSpan &&other) noexcept : buffer(other.buffer), _data(std::move(other._data)) {
+        ManagedSpan(ManagedSpan &&other) noexcept : buffer(other.buffer), _data(std::move(other._data)), deallocate(other.deallocate) {
             other.buffer = nullptr;
         }
 
+        /**
+         * Allocates an array from the calling thread's @c BufferArena, reusing a buffer released earlier when possible.
+         * @param size The number of elements in the array
+         * @return A @c ManagedSpan owning the uninitialized array
+         * @throw @c std::bad_alloc if the array could not be allocated
+         */
+        static ManagedSpan allocate(std::size_t size) {
+            auto *const buffer = static_cast<T *>(BufferArena::allocate(std::max<std::size_t>(size, 1) * sizeof(T)));
+            if (!buffer)
+                throw std::bad_alloc();
+            return {buffer, size, &BufferArena::release};
+        }
+
         [[nodiscard]] constexpr auto begin() const { return _data.begin(); }
         [[nodiscard]] constexpr auto end()   const { return _data.end(); }
         [[nodiscard]] constexpr auto size()  const { return _data.size(); }
         [[nodiscard]] constexpr auto data()  const { return _data; }
+
+        /**
+         * Narrows the view to the first @p size elements of the buffer, e.g. once the amount of output written into it is known.
+         * @param size The number of elements to keep in view, at most @c size()
+         */
+        constexpr void shrink(std::size_t size) { _data = _data.first(size); }
+
+        /**
+         * Widens the view to @p size elements, moving the array to a larger buffer from the calling thread's @c BufferArena if needed.
+         * @param size The number of elements to keep in view, at least @c size()
+         * @throw @c std::bad_alloc if the array could not be reallocated, in which case it is left unchanged
+         * @details Only arrays obtained from @c allocate() can grow. The elements already in view keep their values.
+         */
+        void grow(std::size_t size) {
+            auto *const grown = static_cast<T *>(BufferArena::reallocate(buffer, std::max<std::size_t>(size, 1) * sizeof(T)));
+            if (!grown)
+                throw std::bad_alloc();
+            buffer = grown;
+            _data = {buffer, size};
+        }
     private:
-        T *buffer;
+        T *buffer = nullptr;
         std::span<T> _data;
+        void (*deallocate)(void *) = &std::free;
     };
     
     using ManagedByteSpan = ManagedSpan<unsigned char>;
 
+    /**
+     * Takes ownership of an array returned by LodePNG.
+     * @param buffer The array, or @c nullptr
+     * @param size The number of bytes in the array
+     * @return A @c ManagedByteSpan that frees @p buffer in the same way LodePNG allocated it
+     * @details
+     *     When @c PNGFUSE_LODEPNG_ALLOCATORS is defined, LodePNG must be compiled with @c LODEPNG_NO_COMPILE_ALLOCATORS,
+     *     and every buffer it allocates, from its hash tables to its output, comes from a @c BufferArena instead of the heap.
+     */
+    inline ManagedByteSpan adopt_lodepng(unsigned char *buffer, std::size_t size) {
+#ifdef PNGFUSE_LODEPNG_ALLOCATORS
+        return {buffer, size, &BufferArena::release};
+#else
+        return {buffer, size};
+#endif
+    }
+
+    /**
+     * An owned byte buffer backed by either a vector or a @c ManagedByteSpan, viewed from an offset into it.
+     * This lets data decompressed by LodePNG be handed from a chunk to a subfile without being copied,
+     * even when a prefix such as a filename must be skipped.
+     */
+    class ByteBuffer {
+    public:
+        ByteBuffer() = default;
+        ByteBuffer(std::vector<unsigned char> &&bytes) : storage(std::move(bytes)), view(std::get<0>(storage)) {}
+        ByteBuffer(ManagedByteSpan &&bytes) : storage(std::move(bytes)), view(std::get<1>(storage).data()) {}
+
+        /**
+         * Copies a range of bytes into a new vector-backed buffer.
+         * @param first An iterator to the first byte to copy
+         * @param last An iterator past the last byte to copy
+         */
+        template <std::input_iterator It>
+        ByteBuffer(It first, It last) : ByteBuffer(std::vector<unsigned char>(first, last)) {}
+
+        // The view remains valid when moved, since moving a vector or a ManagedByteSpan transfers its allocation
+        ByteBuffer(ByteBuffer &&other) noexcept : storage(std::move(other.storage)), view(std::exchange(other.view, {})) {}
+        ByteBuffer &operator=(ByteBuffer &&other) noexcept {
+            storage = std::move(other.storage);
+            view = std::exchange(other.view, {});
+            return *this;
+        }
+
+        [[nodiscard]] constexpr auto begin() const { return view.begin(); }
+        [[nodiscard]] constexpr auto end()   const { return view.end(); }
+        [[nodiscard]] constexpr const unsigned char *cbegin() const { return view.data(); }
+        [[nodiscard]] constexpr const unsigned char *cend()   const { return view.data() + view.size(); }
+        [[nodiscard]] constexpr auto size()  const { return view.size(); }
+        [[nodiscard]] constexpr auto data()  const { return view.data(); }
+        [[nodiscard]] constexpr bool empty() const { return view.empty(); }
+
+        /**
+         * Narrows the view to skip the first @p count bytes of the buffer, without moving or freeing them.
+         * @param count The number of bytes to skip, at most @c size()
+         */
+        constexpr void drop_front(std::size_t count) { view = view.subspan(count); }
+
+    private:
+        std::variant<std::vector<unsigned char>, ManagedByteSpan> storage;
+        std::span<unsigned char> view;
+    };
+
     /**
      * Converts LodePNG error codes to thrown C++ exceptions.
      * @param error A LodePNG error code
@@ -65,44 +190,826 @@ namespace ImageImplementation {
      * @param compressed zlib-compressed bytes to be decompressed
      * @return A @c ManagedByteSpan holding uncompressed data extracted from @p compressed
      */
-    ManagedByteSpan decompress(std::span<const unsigned char> compressed) {
+    inline ManagedByteSpan decompress(std::span<const unsigned char> compressed) {
         unsigned char *buffer = nullptr;
         std::size_t buffer_size = 0;
         auto settings = LodePNGDecompressSettings{};
         const auto error = lodepng_zlib_decompress(&buffer, &buffer_size, compressed.data(), compressed.size(), &settings);
-        ManagedByteSpan decompressed{buffer, buffer_size};
+        auto decompressed = adopt_lodepng(buffer, buffer_size);
         check_error(error);
         return decompressed;
     }
 
     /**
-     * A factory function to produce a @c LodePNGCompressSettings object tuned for optimal compression ratios.
-     * @return A @c LodePNGCompressSettings object tuned for optimal compressions ratios
+     * The compression level that stores data without compressing it.
+     */
+    constexpr unsigned STORE_LEVEL = 0;
+    /**
+     * The compression level tuned for optimal compression ratios, and the default.
+     */
+    constexpr unsigned MAX_LEVEL = 9;
+
+    /**
+     * A factory function to produce the @c LodePNGCompressSettings object for a compression level.
+     * @param level A level from @c STORE_LEVEL to @c MAX_LEVEL, trading speed for compression ratio as with zlib's levels
+     * @return A @c LodePNGCompressSettings object that stores data at @c STORE_LEVEL,
+     *     and otherwise searches a larger window for longer matches at each higher level
      */
-    consteval LodePNGCompressSettings best_compression() {
+    consteval LodePNGCompressSettings compression_preset(unsigned level) {
+        constexpr struct { unsigned windowsize, nicematch; bool lazymatching; } PRESETS[MAX_LEVEL + 1] {
+            {0, 0, false},
+            {1024, 8, false}, {2048, 16, false}, {4096, 32, false},
+            {8192, 32, true}, {16384, 64, true}, {32768, 128, true},
+            {32768, 160, true}, {32768, 208, true}, {32768, 258, true},
+        };
         LodePNGCompressSettings settings{};
-        settings.btype = 2;
-        settings.use_lz77 = true;
-        settings.windowsize = 32768;
+        settings.btype = level == STORE_LEVEL ? 0 : 2;
+        settings.use_lz77 = level != STORE_LEVEL;
+        settings.windowsize = std::max(PRESETS[level].windowsize, 1u);
         settings.minmatch = 3;
-        settings.nicematch = 258;
-        settings.lazymatching = true;
+        settings.nicematch = PRESETS[level].nicematch;
+        settings.lazymatching = PRESETS[level].lazymatching;
         return settings;
     }
 
+    /**
+     * The @c LodePNGCompressSettings for every compression level, indexed by level.
+     */
+    constexpr auto COMPRESSION_PRESETS = [] <std::size_t... Levels> (std::index_sequence<Levels...>) {
+        return std::array<LodePNGCompressSettings, sizeof...(Levels)>{compression_preset(Levels)...};
+    }(std::make_index_sequence<MAX_LEVEL + 1>());
+
+    /**
+     * A list of byte ranges to be treated as one contiguous input without copying them together, e.g. a filename followed by file contents.
+     */
+    using ByteParts = std::span<const std::span<const unsigned char>>;
+
+    /**
+     * The total number of bytes in a list of parts.
+     * @param parts The parts to be measured
+     * @return The sum of the sizes of @p parts
+     */
+    constexpr std::size_t total_size(ByteParts parts) {
+        std::size_t size = 0;
+        for (const auto &part : parts)
+            size += part.size();
+        return size;
+    }
+
+    /**
+     * Views a range of bytes in a list of parts, as if the parts were contiguous.
+     * @param parts The parts holding the bytes
+     * @param offset The position of the first byte to view, relative to the beginning of the first part
+     * @param size The number of bytes to view
+     * @param scratch A buffer into which the bytes are copied together if they straddle several parts
+     * @return A view of the bytes in place if they lie within a single part, and otherwise a view of @p scratch
+     */
+    inline std::span<const unsigned char> gather(ByteParts parts, std::size_t offset, std::size_t size, std::vector<unsigned char> &scratch) {
+        auto part = parts.begin();
+        for (; part != parts.end() && offset >= part->size(); ++part)
+            offset -= part->size();
+        if (part == parts.end())
+            return {};
+        if (offset + size <= part->size())
+            return part->subspan(offset, size);
+        scratch.clear();
+        for (; part != parts.end() && scratch.size() < size; ++part, offset = 0) {
+            const auto piece = part->subspan(offset, std::min(part->size() - offset, size - scratch.size()));
+            scratch.insert(scratch.end(), piece.begin(), piece.end());
+        }
+        return scratch;
+    }
+
+    /**
+     * Estimates the Shannon entropy of @p parts from its byte histogram, sampling a few evenly spaced windows of large inputs.
+     * @param parts Bytes whose entropy is to be estimated, as a list of parts treated as if they were contiguous
+     * @return The estimated entropy, from 0 to 8 bits per byte
+     */
+    inline double byte_entropy(ByteParts parts) {
+        constexpr std::size_t SAMPLE_COUNT = 8, SAMPLE_SIZE = 1 << 13;
+        std::array<std::size_t, 256> histogram{};
+        std::size_t total = 0;
+        const auto sample = [&] (std::size_t offset, std::size_t size) {
+            for (const auto &part : parts) {
+                if (size == 0)
+                    break;
+                if (offset >= part.size()) {
+                    offset -= part.size();
+                    continue;
+                }
+                const auto window = part.subspan(offset, std::min(size, part.size() - offset));
+                for (const auto byte : window)
+                    ++histogram[byte];
+                total += window.size();
+                size -= window.size();
+                offset = 0;
+            }
+        };
+        const auto data_size = total_size(parts);
+        if (data_size <= SAMPLE_COUNT * SAMPLE_SIZE)
+            sample(0, data_size);
+        else
+            for (std::size_t i = 0; i < SAMPLE_COUNT; ++i)
+                sample((data_size - SAMPLE_SIZE) / (SAMPLE_COUNT - 1) * i, SAMPLE_SIZE);
+        double entropy = 0;
+        for (const auto count : histogram)
+            if (count)
+                entropy -= static_cast<double>(count) / total * std::log2(static_cast<double>(count) / total);
+        return entropy;
+    }
+
+    /**
+     * Determines whether @p parts is most likely already compressed or otherwise incompressible, e.g. a JPEG or ZIP file.
+     * @param parts Bytes to be compressed, as a list of parts treated as if they were contiguous
+     * @return @c true if the bytes of @p parts are so close to uniformly distributed that compressing them would gain almost nothing
+     * @details Small inputs are never considered incompressible, since their entropy cannot be estimated reliably and they are cheap to compress anyway.
+     */
+    inline bool is_incompressible(ByteParts parts) {
+        constexpr std::size_t MIN_SIZE = 1 << 12;
+        constexpr double MAX_ENTROPY = 7.95;
+        return total_size(parts) >= MIN_SIZE && byte_entropy(parts) > MAX_ENTROPY;
+    }
+
+    /**
+     * The number of uncompressed bytes handed to each worker when compressing a single large input in parallel.
+     */
+    constexpr std::size_t PARALLEL_BLOCK_SIZE = 1 << 20;
+
+    /**
+     * Reads a big-endian unsigned integer, the byte order used throughout the PNG format.
+     * @tparam T The unsigned integer type to be read
+     * @param bytes A pointer to the first of <tt>sizeof(T)</tt> bytes to be read
+     * @return The integer encoded at @p bytes
+     */
+    template <std::unsigned_integral T>
+    constexpr T read_big_endian(const unsigned char *bytes) {
+        T value = 0;
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            value = static_cast<T>(value << 8 | bytes[i]);
+        return value;
+    }
+
+    /**
+     * Appends an unsigned integer to @p out in big-endian byte order.
+     * @tparam T The unsigned integer type to be written
+     * @param out A byte vector to which the encoded integer is appended
+     * @param value The integer to be encoded
+     */
+    template <std::unsigned_integral T>
+    inline void append_big_endian(std::vector<unsigned char> &out, T value) {
+        for (auto shift = static_cast<int>(sizeof(T) * 8) - 8; shift >= 0; shift -= 8)
+            out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+
+    /**
+     * Writes an unsigned integer to @p out in big-endian byte order.
+     * @tparam T The unsigned integer type to be written
+     * @param out A pointer to at least <tt>sizeof(T)</tt> bytes to be overwritten
+     * @param value The integer to be encoded
+     * @return A pointer to the byte following the encoded integer
+     */
+    template <std::unsigned_integral T>
+    constexpr unsigned char *write_big_endian(unsigned char *out, T value) {
+        for (auto shift = static_cast<int>(sizeof(T) * 8) - 8; shift >= 0; shift -= 8)
+            *out++ = static_cast<unsigned char>(value >> shift);
+        return out;
+    }
+
+    /**
+     * The bit positions of interest within a raw DEFLATE stream, as found by @c measure_deflate().
+     */
+    struct DeflateBounds {
+        /**
+         * Bit offset of the @c BFINAL flag of the last block in the stream.
+         */
+        std::size_t final_block_bit;
+        /**
+         * Bit offset immediately following the end-of-block code of the last block in the stream.
+         */
+        std::size_t end_bit;
+    };
+
+    /**
+     * Decodes the symbols of a raw DEFLATE stream without producing any output, reporting each one to @p visitor.
+     * @tparam Visitor A type supporting:
+     *     @c block(std::size_t) called with the bit offset of each block header,
+     *     @c literal(unsigned char) for each literal byte,
+     *     <tt>match(unsigned length, unsigned distance)</tt> for each back-reference,
+     *     @c stored(std::span<const unsigned char>) for the contents of each stored block,
+     *     and @c done() returning @c true once the visitor needs no further symbols
+     * @param stream A raw DEFLATE stream, without a zlib header or trailer
+     * @param visitor The visitor to which decoded symbols are reported
+     * @return The bit offset immediately following the last symbol decoded
+     * @throw @c std::runtime_error if @p stream is truncated or malformed
+     * @details Decoding is done as in Mark Adler's puff.c, only without a window, so that a stream can be inspected in constant memory.
+     */
+    template <class Visitor>
+    std::size_t walk_deflate(std::span<const unsigned char> stream, Visitor &visitor) {
+        std::size_t next_byte = 0;
+        std::uint64_t bit_buffer = 0;
+        unsigned bit_count = 0;
+        const auto position = [&] { return next_byte * 8 - bit_count; };
+        const auto bits = [&] (unsigned count) {
+            while (bit_count < count) {
+                if (next_byte == stream.size())
+                    throw std::runtime_error("Encountered truncated DEFLATE stream");
+                bit_buffer |= static_cast<std::uint64_t>(stream[next_byte++]) << bit_count;
+                bit_count += 8;
+            }
+            const auto value = static_cast<unsigned>(bit_buffer & ((std::uint64_t{1} << count) - 1));
+            bit_buffer >>= count;
+            bit_count -= count;
+            return value;
+        };
+
+        struct Huffman {
+            std::array<std::uint16_t, 16> count{};
+            std::array<std::uint16_t, 288> symbol{};
+
+            explicit Huffman(std::span<const unsigned char> lengths) {
+                for (const auto length : lengths)
+                    ++count[length];
+                std::array<std::uint16_t, 16> offsets{};
+                for (std::size_t length = 1; length < 15; ++length)
+                    offsets[length + 1] = offsets[length] + count[length];
+                for (std::size_t s = 0; s < lengths.size(); ++s)
+                    if (lengths[s])
+                        symbol[offsets[lengths[s]]++] = static_cast<std::uint16_t>(s);
+            }
+        };
+        const auto decode = [&] (const Huffman &huffman) {
+            int code = 0, first = 0, index = 0;
+            for (std::size_t length = 1; length < 16; ++length) {
+                code |= static_cast<int>(bits(1));
+                const int count = huffman.count[length];
+                if (code - count < first)
+                    return huffman.symbol[index + (code - first)];
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            throw std::runtime_error("Encountered corrupt DEFLATE stream");
+        };
+
+        static constexpr std::array<std::uint16_t, 29> LENGTH_BASE {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static constexpr std::array<unsigned char, 29> LENGTH_EXTRA {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static constexpr std::array<std::uint16_t, 30> DISTANCE_BASE {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static constexpr std::array<unsigned char, 30> DISTANCE_EXTRA {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        static constexpr std::array<unsigned char, 19> CODE_LENGTH_ORDER {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        const auto walk_codes = [&] (const Huffman &literals, const Huffman &distances) {
+            for (auto symbol = decode(literals); symbol != 256; symbol = decode(literals)) {
+                if (symbol < 256)
+                    visitor.literal(static_cast<unsigned char>(symbol));
+                else {
+                    if (symbol - 257u >= LENGTH_BASE.size())
+                        throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                    const auto length = LENGTH_BASE[symbol - 257] + bits(LENGTH_EXTRA[symbol - 257]);
+                    const auto distance_symbol = decode(distances);
+                    if (distance_symbol >= DISTANCE_BASE.size())
+                        throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                    visitor.match(length, DISTANCE_BASE[distance_symbol] + bits(DISTANCE_EXTRA[distance_symbol]));
+                }
+                if (visitor.done())
+                    return;
+            }
+        };
+
+        for (bool last = false; !last && !visitor.done();) {
+            visitor.block(position());
+            last = bits(1);
+            switch (bits(2)) {
+                case 0: {
+                    // Discard the remainder of the current byte
+                    bits(bit_count & 7);
+                    const auto length = bits(16);
+                    if (length != (~bits(16) & 0xFFFF))
+                        throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                    // Any whole bytes left in the bit buffer are the start of the stored data, so rewind to them
+                    next_byte -= bit_count / 8;
+                    bit_buffer = 0;
+                    bit_count = 0;
+                    if (length > stream.size() - next_byte)
+                        throw std::runtime_error("Encountered truncated DEFLATE stream");
+                    visitor.stored(stream.subspan(next_byte, length));
+                    next_byte += length;
+                    break;
+                }
+                case 1: {
+                    std::array<unsigned char, 288 + 30> lengths{};
+                    std::fill_n(lengths.begin(), 144, 8);
+                    std::fill_n(lengths.begin() + 144, 112, 9);
+                    std::fill_n(lengths.begin() + 256, 24, 7);
+                    std::fill_n(lengths.begin() + 280, 8, 8);
+                    std::fill_n(lengths.begin() + 288, 30, 5);
+                    walk_codes(Huffman({lengths.data(), 288}), Huffman({lengths.data() + 288, 30}));
+                    break;
+                }
+                case 2: {
+                    const auto literal_count = bits(5) + 257, distance_count = bits(5) + 1, code_length_count = bits(4) + 4;
+                    if (literal_count > 286 || distance_count > 30)
+                        throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                    std::array<unsigned char, 19> code_lengths{};
+                    for (unsigned i = 0; i < code_length_count; ++i)
+                        code_lengths[CODE_LENGTH_ORDER[i]] = static_cast<unsigned char>(bits(3));
+                    const Huffman code_length_huffman(code_lengths);
+
+                    std::array<unsigned char, 286 + 30> lengths{};
+                    for (unsigned i = 0; i < literal_count + distance_count;) {
+                        const auto symbol = decode(code_length_huffman);
+                        if (symbol < 16) {
+                            lengths[i++] = static_cast<unsigned char>(symbol);
+                            continue;
+                        }
+                        unsigned char repeated = 0;
+                        unsigned repeat;
+                        if (symbol == 16) {
+                            if (i == 0)
+                                throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                            repeated = lengths[i - 1];
+                            repeat = 3 + bits(2);
+                        } else if (symbol == 17)
+                            repeat = 3 + bits(3);
+                        else
+                            repeat = 11 + bits(7);
+                        if (i + repeat > literal_count + distance_count)
+                            throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                        std::fill_n(lengths.begin() + i, repeat, repeated);
+                        i += repeat;
+                    }
+                    walk_codes(Huffman({lengths.data(), literal_count}), Huffman({lengths.data() + literal_count, distance_count}));
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Encountered corrupt DEFLATE stream");
+            }
+        }
+        return position();
+    }
+
+    /**
+     * Walks the blocks of a complete raw DEFLATE stream to locate its exact end.
+     * @param stream A complete raw DEFLATE stream, without a zlib header or trailer
+     * @return The position of the final block's header and the end of the stream, in bits
+     * @throw @c std::runtime_error if @p stream is truncated or malformed
+     */
+    inline DeflateBounds measure_deflate(std::span<const unsigned char> stream) {
+        struct : DeflateBounds {
+            void block(std::size_t bit) { final_block_bit = bit; }
+            void literal(unsigned char) {}
+            void match(unsigned, unsigned) {}
+            void stored(std::span<const unsigned char>) {}
+            static bool done() { return false; }
+        } visitor{};
+        visitor.end_bit = walk_deflate(stream, visitor);
+        return visitor;
+    }
+
+    /**
+     * The result of inspecting a zlib stream with @c inspect_zlib().
+     */
+    struct ZlibSummary {
+        /**
+         * The decompressed bytes preceding the first @c NUL byte, if one was found within the prefix limit.
+         */
+        std::optional<std::vector<unsigned char>> prefix;
+        /**
+         * The total size of the decompressed data.
+         */
+        std::size_t uncompressed_size;
+    };
+
+    /**
+     * Determines the size of the data within a zlib stream, and decodes just its leading bytes up to the first @c NUL byte,
+     *     without decompressing the rest of the stream into memory.
+     * @param compressed zlib-compressed bytes to be inspected
+     * @param prefix_limit The maximum number of leading bytes to search for a @c NUL byte
+     * @param measure Whether to walk the whole stream to measure its size, or to stop as soon as the search for a @c NUL byte ends
+     * @return The bytes preceding the first @c NUL byte, and the size of the decompressed data, or of the part decoded if not measuring
+     * @throw @c std::runtime_error if @p compressed is not a valid zlib stream
+     */
+    inline ZlibSummary inspect_zlib(std::span<const unsigned char> compressed, std::size_t prefix_limit, bool measure=true) {
+        // zlib header: CM must be 8 (DEFLATE), FDICT must be unset, and the header must be divisible by 31
+        if (compressed.size() < 2 || (compressed[0] & 0x0F) != 8 || (compressed[1] & 0x20)
+            || (compressed[0] * 256u + compressed[1]) % 31 != 0)
+            throw std::runtime_error("Encountered corrupt zlib stream");
+        struct {
+            std::vector<unsigned char> prefix;
+            std::size_t prefix_limit;
+            bool measure;
+            std::size_t size = 0;
+            bool searching = true;
+            bool found = false;
+
+            void block(std::size_t) {}
+            void literal(unsigned char byte) {
+                ++size;
+                if (searching)
+                    push(byte);
+            }
+            void match(unsigned length, unsigned distance) {
+                size += length;
+                if (distance > prefix.size() && searching)
+                    throw std::runtime_error("Encountered corrupt DEFLATE stream");
+                for (unsigned i = 0; i < length && searching; ++i)
+                    push(prefix[prefix.size() - distance]);
+            }
+            void stored(std::span<const unsigned char> bytes) {
+                size += bytes.size();
+                for (std::size_t i = 0; i < bytes.size() && searching; ++i)
+                    push(bytes[i]);
+            }
+            [[nodiscard]] bool done() const { return !measure && !searching; }
+
+            void push(unsigned char byte) {
+                if (byte == '\0') {
+                    searching = false;
+                    found = true;
+                } else if (prefix.size() == prefix_limit)
+                    searching = false;
+                else
+                    prefix.push_back(byte);
+            }
+        } visitor{{}, prefix_limit, measure};
+        walk_deflate(compressed.subspan(2), visitor);
+        ZlibSummary summary{std::nullopt, visitor.size};
+        if (visitor.found)
+            summary.prefix.emplace(std::move(visitor.prefix));
+        return summary;
+    }
+
+    /**
+     * The size and checksum of the data within a compressed stream, as found by @c digest_zlib() or a @c Codec.
+     */
+    struct StreamDigest {
+        /**
+         * The size of the decompressed data, excluding any skipped leading bytes.
+         */
+        std::uint64_t size;
+        /**
+         * The CRC-32 of the decompressed data, excluding any skipped leading bytes.
+         */
+        std::uint32_t crc;
+    };
+
+    /**
+     * Accumulates the checksums of decompressed data that is streamed through it, keeping only a sliding window of the data.
+     * @details
+     *     Output is written into a ring buffer holding twice the largest window of any supported format,
+     *     and is checksummed and overwritten once a full window of it has accumulated past the last checksum.
+     */
+    class DigestWindow {
+    public:
+        /**
+         * The largest distance back into the output that a DEFLATE match can copy from.
+         */
+        static constexpr std::size_t WINDOW_SIZE = std::size_t{1} << 15;
+
+        /**
+         * Creates an empty window.
+         * @param skip The number of leading bytes of output to exclude from the CRC-32 and size, e.g. a subfile's filename
+         */
+        explicit DigestWindow(std::uint64_t skip=0) : ring(2 * WINDOW_SIZE), skip(skip) {}
+
+        /**
+         * Creates an empty window that excludes instead the leading bytes of output up to and including the first @c NUL byte, and records them.
+         * @param prefix_limit The maximum number of leading bytes to search for a @c NUL byte
+         * @return An empty window, from which @c prefix() retrieves the bytes preceding the @c NUL byte once it has been checksummed
+         */
+        static DigestWindow until_nul(std::size_t prefix_limit) {
+            DigestWindow window;
+            window.prefix_limit = prefix_limit;
+            return window;
+        }
+
+        /**
+         * Appends a byte to the output.
+         * @param byte The byte to be appended
+         */
+        void push(unsigned char byte) {
+            ring[position++ & MASK] = byte;
+            if (position - checksummed >= WINDOW_SIZE)
+                flush();
+        }
+
+        /**
+         * Appends a copy of earlier output to the output.
+         * @param length The number of bytes to copy
+         * @param distance How far back from the end of the output to copy from, which may be less than @p length
+         * @throw @c std::runtime_error if @p distance reaches back past the beginning of the output or the window
+         */
+        void copy(unsigned length, unsigned distance) {
+            if (distance > position || distance > WINDOW_SIZE)
+                throw std::runtime_error("Encountered corrupt DEFLATE stream");
+            for (unsigned i = 0; i < length; ++i)
+                push(ring[(position - distance) & MASK]);
+        }
+
+        /**
+         * Appends bytes to the output.
+         * @param bytes The bytes to be appended
+         */
+        void append(std::span<const unsigned char> bytes) {
+            while (!bytes.empty()) {
+                const auto offset = static_cast<std::size_t>(position & MASK);
+                const auto run = std::min({bytes.size(), ring.size() - offset, WINDOW_SIZE});
+                std::memcpy(ring.data() + offset, bytes.data(), run);
+                position += run;
+                bytes = bytes.subspan(run);
+                if (position - checksummed >= WINDOW_SIZE)
+                    flush();
+            }
+        }
+
+        /**
+         * Checksums any output not yet checksummed.
+         * @return The size and CRC-32 of the output so far, excluding the skipped leading bytes
+         */
+        StreamDigest finish() {
+            flush();
+            return {position > skip ? position - skip : 0, crc};
+        }
+
+        /**
+         * The Adler-32 checksum of all output so far, including any skipped leading bytes.
+         * @return The running Adler-32 checksum, once @c finish() has been called
+         */
+        [[nodiscard]] std::uint32_t adler() const { return adler_sum; }
+
+        /**
+         * The leading bytes of output preceding the first @c NUL byte, for a window created by @c until_nul().
+         * @return The bytes preceding the @c NUL byte, once @c finish() has been called, or @c std::nullopt if none was found within the prefix limit
+         */
+        [[nodiscard]] std::optional<std::vector<unsigned char>> &prefix() { return prefix_bytes; }
+
+    private:
+        static constexpr std::size_t MASK = 2 * WINDOW_SIZE - 1;
+
+        std::vector<unsigned char> ring;
+        std::uint64_t skip;
+        std::uint64_t position = 0, checksummed = 0;
+        std::uint32_t crc = 0, adler_sum = 1;
+        // The limit of a search for a NUL byte still under way, and the bytes found to precede it
+        std::optional<std::size_t> prefix_limit;
+        std::vector<unsigned char> searched;
+        std::optional<std::vector<unsigned char>> prefix_bytes;
+
+        void flush() {
+            while (checksummed < position) {
+                const auto offset = static_cast<std::size_t>(checksummed & MASK);
+                const auto run = static_cast<std::size_t>(std::min<std::uint64_t>(position - checksummed, ring.size() - offset));
+                const std::span<const unsigned char> bytes{ring.data() + offset, run};
+                adler_sum = adler32(bytes, adler_sum);
+                if (prefix_limit.has_value()) {
+                    // Bytes are searched as they are checksummed, so the skip is known before any of the bytes it covers are added to the CRC-32
+                    const auto candidates = bytes.first(static_cast<std::size_t>(std::min<std::uint64_t>(run, prefix_limit.value() + 1 - checksummed)));
+                    const auto nul = std::ranges::find(candidates, '\0');
+                    searched.insert(searched.end(), candidates.begin(), nul);
+                    if (nul != candidates.end()) {
+                        skip = checksummed + static_cast<std::size_t>(nul - candidates.begin()) + 1;
+                        prefix_bytes.emplace(std::move(searched));
+                        prefix_limit.reset();
+                    } else if (checksummed + candidates.size() > prefix_limit.value())
+                        prefix_limit.reset();
+                }
+                if (checksummed + run > skip) {
+                    const auto skipped = static_cast<std::size_t>(checksummed < skip ? skip - checksummed : 0);
+                    crc = crc32(bytes.subspan(skipped), crc);
+                }
+                checksummed += run;
+            }
+        }
+    };
+
+    /**
+     * Decompresses a zlib stream through a @c DigestWindow only to checksum its contents, verifying its Adler-32 trailer.
+     * @param compressed zlib-compressed bytes to be checked
+     * @param window The window through which to stream the decompressed data, which determines the leading bytes to exclude
+     * @return The size and CRC-32 of the decompressed data following the bytes excluded by @p window
+     * @throw @c std::runtime_error if @p compressed is not a valid zlib stream, or its trailer does not match its contents
+     */
+    inline StreamDigest digest_zlib(std::span<const unsigned char> compressed, DigestWindow &window) {
+        if (compressed.size() < 2 || (compressed[0] & 0x0F) != 8 || (compressed[1] & 0x20)
+            || (compressed[0] * 256u + compressed[1]) % 31 != 0)
+            throw std::runtime_error("Encountered corrupt zlib stream");
+        struct {
+            DigestWindow &window;
+
+            void block(std::size_t) {}
+            void literal(unsigned char byte) { window.push(byte); }
+            void match(unsigned length, unsigned distance) { window.copy(length, distance); }
+            void stored(std::span<const unsigned char> bytes) { window.append(bytes); }
+            static bool done() { return false; }
+        } visitor{window};
+        const auto end_byte = 2 + (walk_deflate(compressed.subspan(2), visitor) + 7) / 8;
+        const auto digest = visitor.window.finish();
+        if (compressed.size() < end_byte + 4 || read_big_endian<std::uint32_t>(&compressed[end_byte]) != visitor.window.adler())
+            throw std::runtime_error("Encountered zlib stream whose checksum does not match its contents");
+        return digest;
+    }
+
+    /**
+     * Decompresses a zlib stream only to checksum its contents, verifying its Adler-32 trailer, without holding its data in memory.
+     * @param compressed zlib-compressed bytes to be checked
+     * @param skip The number of leading bytes of decompressed data to exclude from the result, e.g. a subfile's filename
+     * @return The size and CRC-32 of the decompressed data following the first @p skip bytes
+     * @throw @c std::runtime_error if @p compressed is not a valid zlib stream, or its trailer does not match its contents
+     */
+    inline StreamDigest digest_zlib(std::span<const unsigned char> compressed, std::uint64_t skip=0) {
+        DigestWindow window(skip);
+        return digest_zlib(compressed, window);
+    }
+
+    /**
+     * Decompresses a zlib stream only to checksum its contents, as in @c digest_zlib(), excluding the leading bytes up to the first @c NUL byte.
+     * @param compressed zlib-compressed bytes to be checked
+     * @param prefix_limit The maximum number of leading bytes to search for a @c NUL byte
+     * @return The bytes preceding the first @c NUL byte, and the size and CRC-32 of the decompressed data following it
+     * @throw @c std::runtime_error if @p compressed is not a valid zlib stream, its trailer does not match its contents,
+     *     or no @c NUL byte was found within @p prefix_limit bytes
+     */
+    inline std::pair<std::vector<unsigned char>, StreamDigest> digest_zlib_prefixed(std::span<const unsigned char> compressed, std::size_t prefix_limit) {
+        auto window = DigestWindow::until_nul(prefix_limit);
+        const auto digest = digest_zlib(compressed, window);
+        if (!window.prefix().has_value())
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        return {std::move(window.prefix().value()), digest};
+    }
+
+    /**
+     * Compresses the data in @p parts with zlib compression, splitting it into blocks that are compressed concurrently.
+     * @param parts Bytes to be compressed, as a list of parts that are compressed as if they were contiguous
+     * @param level The compression level preset with which to compress each block
+     * @param block_size The number of uncompressed bytes to compress in each independent block
+     * @return A @c ManagedByteSpan holding a single zlib stream containing a compressed form of @p parts
+     * @details
+     *     Similar to pigz, each block is compressed into its own raw DEFLATE stream, and the streams are then joined
+     *     by clearing the @c BFINAL flag of every block but the last and byte-aligning each with an empty stored block.
+     *     The result is an ordinary zlib stream that may be decompressed by any inflater.\n
+     *     Unlike pigz, blocks are not primed with the previous block's tail as a dictionary, since LodePNG's DEFLATE
+     *     implementation offers no way to do so; matches cannot cross block boundaries, which costs a small amount of compression.\n
+     *     Blocks lying within a single part are compressed in place, and only blocks straddling parts are first copied together.
+     */
+    inline ManagedByteSpan compress_parallel(ByteParts parts, unsigned level=MAX_LEVEL, std::size_t block_size=PARALLEL_BLOCK_SIZE) {
+        struct Block {
+            ManagedByteSpan stream;
+            DeflateBounds bounds;
+            std::uint32_t adler;
+        };
+        const auto data_size = total_size(parts);
+        const std::size_t block_count = std::max<std::size_t>((data_size + block_size - 1) / block_size, 1);
+        auto &pool = ThreadPool::shared();
+        std::vector<std::future<Block>> tasks;
+        tasks.reserve(block_count);
+        for (std::size_t i = 0; i < block_count; ++i)
+            tasks.emplace_back(pool.submit([parts, data_size, level, block_size, block_count, i] {
+                // Reused by every block compressed on this thread, so that straddling blocks do not each allocate
+                thread_local std::vector<unsigned char> scratch;
+                const auto settings = COMPRESSION_PRESETS[level];
+                const auto input = gather(parts, i * block_size, std::min(block_size, data_size - i * block_size), scratch);
+                PNGFUSE_TRACE_SCOPE("deflate_block", input.size());
+                unsigned char *buffer = nullptr;
+                std::size_t buffer_size = 0;
+                const auto error = lodepng_deflate(&buffer, &buffer_size, input.data(), input.size(), &settings);
+                Block block{adopt_lodepng(buffer, buffer_size), {}, 0};
+                check_error(error);
+                // The last block keeps its final flag and trailing bits, so only the others need to be measured
+                block.bounds = i + 1 < block_count ? measure_deflate(block.stream.data()) : DeflateBounds{0, block.stream.size() * 8};
+                block.adler = adler32(input);
+                return block;
+            }));
+        const auto blocks = pool.wait_all(tasks);
+
+        // Empty non-final stored block: a 3-bit header that is zero-padded to a byte boundary, then LEN = 0x0000, NLEN = 0xFFFF.
+        // If at least three padding bits already follow a block, they serve as the header and only the LEN/NLEN bytes are needed.
+        constexpr unsigned char SYNC_FLUSH[5] {0x00, 0x00, 0x00, 0xFF, 0xFF};
+        std::size_t output_size = 2 + 4;
+        for (const auto &block : blocks)
+            output_size += (block.bounds.end_bit + 7) / 8 + sizeof(SYNC_FLUSH);
+
+        auto compressed = ManagedByteSpan::allocate(output_size);
+        auto *const buffer = compressed.data().data();
+        unsigned char *out = buffer;
+        // zlib header: CM = 8 (DEFLATE), CINFO = 7 (32K window), FLEVEL = 0, FCHECK such that the header is divisible by 31
+        *out++ = 0x78;
+        *out++ = 0x01;
+        std::uint32_t adler = 1;
+        for (std::size_t i = 0; i < block_count; ++i) {
+            const auto &[stream, bounds, block_adler] = blocks[i];
+            const auto stream_bytes = (bounds.end_bit + 7) / 8;
+            std::memcpy(out, stream.data().data(), stream_bytes);
+            if (const auto tail_bits = bounds.end_bit & 7)
+                // Zero the padding after the final end-of-block code, since it may be read as the next block header
+                out[stream_bytes - 1] &= static_cast<unsigned char>((1u << tail_bits) - 1);
+            if (i + 1 < block_count) {
+                out[bounds.final_block_bit >> 3] &= static_cast<unsigned char>(~(1u << (bounds.final_block_bit & 7)));
+                const auto padding_bits = (8 - (bounds.end_bit & 7)) & 7;
+                const auto flush = padding_bits >= 3 ? std::span<const unsigned char>(SYNC_FLUSH).subspan(1) : std::span<const unsigned char>(SYNC_FLUSH);
+                std::memcpy(out + stream_bytes, flush.data(), flush.size());
+                out += stream_bytes + flush.size();
+            } else
+                out += stream_bytes;
+            const auto input_size = std::min(block_size, data_size - i * block_size);
+            adler = i == 0 ? block_adler : adler32_combine(adler, block_adler, input_size);
+        }
+        for (int shift = 24; shift >= 0; shift -= 8)
+            *out++ = static_cast<unsigned char>(adler >> shift);
+        compressed.shrink(static_cast<std::size_t>(out - buffer));
+        return compressed;
+    }
+
+    /**
+     * Compresses the data in @p parts with zlib compression.
+     * @param parts Bytes to be compressed, as a list of parts that are compressed as if they were contiguous
+     * @param level The compression level preset to use, from @c STORE_LEVEL to @c MAX_LEVEL
+     * @return A @c ManagedByteSpan holding a compressed form of @p parts
+     * @details
+     *     Inputs spanning several @c PARALLEL_BLOCK_SIZE blocks are compressed concurrently via @c compress_parallel(),
+     *     and smaller inputs are compressed as a single block.
+     *     This depends only on the size of the input, so that the output is the same regardless of the number of jobs.
+     */
+    inline ManagedByteSpan compress(ByteParts parts, unsigned level=MAX_LEVEL) {
+        const auto data_size = total_size(parts);
+        return compress_parallel(parts, std::min(level, MAX_LEVEL),
+                                 data_size >= 2 * PARALLEL_BLOCK_SIZE ? PARALLEL_BLOCK_SIZE : std::max<std::size_t>(data_size, 1));
+    }
+
     /**
      * Compresses the data in @p data with zlib compression.
      * @param data Bytes to be compressed
+     * @param level The compression level preset to use, from @c STORE_LEVEL to @c MAX_LEVEL
      * @return A @c ManagedByteSpan holding a compressed form of @p data
      */
-    ManagedByteSpan compress(std::span<const unsigned char> data) {
-        unsigned char *buffer = nullptr;
-        std::size_t buffer_size = 0;
-        auto settings = best_compression();
-        const auto error = lodepng_zlib_compress(&buffer, &buffer_size, data.data(), data.size(), &settings);
-        ManagedByteSpan compressed{buffer, buffer_size};
-        check_error(error);
-        return compressed;
+    inline ManagedByteSpan compress(std::span<const unsigned char> data, unsigned level=MAX_LEVEL) {
+        return compress(ByteParts(&data, 1), level);
+    }
+
+    /**
+     * The 8-byte signature at the beginning of every PNG file (see http://www.libpng.org/pub/png/spec/1.2/PNG-Structure.html).
+     */
+    constexpr unsigned char PNG_SIGNATURE[8] {137, 80, 78, 71, 13, 10, 26, 10};
+
+    /**
+     * Writes a PNG chunk to @p out whose data is gathered from several buffers, without first joining them.
+     * @param out The stream to which to write the chunk
+     * @param type The 4-character type code for the chunk, e.g. zTXt
+     * @param parts The buffers whose concatenation forms the chunk data
+     * @throw @c std::runtime_error if the chunk data is too large for a PNG chunk
+     */
+    inline void write_chunk(std::ostream &out, const char *type, std::initializer_list<std::span<const unsigned char>> parts) {
+        std::size_t length = 0;
+        for (const auto &part : parts)
+            length += part.size();
+        if (length > 0x7FFFFFFF)
+            throw std::runtime_error("Chunk data exceeds the maximum PNG chunk size.");
+        std::vector<unsigned char> header;
+        append_big_endian(header, static_cast<std::uint32_t>(length));
+        header.insert(header.end(), type, type + 4);
+        auto crc = crc32(std::span(header).subspan(4));
+        out.write(reinterpret_cast<const char *>(header.data()), static_cast<std::streamsize>(header.size()));
+        for (const auto &part : parts) {
+            crc = crc32(part, crc);
+            out.write(reinterpret_cast<const char *>(part.data()), static_cast<std::streamsize>(part.size()));
+        }
+        std::vector<unsigned char> footer;
+        append_big_endian(footer, crc);
+        out.write(reinterpret_cast<const char *>(footer.data()), static_cast<std::streamsize>(footer.size()));
+    }
+
+    /**
+     * Writes a PNG chunk into a preallocated buffer, with its data gathered from several buffers without first joining them.
+     * @param out A pointer to at least <tt>total_size(parts) + 12</tt> bytes to be overwritten
+     * @param type The 4-character type code for the chunk, e.g. zTXt
+     * @param parts The buffers whose concatenation forms the chunk data
+     * @return A pointer to the byte following the written chunk
+     * @throw @c std::runtime_error if the chunk data is too large for a PNG chunk
+     */
+    inline unsigned char *write_chunk(unsigned char *out, const char *type, ByteParts parts) {
+        const auto length = total_size(parts);
+        if (length > 0x7FFFFFFF)
+            throw std::runtime_error("Chunk data exceeds the maximum PNG chunk size.");
+        PNGFUSE_TRACE_SCOPE("chunk_encode", length + 12);
+        const auto chunk_type = write_big_endian(out, static_cast<std::uint32_t>(length));
+        out = std::copy(type, type + 4, chunk_type);
+        auto crc = crc32(std::span<const unsigned char>(chunk_type, 4));
+        for (const auto &part : parts) {
+            crc = crc32(part, crc);
+            out = std::ranges::copy(part, out).out;
+        }
+        return write_big_endian(out, crc);
+    }
+
+    /**
+     * Encodes data into the general PNG chunk format by combining its 4-character type code and data, and computing its CRC.
+     * @param parts The buffers whose concatenation forms the chunk data
+     * @param type The 4-character type code for the chunk, e.g. zTXt
+     * @return A @c ManagedByteSpan holding the encoded chunk data, allocated once at its final size
+     */
+    inline ManagedByteSpan chunk_encode(ByteParts parts, const char *type) {
+        const auto size = total_size(parts) + 12;
+        auto chunk = ManagedByteSpan::allocate(size);
+        write_chunk(chunk.data().data(), type, parts);
+        return chunk;
     }
 
     /**
@@ -111,13 +1018,141 @@ namespace ImageImplementation {
      * @param type The 4-character type code for the chunk, e.g. zTXt
      * @return A @c ManagedByteSpan holding the encoded chunk data
      */
-    ManagedByteSpan chunk_encode(std::span<const unsigned char> data, const char *type) {
-        unsigned char *buffer = nullptr;
-        std::size_t buffer_size = 0;
-        const auto error = lodepng_chunk_create(&buffer, &buffer_size, data.size(), type, data.data());
-        ManagedByteSpan chunk{buffer, buffer_size};
-        check_error(error);
-        return chunk;
+    inline ManagedByteSpan chunk_encode(std::span<const unsigned char> data, const char *type) {
+        return chunk_encode(ByteParts(&data, 1), type);
+    }
+
+    /**
+     * Locates the end of the @c IDAT chunks in a PNG file by reading only its chunk headers.
+     * @param in A seekable stream positioned at the beginning of the PNG file. Its position is left unspecified
+     * @param file The path to the PNG file being read, for error messages
+     * @return The offset from the beginning of the file immediately following the last @c IDAT chunk
+     * @throw @c native_runtime_error if the stream does not hold a valid PNG file with image data
+     */
+    inline std::uint64_t find_idat_end(std::istream &in, const path &file) {
+        unsigned char header[8];
+        if (!in.read(reinterpret_cast<char *>(header), 8) || std::memcmp(header, PNG_SIGNATURE, 8) != 0)
+            throw native_runtime_error(file.native() + NATIVE_WIDTH(" is not a valid PNG file."));
+        std::uint64_t position = 8;
+        bool idat_found = false;
+        while (in.read(reinterpret_cast<char *>(header), 8)) {
+            const bool is_idat = std::memcmp(header + 4, "IDAT", 4) == 0;
+            if (idat_found && !is_idat)
+                return position;
+            idat_found |= is_idat;
+            position += 12 + read_big_endian<std::uint32_t>(header);
+            in.seekg(static_cast<std::streamoff>(position));
+        }
+        throw native_runtime_error(file.native() + NATIVE_WIDTH(" is not a valid PNG file."));
+    }
+
+    /**
+     * Locates the @c IEND chunk in a PNG file by reading only its chunk headers.
+     * @param in A seekable stream positioned at the beginning of the PNG file. Its position is left unspecified
+     * @param file The path to the PNG file being read, for error messages
+     * @return The offset from the beginning of the file of the header of the @c IEND chunk
+     * @throw @c native_runtime_error if the stream does not hold a valid PNG file with an @c IEND chunk following its image data
+     */
+    inline std::uint64_t find_iend(std::istream &in, const path &file) {
+        unsigned char header[8];
+        if (!in.read(reinterpret_cast<char *>(header), 8) || std::memcmp(header, PNG_SIGNATURE, 8) != 0)
+            throw native_runtime_error(file.native() + NATIVE_WIDTH(" is not a valid PNG file."));
+        std::uint64_t position = 8;
+        bool idat_found = false;
+        while (in.read(reinterpret_cast<char *>(header), 8)) {
+            if (idat_found && std::memcmp(header + 4, "IEND", 4) == 0)
+                return position;
+            idat_found |= std::memcmp(header + 4, "IDAT", 4) == 0;
+            position += 12 + read_big_endian<std::uint32_t>(header);
+            in.seekg(static_cast<std::streamoff>(position));
+        }
+        throw native_runtime_error(file.native() + NATIVE_WIDTH(" is not a valid PNG file."));
+    }
+
+    /**
+     * Reads the chunks of a PNG image one at a time from a stream that need not be seekable, such as standard input.
+     * @details
+     *     Only the chunk most recently read is held in memory, so an image can be passed through chunk by chunk
+     *     without ever loading it whole. Reading stops at the @c IEND chunk, and any data following it is left unread.
+     */
+    class ChunkReader {
+    public:
+        /**
+         * Begins reading a PNG image by checking its signature.
+         * @param in The stream from which to read the image, positioned at its signature
+         * @throw @c std::runtime_error if @p in does not begin with @c PNG_SIGNATURE
+         */
+        explicit ChunkReader(std::istream &in) : in(in) {
+            unsigned char signature[8];
+            if (!in.read(reinterpret_cast<char *>(signature), 8) || std::memcmp(signature, PNG_SIGNATURE, 8) != 0)
+                throw std::runtime_error("Image data is not a valid PNG file.");
+        }
+
+        /**
+         * Reads the next chunk of the image.
+         * @return A view of the whole encoded chunk, from its length to its CRC, valid until the next call,
+         *     or @c std::nullopt once the @c IEND chunk has been read
+         * @throw @c std::runtime_error if the stream ends before the @c IEND chunk, or holds a chunk longer than a PNG chunk may be
+         */
+        [[nodiscard]] std::optional<std::span<const unsigned char>> next() {
+            if (ended)
+                return std::nullopt;
+            chunk.resize(8);
+            if (!in.read(reinterpret_cast<char *>(chunk.data()), 8))
+                throw std::runtime_error("Image data ended before its IEND chunk.");
+            const auto length = read_big_endian<std::uint32_t>(chunk.data());
+            if (length > 0x7FFFFFFF)
+                throw std::runtime_error("Image data is not a valid PNG file.");
+            chunk.resize(std::size_t{length} + 12);
+            if (!in.read(reinterpret_cast<char *>(chunk.data() + 8), static_cast<std::streamsize>(length) + 4))
+                throw std::runtime_error("Image data ended before its IEND chunk.");
+            ended = std::memcmp(chunk.data() + 4, "IEND", 4) == 0;
+            return std::span<const unsigned char>(chunk);
+        }
+
+    private:
+        std::istream &in;
+        std::vector<unsigned char> chunk;
+        bool ended = false;
+    };
+
+    /**
+     * Inserts new chunks into a PNG file in place, immediately before its @c IEND chunk, without rewriting the rest of the file.
+     * @tparam WriteChunks A callable taking a seekable <tt>std::ostream &</tt>, into which the new chunks are written
+     * @param file The path to the PNG file to be modified
+     * @param write_chunks A callable that writes the encoded chunks to be inserted into the stream it is given
+     * @throw @c native_runtime_error if @p file is not a valid PNG file, or could not be modified
+     * @details
+     *     Only the headers of the existing chunks are read, to find the @c IEND chunk.
+     *     The new chunks are written over it, and the @c IEND chunk and anything following it are then written again after them,
+     *     so the cost depends on the size of the new chunks rather than that of the file.\n
+     *     If writing fails partway, the @c IEND chunk is restored and the file is truncated back to its original size.
+     */
+    template <std::invocable<std::ostream &> WriteChunks>
+    void insert_before_iend(const path &file, WriteChunks &&write_chunks) {
+        std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+        if (!stream)
+            throw native_runtime_error(NATIVE_WIDTH("Could not open output file ") + file.native() + NATIVE_WIDTH('.'));
+        const auto iend = find_iend(stream, file);
+        stream.clear();
+        stream.seekg(static_cast<std::streamoff>(iend));
+        std::vector<char> tail(static_cast<std::size_t>(remaining_size(stream)));
+        if (!stream.read(tail.data(), static_cast<std::streamsize>(tail.size())))
+            throw native_runtime_error(NATIVE_WIDTH("Failed to read file ") + file.native() + NATIVE_WIDTH('.'));
+        try {
+            stream.seekp(static_cast<std::streamoff>(iend));
+            std::forward<WriteChunks>(write_chunks)(static_cast<std::ostream &>(stream));
+            if (!stream.write(tail.data(), static_cast<std::streamsize>(tail.size())) || !stream.flush())
+                throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + file.native() + NATIVE_WIDTH('.'));
+        } catch (...) {
+            stream.clear();
+            stream.seekp(static_cast<std::streamoff>(iend));
+            stream.write(tail.data(), static_cast<std::streamsize>(tail.size()));
+            stream.close();
+            std::error_code ignored;
+            std::filesystem::resize_file(file, iend + tail.size(), ignored);
+            throw;
+        }
     }
 }
 
@@ -161,25 +1196,10 @@ struct TextChunk {
      * @param chunk A pointer to the beginning of an encoded PNG chunk's header
      */
     explicit TextChunk(const unsigned char *chunk) {
-        /* Via http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html
-         * A zTXt chunk contains:
-         *     Keyword:            1-79 bytes (character string)
-         *     Null separator:     1 byte
-         *     Compression method: 1 byte
-         *     Compressed text:    n bytes
-         */
-        const auto length = lodepng_chunk_length(chunk);
-        const auto data = lodepng_chunk_data_const(chunk);
-        const auto end_of_key = static_cast<const unsigned char *>(std::memchr(data, '\0', length - 1));
-        if (!end_of_key)
-            throw std::runtime_error("Encountered corrupt chunk");
-        key = {data, end_of_key};
-        const auto compression_method = std::next(end_of_key);
-        if (*compression_method != 0)
+        const auto contents = decode_key(chunk);
+        if (contents.front() != 0)
             throw std::runtime_error("Encountered corrupt chunk");
-        const auto compressed = std::next(compression_method);
-        const auto compressed_length = static_cast<std::size_t>(length - std::distance(data, compressed));
-        const auto decompressed = ImageImplementation::decompress({compressed, compressed_length});
+        const auto decompressed = ImageImplementation::decompress(contents.subspan(1));
         value = {decompressed.begin(), decompressed.end()};
     }
 
@@ -188,21 +1208,11 @@ struct TextChunk {
      * @return @c key and @c value encoded into a @c zTXt chunk
      */
     [[nodiscard]] virtual ImageImplementation::ManagedByteSpan encode() const {
-        return ImageImplementation::chunk_encode(encode_data(), TextChunk::type());
-    }
-
-    /**
-     * Concatenates @c key with the zlib-compressed form of @c value.
-     * @return A @c zTXt-compatible encoding of a key-value pair, without a PNG chunk header
-     */
-    [[nodiscard]] std::vector<unsigned char> encode_data() const {
+        // The null separator and the compression method byte (0, zlib) between the key and the compressed value
+        static constexpr unsigned char separator[2] {'\0', '\0'};
         const auto compressed = ImageImplementation::compress(value);
-        std::vector<unsigned char> encoded(key.cbegin(), key.cend());
-        encoded.reserve(key.size() + 2 + compressed.size());
-        encoded.push_back('\0');
-        encoded.push_back('\0');
-        std::copy(compressed.begin(), compressed.end(), std::back_inserter(encoded));
-        return encoded;
+        const std::span<const unsigned char> parts[] {key, separator, compressed.data()};
+        return ImageImplementation::chunk_encode(parts, TextChunk::type());
     }
 
     /**
@@ -214,7 +1224,38 @@ struct TextChunk {
         return lodepng_chunk_type_equals(chunk, TextChunk::type());
     }
 
+    TextChunk(const TextChunk &) = default;
+    TextChunk(TextChunk &&) noexcept = default;
+    TextChunk &operator=(const TextChunk &) = default;
+    TextChunk &operator=(TextChunk &&) noexcept = default;
     virtual ~TextChunk() = default;
+
+protected:
+    TextChunk() = default;
+
+    /**
+     * Reads the keyword of the @c zTXt-style chunk pointed to by @p chunk into @c key.
+     * @param chunk A pointer to the beginning of an encoded PNG chunk's header
+     * @return The chunk data following the keyword's null separator, beginning with the compression method byte
+     * @throw @c std::runtime_error if the chunk has no null-terminated keyword followed by at least one byte
+     */
+    std::span<const unsigned char> decode_key(const unsigned char *chunk) {
+        /* Via http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html
+         * A zTXt chunk contains:
+         *     Keyword:            1-79 bytes (character string)
+         *     Null separator:     1 byte
+         *     Compression method: 1 byte
+         *     Compressed text:    n bytes
+         */
+        const auto length = lodepng_chunk_length(chunk);
+        const auto data = lodepng_chunk_data_const(chunk);
+        const auto end_of_key = length < 2 ? nullptr : static_cast<const unsigned char *>(std::memchr(data, '\0', length - 1));
+        if (!end_of_key)
+            throw std::runtime_error("Encountered corrupt chunk");
+        key = {data, end_of_key};
+        const auto contents = std::next(end_of_key);
+        return {contents, static_cast<std::size_t>(length - std::distance(data, contents))};
+    }
 };
 
 
@@ -223,133 +1264,242 @@ struct TextChunk {
  * @tparam ChunkT A handler for the type of chunk to be targeted for reading, writing, and deleting.
  *    A @p ChunkT should support:
  *    @c ChunkT::encode() to return a form of itself suitable for insertion into PNG image data,
- *    @c ChunkT::is_valid() to determine if a chunk should be included in enumerations and deletions,
- *    and a <pre>ChunkT::ChunkT(unsigned const char *)</pre> constructor that can be called with a pointer to raw encoded chunk data.
+ *    and @c ChunkT::is_valid() to determine if a chunk should be included in deletions.
  * @details
  *    This implementation only supports inserting chunks between the end of the @c IDAT chunks and the @c IEND chunk.
  *    This is because inserting large amounts of ancillary data before the @c IDAT chunk can slow down PNG viewing applications.
  *    \n
- *    Note, however, that enumerating chunks via @c Image<ChunkT>::get_chunks()
+ *    Note, however, that finding chunks via @c Image<ChunkT>::find_chunks()
  *    and deleting chunks via @c Image<ChunkT>::clear_chunks() covers the whole image data, from @c IHDR to @c IEND.
  */
 template <class ChunkT>
 struct Image {
-    /**
-     * The raw PNG image data.
-     */
-    std::vector<unsigned char> image;
-
     /**
      * Loads PNG image data from a file.
      * @param file The file from which to load the image data
+     * @details
+     *     The file is memory-mapped, and is only copied into memory when the image data is first modified.
+     *     Its chunk headers are read once here into an index, which every later query and modification uses instead of walking the file.
      */
-    explicit Image(const path &file) : image(read(file)) {
-        // Verify the PNG signature (see http://www.libpng.org/pub/png/spec/1.2/PNG-Structure.html)
-        constexpr unsigned char PNG_SIGNATURE[8] {137, 80, 78, 71, 13, 10, 26, 10};
-        if (image.size() < 8 || std::memcmp(image.data(), PNG_SIGNATURE, 8) != 0)
+    explicit Image(const path &file) : source(file), mapping(std::in_place, file) {
+        if (!has_signature())
             throw native_runtime_error(file.native() + NATIVE_WIDTH(" is not a valid PNG file."));
-        idat_end_pos = find_idat_end();
+        build_index();
+    }
+
+    /**
+     * Loads PNG image data viewed in place in memory owned by the caller, such as a buffer received over a network.
+     * @param data The raw PNG image data, which must outlive the image and remain unchanged until the image is first modified
+     * @details As with a mapped file, the data is only copied when the image data is first modified.
+     */
+    explicit Image(std::span<const unsigned char> data) : borrowed(data) {
+        if (!has_signature())
+            throw std::runtime_error("Image data is not a valid PNG file.");
+        build_index();
+    }
+
+    /**
+     * Loads PNG image data held in memory, taking ownership of it.
+     * @param data The raw PNG image data
+     */
+    explicit Image(std::vector<unsigned char> &&data) : image(std::move(data)) {
+        if (!has_signature())
+            throw std::runtime_error("Image data is not a valid PNG file.");
+        build_index();
+    }
+
+    /**
+     * The current image data, either viewed in place in the mapped file or held in memory.
+     * @return A view of the raw PNG image data, invalidated by any modification of the image
+     * @details Any chunks pending insertion are first spliced into the image data.
+     */
+    [[nodiscard]] std::span<const unsigned char> bytes() const {
+        if (!pending_chunks.empty())
+            splice();
+        return stored_bytes();
     }
 
     /**
      * Adds a new chunk into the image data.
      * @param chunk A @c ChunkT object supporting a @c ChunkT::encode() method that returns a properly formatted PNG chunk
-     * @details This adds the new chunk immediately following the end of the last @c IDAT chunk.
+     * @details
+     *     This adds the new chunk immediately following the end of the last @c IDAT chunk.
+     *     The encoded chunk is held until the image is saved or otherwise accessed, so that all insertions are performed in one pass.
      */
     void add_chunk(const ChunkT &chunk) {
-        const auto encoded_chunk = chunk.encode();
-        const auto idat_end_iterator = std::next(image.begin(), idat_end_pos);
-        image.insert(idat_end_iterator, encoded_chunk.begin(), encoded_chunk.end());
+        pending_chunks.insert(pending_chunks.begin(), chunk.encode());
     }
 
     /**
-     * Adds several new chunks into the image data, encoding their data in parallel.
+     * Adds several new chunks into the image data, encoding their data in parallel on the shared @c ThreadPool.
      * @param chunks A vector of @c ChunkT objects supporting a @c ChunkT::encode() method that returns a properly formatted PNG chunk
-     * @details This adds new chunks immediately following the end of the last @c IDAT chunk.
+     * @details
+     *     This adds new chunks immediately following the end of the last @c IDAT chunk.
+     *     The encoded chunks are held until the image is saved or otherwise accessed, so that all insertions are performed in one pass.
      */
     void add_chunk(const std::vector<ChunkT> &chunks) {
+        auto &pool = ThreadPool::shared();
         std::vector<std::future<ImageImplementation::ManagedByteSpan>> futures;
-        std::vector<ImageImplementation::ManagedByteSpan> encoded;
         futures.reserve(chunks.size());
-        encoded.reserve(chunks.size());
         for (const auto &chunk : chunks)
-            futures.emplace_back(std::async(&ChunkT::encode, &chunk));
-        std::size_t total_size{};
-        for (auto &future : futures) {
-            encoded.emplace_back(future.get());
-            total_size += encoded.back().size();
-        }
-        futures.clear();
-        image.reserve(image.size() + total_size);
-        for (const auto &encoded_chunk : std::ranges::reverse_view(encoded)) {
-            image.insert(std::next(image.begin(), idat_end_pos), encoded_chunk.begin(), encoded_chunk.end());
-        }
+            futures.emplace_back(pool.submit([&chunk] { return chunk.encode(); }));
+        add_encoded_chunks(pool.wait_all(futures));
     }
 
     /**
-     * Enumerates chunks in the image data of type @c ChunkT::type() that satisfy @c ChunkT::is_valid().
-     * @return A vector of @c ChunkT objects constructed from the chunks in the image data for which @c ChunkT::is_valid() returns @c true
+     * Finds every chunk of a given type in the image data, using the chunk index rather than reading the image data.
+     * @param type The 4-character type code of the chunks to find, e.g. fuSe
+     * @return Pointers to the beginning of each matching chunk's header in @c bytes(), in order, invalidated by any modification of the image
      */
-    [[nodiscard]] std::vector<ChunkT> get_chunks() const {
-        const auto begin = image.data();
-        const auto end = &image.back() + 1;
-        std::vector<ChunkT> chunks;
-        for (const unsigned char *chunk = begin + 8;
-             chunk < end;
-             chunk = lodepng_chunk_next_const(chunk, end)) {
-            if (ChunkT::is_valid(chunk))
-                chunks.emplace_back(chunk);
-        }
+    [[nodiscard]] std::vector<const unsigned char *> find_chunks(const char *type) const {
+        const auto begin = bytes().data();
+        std::vector<const unsigned char *> chunks;
+        for (const auto &entry : chunk_index)
+            if (entry.has_type(type))
+                chunks.push_back(begin + entry.offset);
         return chunks;
     }
 
     /**
      * Deletes all chunks found in the image data that satisfy @c ChunkT::is_valid().
      * @return The number of deleted chunks
-     * @details Valid chunks are deleted in contiguous blocks from back-to-front to reduce copy/move operations.
+     * @details
+     *     Valid chunks are deleted in contiguous blocks from back-to-front to reduce copy/move operations,
+     *     and the chunk index is then updated in a single pass.
      */
     std::size_t clear_chunks() {
-        const auto begin = image.data();
-        const auto end = &image.back() + 1;
-        std::vector<std::pair<Offset, Offset>> ranges;
-        std::optional<Offset> range_begin;
-        std::size_t chunk_count = 0;
-        // Find contiguous ranges of chunks
-        for (unsigned char *chunk = begin + 8;
-             chunk < end;
-             chunk = lodepng_chunk_next(chunk, end)) {
-            if (ChunkT::is_valid(chunk)) {
-                ++chunk_count;
-                if (!range_begin.has_value())
-                    // Start of a range
-                    range_begin = std::distance(begin, chunk);
-            } else if (range_begin.has_value()) {
-                // End of a range
-                const auto range_end = std::distance(begin, chunk);
-                ranges.emplace_back(range_begin.value(), range_end);
-                range_begin.reset();
-            }
-        }
+        make_writable();
+        auto [ranges, kept] = plan_removal();
 
         const auto iterator_begin = image.begin();
 
         // Delete contiguous ranges of chunks back-to-front to not invalidate offsets and to perform fewer moves
-        for (const auto [_range_begin, _range_end] : std::ranges::reverse_view(ranges)) {
-            image.erase(std::next(iterator_begin, _range_begin), std::next(iterator_begin, _range_end));
+        for (const auto &[range_begin, range_end] : std::ranges::reverse_view(ranges)) {
+            image.erase(std::next(iterator_begin, static_cast<Offset>(range_begin)), std::next(iterator_begin, static_cast<Offset>(range_end)));
+        }
+
+        const auto chunk_count = chunk_index.size() - kept.size();
+        chunk_index = std::move(kept);
+        idat_end_pos = find_idat_end();
+        return chunk_count;
+    }
+
+    /**
+     * Deletes all chunks that satisfy @c ChunkT::is_valid() directly from the file the image was loaded from, without rewriting all of it.
+     * @return The number of deleted chunks
+     * @details
+     *     Only the data following the first deleted chunk is moved back over the deleted chunks, and the file is then truncated.
+     *     Since chunks are inserted just before the @c IEND chunk, deleting them usually only moves the @c IEND chunk itself.\n
+     *     The file is mapped again afterwards, so the image remains usable.
+     *     If the image has been modified since it was loaded, it is instead saved over its file after deleting the chunks from memory,
+     *     and an image that was loaded from memory rather than from a file is only modified in memory, as with @c clear_chunks().
+     */
+    std::size_t clear_chunks_in_place() {
+        // An image that was not loaded from a file has nowhere else to be modified
+        if (source.empty())
+            return clear_chunks();
+        if (!mapping.has_value() || !pending_chunks.empty()) {
+            const auto chunk_count = clear_chunks();
+            save(source);
+            return chunk_count;
         }
+        auto [ranges, kept] = plan_removal();
+        if (ranges.empty())
+            return 0;
+        // Release the mapping first, since a mapped file cannot be truncated on all platforms
+        mapping.reset();
+        erase_ranges(source, ranges);
+        mapping.emplace(source);
 
+        const auto chunk_count = chunk_index.size() - kept.size();
+        chunk_index = std::move(kept);
+        idat_end_pos = find_idat_end();
         return chunk_count;
     }
 
+    /**
+     * Checks the CRC of every chunk in the image data, in parallel on the shared @c ThreadPool.
+     * @return The offsets of the chunks whose stored CRC does not match their type and data, in order,
+     *     followed by the offset of any trailing data too short to be a complete chunk
+     */
+    [[nodiscard]] std::vector<std::size_t> find_corrupt_chunks() const {
+        using namespace ImageImplementation;
+        const auto data = bytes();
+        auto &pool = ThreadPool::shared();
+        std::vector<std::future<std::vector<std::size_t>>> futures;
+        // Small chunks are checked together, so that each task covers about a block's worth of data
+        for (std::size_t first = 0, last = 0; first < chunk_index.size(); first = last) {
+            for (std::size_t size = 0; last < chunk_index.size() && (last == first || size < PARALLEL_BLOCK_SIZE); ++last)
+                size += chunk_index[last].size();
+            futures.emplace_back(pool.submit([this, data, first, last] {
+                std::vector<std::size_t> corrupt;
+                for (const auto &entry : std::span(chunk_index).subspan(first, last - first)) {
+                    const auto chunk = data.subspan(entry.offset, entry.size());
+                    if (crc32(chunk.subspan(4, std::size_t{entry.length} + 4)) != read_big_endian<std::uint32_t>(&chunk[8 + entry.length]))
+                        corrupt.push_back(entry.offset);
+                }
+                return corrupt;
+            }));
+        }
+        std::vector<std::size_t> corrupt;
+        for (const auto &offsets : pool.wait_all(futures))
+            corrupt.insert(corrupt.end(), offsets.begin(), offsets.end());
+        if (const auto indexed_end = chunk_index.empty() ? 8 : chunk_index.back().offset + chunk_index.back().size(); indexed_end != data.size())
+            corrupt.push_back(indexed_end);
+        return corrupt;
+    }
+
     /**
      * Saves the current state of the image data at the path pointed to by @p out.
      * @param out The file path at which to save the image
+     * @details
+     *     The unmodified parts of the image and any chunks pending insertion are written together with a single gathering write,
+     *     without assembling them in memory first.
+     *     The exception is saving an image over the file it is still mapped from, in which case the image is copied into memory first.
      */
     void save(const path &out) const {
-        write(out, image);
+        PNGFUSE_TRACE_SCOPE("save", 0);
+        if (mapping.has_value() && std::filesystem::exists(out) && std::filesystem::equivalent(source, out))
+            splice();
+        write(out, splice_plan());
+    }
+
+    /**
+     * Writes the current state of the image data to @p out, as with @c save(), without assembling it in memory first.
+     * @param out The stream to which to write the image
+     * @throw @c std::runtime_error if @p out could not be written to
+     */
+    void save(std::ostream &out) const {
+        PNGFUSE_TRACE_SCOPE("save", 0);
+        for (const auto part : splice_plan())
+            if (!out.write(reinterpret_cast<const char *>(part.data()), static_cast<std::streamsize>(part.size())))
+                throw std::runtime_error("Failed to write image data to stream.");
+    }
+
+    /**
+     * Moves the current image data out of the image, including any chunks pending insertion, to be used without saving it to a file.
+     * @return The raw PNG image data
+     * @details
+     *     Image data still viewed in a mapped file or borrowed memory is first copied, as when it is modified.
+     *     The image is left empty, and may only be destroyed afterwards.
+     */
+    [[nodiscard]] std::vector<unsigned char> release() && {
+        make_writable();
+        chunk_index.clear();
+        return std::move(image);
     }
 
 protected:
+    /**
+     * The file from which the image data was loaded.
+     */
+    path source;
+
+    /**
+     * The raw PNG image data, once it has been copied out of the mapped file by an operation that modifies it.
+     */
+    mutable std::vector<unsigned char> image;
+
     /**
      * An iterator offset relative to @c image.begin() or @c image.data().
      */
@@ -360,15 +1510,206 @@ protected:
     Offset idat_end_pos;
 
     /**
-     * Locates the end offset of the @c IDAT chunks in the image data, to initialize @c idat_end_pos.
+     * The location and type of one chunk in the image data, as recorded in the chunk index.
+     */
+    struct ChunkEntry {
+        /**
+         * The offset of the beginning of the chunk's header from the beginning of the image data.
+         */
+        std::size_t offset;
+        /**
+         * The length of the chunk's data, excluding its header and CRC.
+         */
+        std::uint32_t length;
+        /**
+         * The chunk's 4-character type code.
+         */
+        std::array<char, 4> type;
+
+        /**
+         * The size of the whole chunk, including its header and CRC.
+         * @return The number of bytes occupied by the chunk in the image data
+         */
+        [[nodiscard]] constexpr std::size_t size() const { return std::size_t{length} + 12; }
+
+        /**
+         * Determines if the chunk has the type @p chunk_type.
+         * @param chunk_type A 4-character type code, e.g. IDAT
+         * @return @c true if the chunk's type code is @p chunk_type, @c false otherwise
+         */
+        [[nodiscard]] bool has_type(const char *chunk_type) const { return !std::memcmp(type.data(), chunk_type, 4); }
+    };
+
+    /**
+     * The location and type of every chunk in the image data as last spliced, in order.
+     */
+    mutable std::vector<ChunkEntry> chunk_index;
+
+    /**
+     * The mapped file from which the image data is read until it is first modified.
+     */
+    mutable std::optional<MappedFile> mapping;
+
+    /**
+     * The memory owned by the caller from which the image data is read until it is first modified, if it was loaded from memory.
+     */
+    mutable std::optional<std::span<const unsigned char>> borrowed;
+
+    /**
+     * Encoded chunks waiting to be inserted at @c idat_end_pos, in order.
+     */
+    mutable std::vector<ImageImplementation::ManagedByteSpan> pending_chunks;
+
+    /**
+     * Adds several already encoded chunks into the image data, in order.
+     * @param encoded Properly formatted PNG chunks, as returned by @c ChunkT::encode()
+     * @details As with @c add_chunk(), the chunks are held until the image is saved or otherwise accessed.
+     */
+    void add_encoded_chunks(std::vector<ImageImplementation::ManagedByteSpan> &&encoded) {
+        PNGFUSE_TRACE_SCOPE("add_chunk", [&encoded] { std::size_t size = 0; for (const auto &chunk : encoded) size += chunk.size(); return size; }());
+        pending_chunks.insert(pending_chunks.begin(), std::make_move_iterator(encoded.begin()), std::make_move_iterator(encoded.end()));
+    }
+
+    /**
+     * The image data as last spliced, without any chunks pending insertion.
+     * @return A view of the mapped file, the borrowed memory, or @c image
+     */
+    [[nodiscard]] std::span<const unsigned char> stored_bytes() const {
+        return mapping.has_value() ? mapping->data() : borrowed.value_or(std::span<const unsigned char>(image));
+    }
+
+    /**
+     * Checks that the image data begins with the PNG signature.
+     * @return @c true if the stored image data begins with @c ImageImplementation::PNG_SIGNATURE, @c false otherwise
+     */
+    [[nodiscard]] bool has_signature() const {
+        const auto data = stored_bytes();
+        return data.size() >= 8 && std::memcmp(data.data(), ImageImplementation::PNG_SIGNATURE, 8) == 0;
+    }
+
+    /**
+     * Reads every chunk header of newly loaded image data into @c chunk_index, and finds @c idat_end_pos.
+     */
+    void build_index() {
+        const auto data = stored_bytes();
+        PNGFUSE_TRACE_SCOPE("index", data.size());
+        chunk_index = index_chunks(data, 8);
+        idat_end_pos = find_idat_end();
+    }
+
+    /**
+     * Describes the current image data as a sequence of buffers to be concatenated, including all chunks pending insertion.
+     * @return The stored image data before @c idat_end_pos, each pending chunk, and the stored image data after @c idat_end_pos
+     */
+    [[nodiscard]] std::vector<std::span<const unsigned char>> splice_plan() const {
+        const auto stored = stored_bytes();
+        const auto split = static_cast<std::size_t>(idat_end_pos);
+        std::vector<std::span<const unsigned char>> plan;
+        plan.reserve(pending_chunks.size() + 2);
+        plan.push_back(stored.first(split));
+        for (const auto &encoded_chunk : pending_chunks)
+            plan.push_back(encoded_chunk.data());
+        plan.push_back(stored.subspan(split));
+        return plan;
+    }
+
+    /**
+     * Assembles the image data described by @c splice_plan() into @c image in a single pass,
+     * inserting all pending chunks and releasing the mapped file or borrowed memory.
+     */
+    void splice() const {
+        std::vector<unsigned char> spliced;
+        const auto plan = splice_plan();
+        PNGFUSE_TRACE_SCOPE("splice", ImageImplementation::total_size(plan));
+        // Index the inserted chunks and shift the chunks that follow them, rather than walking the whole image again
+        const auto split = static_cast<std::size_t>(idat_end_pos);
+        const auto first_moved = std::ranges::find_if(chunk_index, [split] (const ChunkEntry &entry) { return entry.offset >= split; });
+        std::vector<ChunkEntry> inserted;
+        std::size_t position = split;
+        for (const auto &encoded_chunk : pending_chunks) {
+            const auto entries = index_chunks(encoded_chunk.data(), 0);
+            for (const auto &entry : entries)
+                inserted.push_back({entry.offset + position, entry.length, entry.type});
+            position += encoded_chunk.size();
+        }
+        for (auto &entry : std::ranges::subrange(first_moved, chunk_index.end()))
+            entry.offset += position - split;
+        chunk_index.insert(first_moved, inserted.begin(), inserted.end());
+        std::size_t total_size = 0;
+        for (const auto &part : plan)
+            total_size += part.size();
+        spliced.reserve(total_size);
+        for (const auto &part : plan)
+            spliced.insert(spliced.end(), part.begin(), part.end());
+        image = std::move(spliced);
+        pending_chunks.clear();
+        mapping.reset();
+        borrowed.reset();
+    }
+
+    /**
+     * Ensures the image data is held in @c image with no chunks pending insertion, so that it may be modified in place.
+     */
+    void make_writable() {
+        if (mapping.has_value() || borrowed.has_value() || !pending_chunks.empty())
+            splice();
+    }
+
+    /**
+     * Finds the chunks in the image data that satisfy @c ChunkT::is_valid(), to be deleted.
+     * @return The contiguous <tt>[begin, end)</tt> ranges of chunks to be deleted, in order,
+     *     and the index entries of the chunks that remain, with their offsets shifted back over the chunks deleted before them
+     */
+    [[nodiscard]] std::pair<std::vector<std::pair<std::uint64_t, std::uint64_t>>, std::vector<ChunkEntry>> plan_removal() const {
+        const auto data = stored_bytes();
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+        std::vector<ChunkEntry> kept;
+        kept.reserve(chunk_index.size());
+        std::size_t removed_size = 0;
+        // Find contiguous ranges of chunks, shifting the chunks that remain back over those removed before them
+        for (auto entry : chunk_index) {
+            if (entry.has_type(ChunkT::type()) && ChunkT::is_valid(data.data() + entry.offset)) {
+                if (!ranges.empty() && ranges.back().second == entry.offset)
+                    ranges.back().second += entry.size();
+                else
+                    ranges.emplace_back(entry.offset, entry.offset + entry.size());
+                removed_size += entry.size();
+            } else {
+                entry.offset -= removed_size;
+                kept.push_back(entry);
+            }
+        }
+        return {std::move(ranges), std::move(kept)};
+    }
+
+    /**
+     * Reads the headers of the chunks in @p data into index entries, following their lengths from @p offset.
+     * @param data The data in which to find chunks
+     * @param offset The offset of the first chunk's header in @p data
+     * @return The location and type of each complete chunk found in @p data, in order
+     * @details A chunk whose declared length runs past the end of @p data ends the index, along with anything following it.
+     */
+    static std::vector<ChunkEntry> index_chunks(std::span<const unsigned char> data, std::size_t offset) {
+        std::vector<ChunkEntry> entries;
+        while (data.size() - offset >= 12) {
+            const auto length = lodepng_chunk_length(data.data() + offset);
+            if (length > data.size() - offset - 12)
+                break;
+            ChunkEntry &entry = entries.emplace_back(ChunkEntry{offset, length, {}});
+            std::memcpy(entry.type.data(), data.data() + offset + 4, 4);
+            offset += entry.size();
+        }
+        return entries;
+    }
+
+    /**
+     * Locates the end offset of the @c IDAT chunks in the image data from the chunk index, to initialize @c idat_end_pos.
      * @return The offset representing the location of the end of the last @c IDAT chunk in @c image
      */
     Offset find_idat_end() const {
-        const auto end = image.data() + image.size();
-        auto chunk = lodepng_chunk_find_const(image.data() + 8, end, "IDAT");
-        while (lodepng_chunk_type_equals(chunk, "IDAT"))
-            chunk = lodepng_chunk_next_const(chunk, end);
-        return std::distance(image.data(), chunk);
+        const auto first_idat = std::ranges::find_if(chunk_index, [] (const ChunkEntry &entry) { return entry.has_type("IDAT"); });
+        const auto after_idat = std::find_if(first_idat, chunk_index.end(), [] (const ChunkEntry &entry) { return !entry.has_type("IDAT"); });
+        return static_cast<Offset>(after_idat == chunk_index.end() ? stored_bytes().size() : after_idat->offset);
     }
 };
 
@@ -6,20 +6,28 @@
  */
 
 #include <iostream>
+#include <sstream>
 #include <filesystem>
 #include <string_view>
 #include <vector>
 #include <ranges>
 #include <utility>
+#include <tuple>
 #include <algorithm>
 
 #include "subfileimage.h"
 #include "argumentparsing.h"
+#include "tarwriter.h"
 
 using std::filesystem::path;
 
 constexpr static std::u8string_view PNG_EXTENSION = u8".png";
 
+/**
+ * The type of @c native_out and @c native_err, either @c std::ostream or @c std::wostream.
+ */
+using native_ostream = std::remove_reference_t<decltype(native_out)>;
+
 
 /**
  * Converts a UTF-8 encoded string to lowercase.
@@ -36,11 +44,59 @@ static inline std::u8string string_to_lowercase(std::u8string s) {
 /**
  * Determines which file from the list of paths should be used as a fusion target for the other files.
  * @param r A range of paths to search for a target
- * @return The fusion target file from @p r
+ * @return The fusion target file from @p r, which is either a PNG or @c - for standard input
  */
 template <std::ranges::input_range PathRange>
 auto find_target(const PathRange &r) {
-    return std::ranges::find_if(r, [] (const path &p) { return string_to_lowercase(p.extension().u8string()) == PNG_EXTENSION; });
+    return std::ranges::find_if(r, [] (const path &p) {
+        return is_standard_stream(p) || string_to_lowercase(p.extension().u8string()) == PNG_EXTENSION;
+    });
+}
+
+
+/**
+ * Reads from a path given on the command line, which may be @c - for standard input.
+ * @param input The path from which to read
+ * @param read A callable taking the <tt>std::istream &</tt> from which to read
+ * @return The result of @p read
+ * @throw @c native_runtime_error if @p input could not be opened
+ */
+template <class Read>
+auto read_input(const path &input, Read &&read) {
+    if (is_standard_stream(input))
+        return read(standard_input());
+    auto in = open_input(input);
+    return read(in);
+}
+
+
+/**
+ * Writes to a path given on the command line, which may be @c - for standard output.
+ * @param output The path to which to write
+ * @param write A callable taking the <tt>std::ostream &</tt> to which to write
+ * @throw @c native_runtime_error if @p output could not be written to
+ * @details A file left partly written by a failure of @p write is removed.
+ */
+template <class Write>
+void write_output(const path &output, Write &&write) {
+    if (is_standard_stream(output)) {
+        auto &out = standard_output();
+        write(out);
+        if (!out.flush())
+            throw std::runtime_error("Failed to write to standard output.");
+        return;
+    }
+    auto out = open_output(output);
+    try {
+        write(out);
+        out.close();
+        if (!out)
+            throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + output.native() + NATIVE_WIDTH('.'));
+    } catch (...) {
+        out.close();
+        std::filesystem::remove(output);
+        throw;
+    }
 }
 
 
@@ -49,8 +105,16 @@ auto find_target(const PathRange &r) {
  * @param files A list of files to take part in the fusion. The first PNG listed is the target for the fusion
  * @param overwrite Whether to overwrite the target file with the result, or to determine a new filename automatically
  * @param output A custom output path to save the result. Overrides the @p overwrite parameter
+ * @param stream Whether to stream files through fixed-size buffers instead of loading them whole, to bound memory usage
+ * @param solid Whether to pack the files together into one solid run of chunks, so that they compress together
+ * @param compression The settings with which to compress the subfiles
+ * @details
+ *     When the result replaces the target file, the new subfiles are appended to it in place rather than rewriting it.\n
+ *     The target may be @c - to read it from standard input, in which case the result is written to standard output unless @p output is given,
+ *     and @p output may be @c - to write the result to standard output. Either way, the image is passed through chunk by chunk.
  */
-void fuse(std::vector<path> files, bool overwrite=false, const std::optional<path> &output=std::nullopt) {
+void fuse(std::vector<path> files, bool overwrite=false, const std::optional<path> &output=std::nullopt, bool stream=false,
+          bool solid=false, const Compression &compression={}) {
     const auto target = find_target(files);
     if (target == files.cend())
         throw std::runtime_error("Could not find a target PNG to fuse into.");
@@ -65,12 +129,17 @@ void fuse(std::vector<path> files, bool overwrite=false, const std::optional<pat
     }
 #endif
 
-    SubFileImage image(target_file);
-
-    if (files.size() == 1)
-        image.add_sub_file(files.front());
-    else
-        image.add_sub_file(files);
+    if (is_standard_stream(target_file) || (output.has_value() && is_standard_stream(output.value()))) {
+        const path output_file = output.value_or(target_file);
+        if (overwrite)
+            throw std::runtime_error("Cannot overwrite an image read from standard input.");
+        if (stream && is_standard_stream(output_file))
+            throw std::runtime_error("Cannot specify stream mode when writing to standard output, which cannot seek back over each chunk written.");
+        write_output(output_file, [&] (std::ostream &out) {
+            read_input(target_file, [&] (std::istream &in) { SubFileImage::fuse_pipe(in, files, out, compression, stream, solid); });
+        });
+        return;
+    }
 
     path output_file = output.value_or(target_file);
     if (!output.has_value() && !overwrite) {
@@ -79,41 +148,164 @@ void fuse(std::vector<path> files, bool overwrite=false, const std::optional<pat
         output_file += target_file.extension();
     }
 
+    if (std::filesystem::exists(output_file) && std::filesystem::equivalent(target_file, output_file)) {
+        SubFileImage::append_sub_files(target_file, files, compression, stream, solid);
+        return;
+    }
+
+    if (stream) {
+        SubFileImage::fuse_stream(target_file, files, output_file, compression);
+        return;
+    }
+
+    SubFileImage image(target_file);
+
+    if (solid)
+        image.add_solid_sub_files(files, compression);
+    else if (files.size() == 1)
+        image.add_sub_file(files.front(), compression);
+    else
+        image.add_sub_file(files, compression);
+
     image.save(output_file);
 }
 
 
 /**
  * Extract subfiles from a specified file.
- * @param source Path to a file from which to extract subfiles
+ * @param source Path to a file from which to extract subfiles, or @c - to read the image from standard input
+ * @param pattern A filename or glob selecting which subfiles to extract, or @c std::nullopt to extract all of them
+ * @param output @c - to write the subfiles to standard output as a tar archive instead of saving them as files
+ * @throw @c native_runtime_error if @p pattern matches no subfiles in @p source
+ * @details When reading from standard input or writing to standard output, the image is read chunk by chunk, as with @c SubFileImage::extract_pipe().
  */
-void sunder(const path &source) {
-    for (const SubFile &file : SubFileImage(source).get_sub_files())
-        file.save();
+void sunder(const path &source, const std::optional<path> &pattern=std::nullopt, const std::optional<path> &output=std::nullopt) {
+    std::optional<std::u8string> name_pattern;
+    if (pattern.has_value())
+        name_pattern.emplace(pattern->u8string());
+    const std::optional<std::u8string_view> name_pattern_view(name_pattern);
+    std::size_t extracted;
+    if (output.has_value() && is_standard_stream(output.value())) {
+        write_output(output.value(), [&] (std::ostream &out) {
+            TarWriter archive(out);
+            extracted = read_input(source, [&] (std::istream &in) {
+                return SubFileImage::extract_pipe(in, [&archive] (SubFile &&sub_file) { archive.add(sub_file.name.u8string(), sub_file.contents); },
+                                                  name_pattern_view);
+            });
+            archive.finish();
+        });
+    } else if (is_standard_stream(source))
+        extracted = SubFileImage::extract_pipe(standard_input(), [] (SubFile &&sub_file) { sub_file.save(); }, name_pattern_view);
+    else {
+        const SubFileImage image(source);
+        extracted = pattern.has_value() ? image.save_sub_files(name_pattern.value()) : image.save_sub_files();
+    }
+    if (pattern.has_value() && extracted == 0)
+        throw native_runtime_error(NATIVE_WIDTH("No subfiles in ") + source.native() + NATIVE_WIDTH(" match ") + pattern->native() + NATIVE_WIDTH('.'));
+}
+
+
+/**
+ * Repacks the subfiles of a specified file in another format, as selected by the compression settings.
+ * @param file Path to a fused PNG whose subfiles are to be repacked, or @c - to read it from standard input
+ * @param overwrite Whether to replace the input file with the result, or to determine a new filename automatically
+ * @param output A custom output path to save the result, or @c - for standard output. Overrides the @p overwrite parameter
+ * @param solid Whether to pack the subfiles together into solid runs instead of encoding each on its own
+ * @param compression The settings with which to compress the repacked subfiles
+ * @param stream The stream to which to print the number of repacked subfiles
+ * @details
+ *     The image is passed through chunk by chunk, as with @c SubFileImage::repack_pipe(), so no subfile is written to the filesystem.
+ *     When the result replaces the input file, it is written to a temporary file that then replaces the input file.
+ */
+void repack(const path &file, bool overwrite=false, const std::optional<path> &output=std::nullopt, bool solid=false,
+            const Compression &compression={}, native_ostream &stream=native_out) {
+    if (overwrite && is_standard_stream(file))
+        throw std::runtime_error("Cannot overwrite an image read from standard input.");
+    path output_path = output.value_or(file);
+    if (!output.has_value() && !overwrite && !is_standard_stream(file)) {
+        // Generate a non-conflicting name
+        output_path.replace_extension(".repacked");
+        output_path += file.extension();
+    }
+
+    const bool in_place = !is_standard_stream(file) && !is_standard_stream(output_path)
+                          && std::filesystem::exists(output_path) && std::filesystem::equivalent(file, output_path);
+    path destination = output_path;
+    if (in_place)
+        destination += ".tmp";
+    RepackResult result;
+    write_output(destination, [&] (std::ostream &out) {
+        result = read_input(file, [&] (std::istream &in) { return SubFileImage::repack_pipe(in, out, compression, solid); });
+    });
+    if (in_place)
+        std::filesystem::rename(destination, output_path);
+    stream << result.repacked << " subfile" << (result.repacked == 1 ? "" : "s") << " repacked, "
+           << result.skipped << " already in the target format." << std::endl;
+}
+
+
+/**
+ * List subfiles present in a loaded image.
+ * @param image An image whose subfiles are to be listed
+ * @param stream The stream to which to print the listing
+ */
+void list(const SubFileImage &image, native_ostream &stream=native_out) {
+    for (const SubFileInfo &file : image.get_sub_file_info()) {
+        stream << file.name.native() << " : " << file.size << " bytes" << std::endl;
+    }
 }
 
 
 /**
- * List subfiles present in a specified file.
- * @param source Path to a file whose subfiles are to be listed
+ * Checks the chunk CRCs of a loaded image and the integrity of each of its subfiles, without extracting them.
+ * @param image An image whose integrity is to be checked
+ * @param stream The stream to which to print the results
+ * @return @c true if no problems were found, @c false otherwise
  */
-void list(const path &source) {
-    for (const SubFile &file : SubFileImage(source).get_sub_files()) {
-        native_out << file.name.native() << " : " << file.contents.size() << " bytes" << std::endl;
+bool verify(const SubFileImage &image, native_ostream &stream=native_out) {
+    const auto corrupt_chunks = image.find_corrupt_chunks();
+    for (const auto offset : corrupt_chunks)
+        stream << "Chunk at offset " << offset << " is corrupt." << std::endl;
+    std::size_t corrupt_count = 0;
+    const auto checks = image.verify_sub_files();
+    for (const SubFileCheck &check : checks) {
+        if (check.info.name.empty())
+            stream << "(unreadable filename) : ";
+        else
+            stream << check.info.name.native() << " : ";
+        if (check.error.has_value()) {
+            ++corrupt_count;
+            stream << "corrupt (" << check.error.value().c_str() << ')' << std::endl;
+        } else
+            stream << "OK" << std::endl;
     }
+    if (corrupt_count == 0)
+        stream << checks.size() << " subfile" << (checks.size() == 1 ? "" : "s") << " verified." << std::endl;
+    else
+        stream << corrupt_count << " of " << checks.size() << " subfiles corrupt." << std::endl;
+    return corrupt_chunks.empty() && corrupt_count == 0;
 }
 
 
 /**
- * Removes subfiles from a specified file.
- * @param source Path to a file from which to remove subfiles
+ * Removes subfiles from a loaded image and saves the result.
+ * @param image An image from which to remove subfiles
+ * @param source Path to the file from which @p image was loaded
  * @param overwrite Whether to overwrite the input file with the result, or to determine a new filename automatically
  * @param output A custom output path to save the result. Overrides the @p overwrite parameter
+ * @param stream The stream to which to print the number of removed subfiles
+ * @details
+ *     When the result replaces the input file, the subfiles are removed from it in place rather than rewriting it.\n
+ *     When the image was read from standard input, the result is written to standard output unless @p output is given.
  */
-void clean(const path &source, bool overwrite=false, const std::optional<path> &output=std::nullopt) {
-    SubFileImage image(source);
-    const std::size_t num_cleared = image.clear_chunks();
-    native_out << num_cleared << " subfile" << (num_cleared == 1 ? "" : "s") << " removed." << std::endl;
+void clean(SubFileImage &image, const path &source, bool overwrite=false, const std::optional<path> &output=std::nullopt,
+           native_ostream &stream=native_out) {
+    if (is_standard_stream(output.value_or(source))) {
+        const auto num_cleared = image.clear_sub_files();
+        write_output(output.value_or(source), [&image] (std::ostream &out) { image.save(out); });
+        stream << num_cleared << " subfile" << (num_cleared == 1 ? "" : "s") << " removed." << std::endl;
+        return;
+    }
 
     path output_path = output.value_or(source);
     if (!output.has_value() && !overwrite) {
@@ -127,7 +319,130 @@ void clean(const path &source, bool overwrite=false, const std::optional<path> &
         output_path.replace_filename(new_stem + new_extension);
     }
 
-    image.save(output_path);
+    std::size_t num_cleared;
+    if (std::filesystem::exists(output_path) && std::filesystem::equivalent(source, output_path)) {
+        num_cleared = image.clear_sub_files_in_place();
+    } else {
+        num_cleared = image.clear_sub_files();
+        image.save(output_path);
+    }
+    stream << num_cleared << " subfile" << (num_cleared == 1 ? "" : "s") << " removed." << std::endl;
+}
+
+
+/**
+ * Lists, verifies, and/or cleans the subfiles of a specified file, as selected by the command line flags.
+ * @param file Path to a fused PNG to be processed
+ * @param flags The command line flags selecting the operations to perform
+ * @param stream The stream to which to print the results
+ * @return @c false if verification found any problems, @c true otherwise
+ * @details
+ *     The file is loaded once, even when several operations are performed on it, and is only cleaned if it verified successfully.\n
+ *     The file may be @c - to read it from standard input. When only cleaning, and reading from standard input or writing to standard output,
+ *     the image is passed through chunk by chunk rather than loaded, as with @c SubFileImage::clean_pipe().
+ */
+bool list_and_clean(const path &file, const Flags &flags, native_ostream &stream=native_out) {
+    if (flags.overwrite && is_standard_stream(file))
+        throw std::runtime_error("Cannot overwrite an image read from standard input.");
+    if (flags.clean && !flags.list && !flags.verify && (is_standard_stream(file) || is_standard_stream(flags.output.value_or(file)))) {
+        std::size_t num_cleared;
+        write_output(flags.output.value_or(file), [&] (std::ostream &out) {
+            num_cleared = read_input(file, [&out] (std::istream &in) { return SubFileImage::clean_pipe(in, out); });
+        });
+        stream << num_cleared << " subfile" << (num_cleared == 1 ? "" : "s") << " removed." << std::endl;
+        return true;
+    }
+    SubFileImage image = is_standard_stream(file) ? SubFileImage(read(standard_input())) : SubFileImage(file);
+    if (flags.list)
+        list(image, stream);
+    if (flags.verify && !verify(image, stream))
+        return false;
+    if (flags.clean)
+        clean(image, file, flags.overwrite, flags.output, stream);
+    return true;
+}
+
+
+/**
+ * Prints the message of an exception thrown while processing a file, in the same format as @c main().
+ * @param error The exception to be reported
+ * @param stream The stream to which to print the message
+ */
+void print_error(const std::exception_ptr &error, native_ostream &stream=native_err) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const native_runtime_error &e) {
+        stream << "Error: " << e.native_what() << std::endl;
+    } catch (const std::exception &e) {
+        stream << "Error: " << e.what() << std::endl;
+    }
+}
+
+
+/**
+ * Lists, verifies, and/or cleans several fused PNGs in parallel on the shared @c ThreadPool.
+ * @param files Paths to the fused PNGs to be processed
+ * @param flags The command line flags selecting the operations to perform
+ * @return @c true if every file was processed and verified successfully, @c false if any failed
+ * @details
+ *     The output for each file is buffered, and printed as a group in the order of @p files as soon as all earlier files are done.
+ *     A failure in one file is reported after its output without stopping the others.\n
+ *     When a custom output path is given, every file is cleaned into the same path, so files are then processed one at a time,
+ *     leaving the last file's result as before.
+ */
+bool list_and_clean(const std::vector<path> &files, const Flags &flags) {
+    using native_ostringstream = std::basic_ostringstream<native_ostream::char_type>;
+    auto &pool = ThreadPool::shared();
+    const auto process = [&flags] (const path &file) {
+        native_ostringstream stream;
+        // Provide context for which file out of multiple is being listed or cleaned
+        stream << file.filename().native() << ':' << std::endl;
+        std::exception_ptr error;
+        bool verified = true;
+        try {
+            verified = list_and_clean(file, flags, stream);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        return std::tuple{std::move(stream).str(), error, verified};
+    };
+    const bool parallel = !(flags.clean && flags.output.has_value());
+    std::vector<std::future<std::invoke_result_t<decltype(process), const path &>>> futures;
+    if (parallel) {
+        futures.reserve(files.size());
+        for (const auto &file : files)
+            futures.emplace_back(pool.submit([&process, &file] { return process(file); }));
+    }
+
+    bool succeeded = true;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        const auto [output, error, verified] = parallel ? pool.wait(futures[i]) : process(files[i]);
+        native_out << output << std::flush;
+        if (error)
+            print_error(error);
+        succeeded &= verified && !error;
+    }
+    return succeeded;
+}
+
+
+/**
+ * Reports the phases timed while processing the command line, as selected by the @c --stats and @c --trace flags.
+ * @param flags The command line flags selecting the reports to produce
+ * @throw @c native_runtime_error if the trace file could not be written
+ */
+void report_trace([[maybe_unused]] const Flags &flags) {
+#ifdef PNGFUSE_TRACE
+    if (flags.stats)
+        Trace::write_summary(native_err);
+    if (flags.trace.has_value()) {
+        auto output = open_output(flags.trace.value());
+        Trace::write_chrome_trace(output);
+        output.close();
+        if (!output)
+            throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + flags.trace->native() + NATIVE_WIDTH('.'));
+    }
+#endif
 }
 
 
@@ -138,7 +453,7 @@ void clean(const path &source, bool overwrite=false, const std::optional<path> &
  */
 void print_usage(const path &program_path, decltype(native_out) &stream=native_out) {
     const native_string program_name = program_path.filename().native();
-    stream << "usage: " << program_name << " [-h] [--list] [--clean] [--overwrite] [--output <PATH>] fuse-host.png [files to fuse...]" << std::endl
+    stream << "usage: " << program_name << " [-h] [--list] [--clean] [--overwrite] [--output <PATH>] [--extract <NAME>] [--stream] [--solid] [--index] [--verify] [--repack] [--jobs <N>] [--codec <NAME>] [--level <0-9>] [--cache <DIR>] [--in-flight <MiB>] [--stats] [--trace <PATH>] fuse-host.png [files to fuse...]" << std::endl
            << std::endl
            << "fuse subfiles into PNG metadata." << std::endl
            << std::endl
@@ -146,7 +461,7 @@ void print_usage(const path &program_path, decltype(native_out) &stream=native_o
            << " or specify a single fused PNG to extract its subfiles (without removing them)." << std::endl
            << std::endl
            << "positional arguments:" << std::endl
-           << "  fuse-host.png         path to a PNG in which to store subfiles" << std::endl
+           << "  fuse-host.png         path to a PNG in which to store subfiles, or - to read it from standard input" << std::endl
            << "  files to fuse         one or more files to be fused into fuse-host.png" << std::endl
            << std::endl
            << "optional arguments:" << std::endl
@@ -154,34 +469,83 @@ void print_usage(const path &program_path, decltype(native_out) &stream=native_o
            << "  -l, --list            list the subfiles present in a fused PNG" << std::endl
            << "  -c, --clean           remove all subfiles from a fused PNG" << std::endl
            << "  -m, --overwrite       modify the input files when fusing or cleaning instead of creating new ones" << std::endl
-           << "  -o, --output <PATH>   custom output path for the result of a fuse or clean operation" << std::endl;
+           << "  -o, --output <PATH>   custom output path for the result of a fuse or clean operation, or - for standard output" << std::endl
+           << "                        (when extracting, -o - writes the subfiles to standard output as a tar archive)" << std::endl
+           << "  -x, --extract <NAME>  extract only the subfiles with a given name, which may use * and ? wildcards" << std::endl
+           << "  -s, --stream          fuse with bounded memory, streaming files through instead of loading them whole" << std::endl
+           << "      --solid           fuse all files together into one compressed run, so that many small files compress better" << std::endl
+           << "      --index           record each fused file's name, size, and checksum so that --list and --verify need not decompress it" << std::endl
+           << "                        (older versions of PNGFuse cannot read files fused with an index)" << std::endl
+           << "      --verify          check the integrity of a fused PNG and its subfiles without extracting them" << std::endl
+           << "      --repack          compress the subfiles of fused PNGs again with the chosen --codec, --level, --index, and --solid layout" << std::endl
+           << "  -j, --jobs <N>        number of files and blocks to process at once (default: one per CPU core)" << std::endl
+           << "      --codec <NAME>    compression codec for fused files (default: zlib; available: " << Codec::names() << ")" << std::endl
+           << "      --level <0-9>     compression level for fused files, from 0 (store only) to 9 (smallest, the default)" << std::endl
+           << "      --cache <DIR>     reuse compressed copies of previously fused files kept in DIR, and keep new ones there" << std::endl
+           << "      --in-flight <MiB> megabytes of subfiles to hold decompressed at once while extracting (default: 256)" << std::endl
+           << "      --stats           print the time spent in each phase of the operation (requires a PNGFUSE_TRACE build)" << std::endl
+           << "      --trace <PATH>    write a Chrome trace of each phase of the operation to PATH (requires a PNGFUSE_TRACE build)" << std::endl;
 }
 
 
 int main(int argc, char **argv) try {
     init_unicode();
     Arguments args(argc, argv);
+    if (args.flags.jobs.has_value())
+        ThreadPool::configure(args.flags.jobs.value());
+    if (args.flags.in_flight.has_value())
+        SubFileImage::configure_in_flight(std::size_t{args.flags.in_flight.value()} << 20);
+    Compression compression{.level = args.flags.level.value_or(ImageImplementation::MAX_LEVEL), .index = args.flags.indexed};
+    if (args.flags.codec.has_value() && !(compression.codec = Codec::find(args.flags.codec.value())))
+        throw std::runtime_error("Unknown codec specified: " + args.flags.codec.value() + ". Available codecs: " + Codec::names());
+    if (args.flags.stats || args.flags.trace.has_value()) {
+#ifdef PNGFUSE_TRACE
+        Trace::enable();
+#else
+        throw std::runtime_error("Stats and trace flags require PNGFuse to be built with PNGFUSE_TRACE defined.");
+#endif
+    }
 
+    // Standard input and output can each only carry one image
+    if (args.num_args() > 1 && (args.flags.list || args.flags.clean || args.flags.verify || args.flags.repack || args.flags.extract.has_value())
+        && (std::ranges::any_of(args.args, is_standard_stream) || (args.flags.output.has_value() && is_standard_stream(args.flags.output.value()))))
+        throw std::runtime_error("Standard input and output can only be used with a single image at a time.");
+
+    bool succeeded = true;
     if (args.num_args() == 0 || args.flags.help) {
         print_usage(Arguments::program_path.value());
         return 0;
-    } else if (!(args.flags.list || args.flags.clean)) {
-        if (args.num_args() == 1)
-            sunder(args.args[0]);
-        else
-            fuse(args.args, args.flags.overwrite, args.flags.output);
-    } else {
-        for (const path &file : args.args) {
+    } else if (args.flags.repack) {
+        if (args.num_args() > 1 && args.flags.output.has_value())
+            throw std::runtime_error("Cannot specify a custom output path when repacking several images.");
+        for (const auto &file : args.args) {
+            // Keep messages out of the way of an image written to standard output
+            native_ostream &stream = is_standard_stream(args.flags.output.value_or(file)) ? native_err : native_out;
             if (args.num_args() > 1)
-                // Provide context for which file out of multiple is being listed or cleaned
-                native_out << file.filename().native() << ':' << std::endl;
-            if (args.flags.list)
-                list(file);
-            if (args.flags.clean)
-                clean(file, args.flags.overwrite, args.flags.output);
+                stream << file.filename().native() << ':' << std::endl;
+            repack(file, args.flags.overwrite, args.flags.output, args.flags.solid, compression, stream);
         }
+    } else if (args.flags.extract.has_value()) {
+        for (const auto &file : args.args)
+            sunder(file, args.flags.extract, args.flags.output);
+    } else if (!(args.flags.list || args.flags.clean || args.flags.verify)) {
+        if (args.num_args() == 1)
+            sunder(args.args[0], std::nullopt, args.flags.output);
+        else {
+            std::optional<ChunkCache> cache;
+            if (args.flags.cache.has_value())
+                compression.cache = &cache.emplace(args.flags.cache.value());
+            fuse(args.args, args.flags.overwrite, args.flags.output, args.flags.stream, args.flags.solid, compression);
+        }
+    } else if (args.num_args() == 1) {
+        // Keep messages out of the way of an image written to standard output
+        const bool image_to_stdout = args.flags.clean && is_standard_stream(args.flags.output.value_or(args.args[0]));
+        succeeded = list_and_clean(args.args[0], args.flags, image_to_stdout ? native_err : native_out);
+    } else {
+        succeeded = list_and_clean(args.args, args.flags);
     }
-    return 0;
+    report_trace(args.flags);
+    return succeeded ? 0 : -1;
 } catch (const native_runtime_error &e) {
     native_err << "Error: " << e.native_what() << std::endl;
     print_usage(Arguments::program_path.value_or(argv[0]), native_err);
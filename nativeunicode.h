@@ -77,7 +77,7 @@ public:
  *     and retrieves the true UTF-16 command line arguments via win32's GetCommandLineW().
  *     When called on other platforms, the resulting vector is constructed directly from the provided @p argv array.
  */
-std::vector<native_string> native_argv(int argc, char **argv) {
+inline std::vector<native_string> native_argv(int argc, char **argv) {
     std::vector<native_string> vec_argv;
 #ifdef _WINDOWS
     LPWSTR command_line = GetCommandLineW();
@@ -1,11 +1,21 @@
 #ifndef PNGFUSE_SUBFILEIMAGE_H
 #define PNGFUSE_SUBFILEIMAGE_H
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+
 #include "image.h"
+#include "codec.h"
+#include "chunkcache.h"
 
 /**
  * A class representing a file and its contents from either the filesystem or an embedded @c fuSe chunk.
- * @details A @c SubFile has a serialized ("merged") representation in the format <tt>"[filename]NUL[binary contents]"</tt>,
+ * @details A @c SubFile is serialized in a @c fuSe chunk in the format <tt>"[filename]NUL[binary contents]"</tt>,
  *     where @c filename is encoded in UTF-8.
  */
 struct SubFile {
@@ -15,9 +25,9 @@ struct SubFile {
     path name;
 
     /**
-     * The uncompressed file data associated with this subfile..
+     * The uncompressed file data associated with this subfile, which may be a view into a larger decompressed buffer.
      */
-    std::vector<unsigned char> contents;
+    ImageImplementation::ByteBuffer contents;
 
     /**
      * Creates a @c SubFile by loading the contents of @p file from the filesystem.
@@ -34,31 +44,64 @@ struct SubFile {
     inline void save() const {
         write(name, contents);
     }
+};
+
 
+/**
+ * Summary information about a subfile embedded in a fused PNG, which can be read without decompressing the subfile.
+ */
+struct SubFileInfo {
     /**
-     * Decodes a @c SubFile from its merged representation.
-     * @param data The merged representation of a @c SubFile
-     * @return The deserialized form of @p data as a @c SubFile object
+     * The filename that is recorded in the @c fuSe chunk.
      */
-    static SubFile from_merged(std::basic_string_view<unsigned char> data) {
-        const auto end_of_filename = static_cast<const unsigned char *>(std::memchr(data.data(), '\0', data.size()));
-        const path filename = std::u8string{data.data(), end_of_filename};
-        const std::vector<unsigned char> contents = {end_of_filename + 1, data.data() + data.size()};
-        return {filename, contents};
-    }
+    path name;
 
     /**
-     * Encodes a @c SubFile into its merged representation.
-     * @return The merged representation of a @c SubFile in the format <tt>"[filename]NUL[binary contents]"</tt>
+     * The size of the subfile's uncompressed contents, in bytes.
      */
-    std::vector<unsigned char> merged() && {
-        const auto filename = name.u8string();
-        std::vector<unsigned char> combined(filename.cbegin(), filename.cend());
-        combined.reserve(combined.size() + 1 + contents.size());
-        combined.push_back('\0');
-        std::move(contents.begin(), contents.end(), std::back_inserter(combined));
-        return combined;
-    }
+    std::uint64_t size;
+
+    /**
+     * The total size of the compressed data in all of the subfile's @c fuSe chunks, in bytes.
+     */
+    std::uint64_t compressed_size;
+
+    /**
+     * The CRC-32 of the subfile's uncompressed contents, if recorded in its @c fuSe chunk.
+     */
+    std::optional<std::uint32_t> checksum;
+};
+
+
+/**
+ * The result of checking the integrity of a subfile embedded in a fused PNG.
+ */
+struct SubFileCheck {
+    /**
+     * The summary information recorded for the subfile.
+     */
+    SubFileInfo info;
+
+    /**
+     * A description of the first problem found with the subfile, or @c std::nullopt if its data is intact.
+     */
+    std::optional<std::string> error;
+};
+
+
+/**
+ * The result of repacking the subfiles embedded in a fused PNG with @c SubFileImage::repack_pipe().
+ */
+struct RepackResult {
+    /**
+     * The number of subfiles decompressed and encoded again.
+     */
+    std::size_t repacked = 0;
+
+    /**
+     * The number of subfiles left as they were, being already in the target format.
+     */
+    std::size_t skipped = 0;
 };
 
 
@@ -68,13 +111,162 @@ struct SubFile {
  *     A @c fuSe chunk has a mostly compatible format with a @c zTXt chunk, with a few alterations:\n
  *     1. The keyword is always "PNGFuse"\n
  *     2. The value is of the form <tt>[filename]NUL[binary contents]</tt>\n
- *     Like a @c zTXt chunk, the keyword and value are separated by two @c NUL bytes, and the value is zlib-compressed.
+ *     Like a @c zTXt chunk, the keyword and value are separated by a @c NUL byte, and the value is zlib-compressed.
  *     Unlike in a @c zTXt chunk, where the contents are human-readable Latin-1 encoded text,
  *     @c filename is encoded in UTF-8, and the data following the filename is a sequence of bytes with no particular encoding.
+ *     \n\n
+ *     The byte following the keyword's null separator is a format version.
+ *     In the original format (version 0), it doubles as the @c zTXt compression method byte, and the chunk holds the whole compressed value.
+ *     Since a single PNG chunk is limited to 2^31-1 bytes, later formats split values exceeding @c FuseChunk::SEGMENT_SIZE bytes
+ *     into segments that are compressed independently and stored in a consecutive run of chunks:
+ *     <pre>
+ *     Keyword:            "PNGFuse"
+ *     Null separator:     1 byte
+ *     Format version:     1 byte (1, 2, or 3)
+ *     Compression method: 1 byte (see @c Codec: 0, zlib; 1, zstd; 2, LZ4)
+ *     Sequence index:     4 bytes (0-based)
+ *     Sequence count:     4 bytes
+ *     </pre>
+ *     In format version 2, the first chunk of each run also holds an uncompressed index of the subfile,
+ *     which is only written when @c FuseChunk::records_index() calls for it, so that subfiles fitting in one chunk otherwise stay readable as version 0:
+ *     <pre>
+ *     Uncompressed size:  8 bytes (size of the binary contents)
+ *     Compressed size:    8 bytes (total size of the compressed segments in the run)
+ *     CRC-32:             4 bytes (of the binary contents)
+ *     Filename length:    2 bytes
+ *     Filename:           n bytes
+ *     </pre>
+ *     In format version 3, a "solid" run instead packs several subfiles into one value holding just their concatenated binary contents,
+ *     so that small files compress together, and its first chunk holds an uncompressed table of the subfiles:
+ *     <pre>
+ *     Segment size:       4 bytes (uncompressed bytes of the value per chunk)
+ *     Entry count:        4 bytes
+ *     For each entry, as in the version 2 index:
+ *       Uncompressed size:  8 bytes
+ *       CRC-32:             4 bytes
+ *       Filename length:    2 bytes
+ *       Filename:           n bytes
+ *     </pre>
+ *     Each subfile's offset within the value follows from the sizes of the entries before it,
+ *     so one subfile can be decoded from just the segments holding it.\n
+ *     In every version, the header is followed by the compressed segment, and all integers are big-endian.
+ *     Each chunk records its own compression method, since incompressible segments are stored with zlib regardless of the codec.
+ *     The value is the concatenation of the decompressed segments in sequence order.
+ *     \n\n
+ *     In memory, the filename is held apart from the binary contents in @c value, so that neither is copied to join them:
+ *     encoding compresses the two straight from their own buffers, and decoding views the contents in place past the filename.
  */
-struct FuseChunk final : public TextChunk<std::vector<unsigned char>> {
+struct FuseChunk final : public TextChunk<ImageImplementation::ByteBuffer> {
     static constexpr std::string_view key = "PNGFuse";
 
+    /**
+     * The format version of a single @c zTXt-compatible @c fuSe chunk, which occupies the compression method byte.
+     */
+    static constexpr unsigned char LEGACY_FORMAT = 0;
+    /**
+     * The format version of a @c fuSe chunk holding one segment of a subfile, possibly split across several chunks.
+     */
+    static constexpr unsigned char SEGMENTED_FORMAT = 1;
+    /**
+     * The format version of a segmented @c fuSe chunk whose first chunk also holds a @c SubFileInfo index.
+     */
+    static constexpr unsigned char INDEXED_FORMAT = 2;
+    /**
+     * The format version of a run of @c fuSe chunks packing several subfiles into one value, whose first chunk holds a table of them.
+     */
+    static constexpr unsigned char SOLID_FORMAT = 3;
+    /**
+     * The maximum number of uncompressed bytes of a subfile's value stored in a single @c fuSe chunk.
+     */
+    static constexpr std::size_t SEGMENT_SIZE = std::size_t{1} << 25;
+    /**
+     * The maximum length of the UTF-8 encoded filename of a subfile, as limited by the filename length field of the index.
+     */
+    static constexpr std::size_t MAX_FILENAME_LENGTH = std::numeric_limits<std::uint16_t>::max();
+    /**
+     * The number of uncompressed bytes of a @c SOLID_FORMAT run's value stored in each of its chunks when encoding,
+     * small enough that decoding one subfile out of a run only needs to decompress a little more than the subfile itself.
+     */
+    static constexpr std::size_t SOLID_SEGMENT_SIZE = std::size_t{1} << 22;
+
+    /**
+     * The UTF-8 encoded filename of the subfile, which is empty for chunks after the first of a segmented run.
+     */
+    std::u8string name;
+    /**
+     * The position of this chunk in the run of chunks holding its subfile.
+     */
+    std::uint32_t sequence_index = 0;
+    /**
+     * The number of chunks in the run of chunks holding this chunk's subfile.
+     */
+    std::uint32_t sequence_count = 1;
+    /**
+     * The settings with which to compress this chunk's segments.
+     */
+    Compression compression;
+
+    /**
+     * The uncompressed header fields of an encoded @c fuSe chunk.
+     */
+    struct Header {
+        unsigned char format;
+        /**
+         * The compression method byte, which is always @c Codec::ZLIB_METHOD for @c LEGACY_FORMAT chunks.
+         */
+        unsigned char method = Codec::ZLIB_METHOD;
+        std::uint32_t sequence_index = 0;
+        std::uint32_t sequence_count = 1;
+        /**
+         * The subfile index, present only in the first chunk of an @c INDEXED_FORMAT run.
+         */
+        std::optional<SubFileInfo> info{};
+        /**
+         * The number of uncompressed bytes of the value per chunk, present only in the first chunk of a @c SOLID_FORMAT run.
+         */
+        std::uint32_t segment_size = 0;
+        /**
+         * The number of subfiles in the table, present only in the first chunk of a @c SOLID_FORMAT run.
+         */
+        std::uint32_t entry_count = 0;
+        /**
+         * The still encoded table of subfiles, present only in the first chunk of a @c SOLID_FORMAT run, to be read by @c read_table().
+         */
+        std::span<const unsigned char> table{};
+        /**
+         * The compressed data following the header.
+         */
+        std::span<const unsigned char> compressed{};
+    };
+
+    /**
+     * The table of subfiles packed into a @c SOLID_FORMAT run.
+     */
+    struct SolidTable {
+        /**
+         * A subfile packed into a @c SOLID_FORMAT run.
+         */
+        struct Entry {
+            /**
+             * The name, size, and checksum of the subfile. Its compressed size is 0, since it shares compressed data with the others.
+             */
+            SubFileInfo info;
+            /**
+             * The offset of the subfile's contents within the run's value.
+             */
+            std::uint64_t offset;
+        };
+
+        /**
+         * The number of uncompressed bytes of the run's value stored in each of its chunks.
+         */
+        std::uint32_t segment_size;
+        /**
+         * The subfiles packed into the run, in order.
+         */
+        std::vector<Entry> entries;
+    };
+
     /**
      * The PNG chunk type.
      * @return The PNG chunk type for a @c fuSe chunk, i.e. @c "fuSe"
@@ -82,31 +274,400 @@ struct FuseChunk final : public TextChunk<std::vector<unsigned char>> {
     static consteval const char *type() { return "fuSe"; }
 
     /**
-     * Compresses and encodes the keyword ("PNGFuse") and file info as a @c fuSe chunk with a chunk header.
-     * @return The file info encoded into a @c fuSe chunk
+     * Compresses and encodes the keyword ("PNGFuse") and file info as a run of @c fuSe chunks with chunk headers.
+     * @return The file info encoded into a run of one @c fuSe chunk per @c SEGMENT_SIZE bytes of the subfile's value, in the layout chosen by @c records_index()
+     * @details
+     *     Each segment is compressed straight from @c name and @c value, and the run is written into a single buffer
+     *     allocated once all segments are compressed, releasing each compressed segment as soon as it has been copied.\n
+     *     If the settings include a @c ChunkCache, a run cached for the same filename, contents, and settings is returned instead,
+     *     without compressing anything, and a newly encoded run is stored in the cache.
      */
     [[nodiscard]] ImageImplementation::ManagedByteSpan encode() const final {
-        return ImageImplementation::chunk_encode(encode_data(), FuseChunk::type());
+        static constexpr unsigned char separator[1] {'\0'};
+        const std::span<const unsigned char> filename{reinterpret_cast<const unsigned char *>(name.data()), name.size()}, contents{value.data(), value.size()};
+        PNGFUSE_TRACE_SCOPE("encode", contents.size());
+        if (filename.size() > MAX_FILENAME_LENGTH)
+            throw std::runtime_error("Subfile name is too long to be fused.");
+        const auto value_size = filename.size() + 1 + contents.size();
+        const auto count = std::max<std::size_t>((value_size + SEGMENT_SIZE - 1) / SEGMENT_SIZE, 1);
+        if (count > std::numeric_limits<std::uint32_t>::max())
+            throw std::runtime_error("Subfile is too large to be fused.");
+
+        const auto checksum = ImageImplementation::crc32(contents);
+        const bool indexed = records_index(compression);
+        std::optional<std::filesystem::path> cache_entry;
+        if (compression.cache) {
+            cache_entry.emplace(compression.cache->entry(name, contents, checksum, compression));
+            if (auto cached = compression.cache->find(cache_entry.value()); cached.has_value() && encodes(cached->data(), name, contents.size(), checksum, indexed))
+                return std::move(cached.value());
+        }
+
+        std::vector<std::pair<unsigned char, ImageImplementation::ManagedByteSpan>> segments;
+        segments.reserve(count);
+        std::uint64_t compressed_size = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            // The first segment holds the filename and separator, so later segments are offset by their length within the contents
+            const auto begin = i == 0 ? 0 : i * SEGMENT_SIZE - filename.size() - 1;
+            const auto end = std::min((i + 1) * SEGMENT_SIZE - filename.size() - 1, contents.size());
+            const auto slice = contents.subspan(begin, end - begin);
+            const std::span<const unsigned char> first[] {filename, separator, slice};
+            segments.emplace_back(compression.compress(i == 0 ? ImageImplementation::ByteParts(first) : ImageImplementation::ByteParts(&slice, 1)));
+            compressed_size += segments.back().second.size();
+        }
+
+        std::size_t encoded_size = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            encoded_size += 12 + header_size(i, count, indexed) + (i == 0 && indexed ? filename.size() : 0) + segments[i].second.size();
+        auto encoded = ImageImplementation::ManagedByteSpan::allocate(encoded_size);
+        auto *out = encoded.data().data();
+        for (std::size_t i = 0; i < count; ++i) {
+            auto &[method, segment] = segments[i];
+            HeaderBuffer header;
+            const std::span<const unsigned char> parts[] {
+                encode_header(header, method, i, count, indexed, filename.size(), contents.size(), compressed_size, checksum),
+                i == 0 && indexed ? filename : std::span<const unsigned char>{},
+                segment.data()
+            };
+            out = ImageImplementation::write_chunk(out, FuseChunk::type(), parts);
+            // Release each compressed segment as soon as it has been copied into its chunk
+            segment = {};
+        }
+        if (cache_entry.has_value())
+            compression.cache->store(cache_entry.value(), encoded.data());
+        return encoded;
+    }
+
+    /**
+     * Compresses and encodes a subfile read from a stream into a run of @c fuSe chunks written to @p out, one segment at a time.
+     * @param filename The UTF-8 encoded filename to record for the subfile
+     * @param in The stream from which to read the subfile's contents
+     * @param size The number of bytes of contents to read from @p in
+     * @param out A seekable stream to which to write the encoded chunks
+     * @param compression The settings with which to compress the segments
+     * @details
+     *     Produces the same chunks as @c FuseChunk::encode(), while holding no more than two segments in memory at once.
+     *     Since an index in the first chunk depends on the whole subfile, that chunk is rewritten in place once all others are written.
+     */
+    static void encode_stream(std::u8string_view filename, std::istream &in, std::uint64_t size, std::ostream &out,
+                              const Compression &compression={}) {
+        if (filename.size() > MAX_FILENAME_LENGTH)
+            throw std::runtime_error("Subfile name is too long to be fused.");
+        const std::span<const unsigned char> name{reinterpret_cast<const unsigned char *>(filename.data()), filename.size()};
+        const auto value_size = name.size() + 1 + size;
+        const auto count = std::max<std::uint64_t>((value_size + SEGMENT_SIZE - 1) / SEGMENT_SIZE, 1);
+        if (count > std::numeric_limits<std::uint32_t>::max())
+            throw std::runtime_error("Subfile is too large to be fused.");
+
+        const bool indexed = records_index(compression);
+        std::vector<unsigned char> segment;
+        ImageImplementation::ManagedByteSpan first_segment;
+        unsigned char first_method = Codec::ZLIB_METHOD;
+        const auto first_chunk_position = out.tellp();
+        std::uint64_t compressed_size = 0;
+        std::uint32_t checksum = 0;
+        for (std::uint64_t i = 0; i < count; ++i) {
+            const auto segment_size = static_cast<std::size_t>(std::min<std::uint64_t>(SEGMENT_SIZE, value_size - i * SEGMENT_SIZE));
+            segment.resize(segment_size);
+            std::size_t contents_offset = 0;
+            if (i == 0) {
+                std::ranges::copy(name, segment.begin());
+                segment[name.size()] = '\0';
+                contents_offset = name.size() + 1;
+            }
+            const auto contents = std::span(segment).subspan(contents_offset);
+            if (!in.read(reinterpret_cast<char *>(contents.data()), static_cast<std::streamsize>(contents.size())))
+                throw std::runtime_error("Failed to read subfile contents.");
+            checksum = ImageImplementation::crc32(contents, checksum);
+            const std::span<const unsigned char> segment_view = segment;
+
+            auto [method, compressed] = compression.compress(ImageImplementation::ByteParts(&segment_view, 1));
+            compressed_size += compressed.size();
+            HeaderBuffer header;
+            ImageImplementation::write_chunk(out, FuseChunk::type(), {encode_header(header, method, i, count, indexed, name.size(), size, 0, 0),
+                                                                   i == 0 && indexed ? name : std::span<const unsigned char>{}, compressed.data()});
+            if (i == 0 && indexed) {
+                first_method = method;
+                first_segment = std::move(compressed);
+            }
+        }
+        if (indexed) {
+            const auto end_position = out.tellp();
+            HeaderBuffer header;
+            out.seekp(first_chunk_position);
+            ImageImplementation::write_chunk(out, FuseChunk::type(), {encode_header(header, first_method, 0, count, true, name.size(), size, compressed_size, checksum),
+                                                                   name, first_segment.data()});
+            out.seekp(end_position);
+        }
+        if (!out)
+            throw std::runtime_error("Failed to write fuSe chunk.");
+    }
+
+    /**
+     * Compresses and encodes several subfiles together as one @c SOLID_FORMAT run of @c fuSe chunks with chunk headers.
+     * @param sub_files The subfiles to pack into the run, in order
+     * @param compression The settings with which to compress the run's segments
+     * @return The subfiles encoded into a run of one @c fuSe chunk per @c SOLID_SEGMENT_SIZE bytes of their joined contents
+     * @details
+     *     The contents of the subfiles are joined into one value, so that many small files compress as well as one large file would,
+     *     and each segment of the value is compressed straight from the subfiles by its own task on the shared @c ThreadPool.
+     *     A run is never looked up in or stored to a @c ChunkCache, since it depends on every subfile packed into it.
+     */
+    [[nodiscard]] static ImageImplementation::ManagedByteSpan encode_solid(std::span<const SubFile> sub_files, const Compression &compression={}) {
+        using ImageImplementation::write_big_endian;
+        if (sub_files.size() > std::numeric_limits<std::uint32_t>::max())
+            throw std::runtime_error("Too many subfiles to be fused together.");
+        std::vector<unsigned char> table;
+        std::uint64_t value_size = 0;
+        for (const auto &sub_file : sub_files) {
+            const auto filename = sub_file.name.u8string();
+            if (filename.size() > MAX_FILENAME_LENGTH)
+                throw std::runtime_error("Subfile name is too long to be fused.");
+            const std::span<const unsigned char> contents{sub_file.contents.data(), sub_file.contents.size()};
+            std::array<unsigned char, 8 + 4 + 2> entry{};
+            auto *end = write_big_endian(entry.data(), static_cast<std::uint64_t>(contents.size()));
+            end = write_big_endian(end, ImageImplementation::crc32(contents));
+            write_big_endian(end, static_cast<std::uint16_t>(filename.size()));
+            table.insert(table.end(), entry.begin(), entry.end());
+            table.insert(table.end(), filename.begin(), filename.end());
+            value_size += contents.size();
+        }
+        const auto count = std::max<std::uint64_t>((value_size + SOLID_SEGMENT_SIZE - 1) / SOLID_SEGMENT_SIZE, 1);
+        if (count > std::numeric_limits<std::uint32_t>::max())
+            throw std::runtime_error("Subfiles are too large to be fused.");
+        PNGFUSE_TRACE_SCOPE("encode_solid", value_size);
+
+        auto &pool = ThreadPool::shared();
+        std::vector<std::future<std::pair<unsigned char, ImageImplementation::ManagedByteSpan>>> futures;
+        futures.reserve(count);
+        for (std::uint64_t i = 0; i < count; ++i)
+            futures.emplace_back(pool.submit([&sub_files, &compression, begin = i * SOLID_SEGMENT_SIZE,
+                                              end = std::min((i + 1) * SOLID_SEGMENT_SIZE, value_size)] {
+                // Gather the slices of each subfile's contents that fall within this segment of the joined value
+                std::vector<std::span<const unsigned char>> parts;
+                std::uint64_t offset = 0;
+                for (const auto &sub_file : sub_files) {
+                    const std::span<const unsigned char> contents{sub_file.contents.data(), sub_file.contents.size()};
+                    if (offset < end && offset + contents.size() > begin) {
+                        const auto first = std::max(begin, offset) - offset;
+                        parts.push_back(contents.subspan(first, std::min(end, offset + contents.size()) - offset - first));
+                    }
+                    offset += contents.size();
+                }
+                return compression.compress(parts);
+            }));
+        auto segments = pool.wait_all(futures);
+
+        std::size_t encoded_size = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            encoded_size += 12 + solid_header_size(i) + (i == 0 ? table.size() : 0) + segments[i].second.size();
+        auto encoded = ImageImplementation::ManagedByteSpan::allocate(encoded_size);
+        auto *out = encoded.data().data();
+        for (std::size_t i = 0; i < count; ++i) {
+            auto &[method, segment] = segments[i];
+            HeaderBuffer header;
+            const std::span<const unsigned char> parts[] {
+                encode_solid_header(header, method, i, count, static_cast<std::uint32_t>(sub_files.size())),
+                i == 0 ? std::span<const unsigned char>(table) : std::span<const unsigned char>{},
+                segment.data()
+            };
+            out = ImageImplementation::write_chunk(out, FuseChunk::type(), parts);
+            segment = {};
+        }
+        return encoded;
     }
 
     /**
-     * Initializes a @c fuSe chunk's @c value by serializing a @c SubFile object.
+     * Initializes a @c fuSe chunk's @c name and @c value from a @c SubFile object, taking ownership of its contents.
      * @param data The @c SubFile data to be converted into a @c fuSe chunk
+     * @param compression The settings with which to compress the chunk's segments
      */
-    explicit FuseChunk(SubFile &&data) : TextChunk(key, std::move(data).merged()) {}
+    explicit FuseChunk(SubFile &&data, const Compression &compression={})
+        : TextChunk(key, std::move(data.contents)), name(data.name.u8string()), compression(compression) {}
 
     /**
      * Decode the @c fuSe chunk data pointed to by @p chunk.
      * @param chunk A pointer to the beginning of an encoded PNG chunk's header
+     * @details
+     *     For the first chunk of a subfile, the filename is split off into @c name and @c value views the rest of the decompressed buffer.
+     *     For a later chunk of a segmented run, @c value holds only this chunk's segment of the subfile's contents.
      */
-    explicit FuseChunk(const unsigned char *chunk) : TextChunk(chunk) {}
+    explicit FuseChunk(const unsigned char *chunk) {
+        const auto header = read_header(chunk);
+        TextChunk::key = {key.cbegin(), key.cend()};
+        sequence_index = header.sequence_index;
+        sequence_count = header.sequence_count;
+        const auto codec = Codec::find(header.method);
+        if (!codec)
+            throw std::runtime_error("Encountered fuSe chunk compressed with an unsupported codec");
+        compression.codec = codec;
+        PNGFUSE_TRACE_SCOPE("decompress", header.compressed.size());
+        value = codec->decompress(header.compressed);
+        if (sequence_index != 0 || header.format == SOLID_FORMAT)
+            return;
+        const auto end_of_filename = std::ranges::find(value, '\0');
+        if (end_of_filename == value.end())
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        name.assign(value.begin(), end_of_filename);
+        value.drop_front(name.size() + 1);
+    }
+
+    /**
+     * Reads the uncompressed header of the @c fuSe chunk pointed to by @p chunk, without decompressing its contents.
+     * @param chunk A pointer to the beginning of an encoded PNG chunk's header for which @c FuseChunk::is_valid() is @c true
+     * @return The header fields of @p chunk, and a view of its compressed data
+     * @throw @c std::runtime_error if the header is malformed or of an unsupported format version
+     */
+    [[nodiscard]] static Header read_header(const unsigned char *chunk) {
+        using ImageImplementation::read_big_endian;
+        const std::span<const unsigned char> data{lodepng_chunk_data_const(chunk), lodepng_chunk_length(chunk)};
+        if (data.size() < key.size() + 2 || data[key.size()] != '\0')
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        auto contents = data.subspan(key.size() + 1);
+        Header header{contents.front()};
+        if (header.format == LEGACY_FORMAT) {
+            header.compressed = contents.subspan(1);
+            return header;
+        } else if (header.format != SEGMENTED_FORMAT && header.format != INDEXED_FORMAT && header.format != SOLID_FORMAT)
+            throw std::runtime_error("Encountered fuSe chunk with an unsupported format version");
+
+        constexpr std::size_t SEQUENCE_HEADER_SIZE = 1 + 1 + 4 + 4;
+        if (contents.size() < SEQUENCE_HEADER_SIZE)
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        header.method = contents[1];
+        header.sequence_index = read_big_endian<std::uint32_t>(&contents[2]);
+        header.sequence_count = read_big_endian<std::uint32_t>(&contents[6]);
+        if (header.sequence_index >= header.sequence_count)
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        contents = contents.subspan(SEQUENCE_HEADER_SIZE);
+
+        if (header.format == INDEXED_FORMAT && header.sequence_index == 0) {
+            constexpr std::size_t INDEX_SIZE = 8 + 8 + 4 + 2;
+            if (contents.size() < INDEX_SIZE)
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            const auto name_length = read_big_endian<std::uint16_t>(&contents[20]);
+            if (contents.size() < INDEX_SIZE + name_length)
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            const auto name = contents.subspan(INDEX_SIZE, name_length);
+            header.info.emplace(SubFileInfo{
+                std::u8string{name.begin(), name.end()},
+                read_big_endian<std::uint64_t>(&contents[0]),
+                read_big_endian<std::uint64_t>(&contents[8]),
+                read_big_endian<std::uint32_t>(&contents[16])
+            });
+            contents = contents.subspan(INDEX_SIZE + name_length);
+        } else if (header.format == SOLID_FORMAT && header.sequence_index == 0) {
+            if (contents.size() < 8)
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            header.segment_size = read_big_endian<std::uint32_t>(&contents[0]);
+            header.entry_count = read_big_endian<std::uint32_t>(&contents[4]);
+            if (header.segment_size == 0)
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            // Find the end of the table from the filename lengths alone, leaving the entries to be read by read_table(),
+            // and check that every entry lies within what the run's segments can hold, so that no recorded size is trusted beyond that
+            const auto capacity = static_cast<std::uint64_t>(header.segment_size) * header.sequence_count;
+            std::uint64_t value_size = 0;
+            std::size_t table_size = 0;
+            for (std::uint32_t i = 0; i < header.entry_count; ++i) {
+                constexpr std::size_t ENTRY_SIZE = 8 + 4 + 2;
+                if (contents.size() - 8 - table_size < ENTRY_SIZE)
+                    throw std::runtime_error("Encountered corrupt fuSe chunk");
+                const auto size = read_big_endian<std::uint64_t>(&contents[8 + table_size]);
+                if (size > capacity - value_size)
+                    throw std::runtime_error("Encountered corrupt fuSe chunk");
+                value_size += size;
+                table_size += ENTRY_SIZE + read_big_endian<std::uint16_t>(&contents[8 + table_size + 12]);
+                if (table_size > contents.size() - 8)
+                    throw std::runtime_error("Encountered corrupt fuSe chunk");
+            }
+            header.table = contents.subspan(8, table_size);
+            contents = contents.subspan(8 + table_size);
+        }
+        header.compressed = contents;
+        return header;
+    }
 
     /**
-     * Constructs a @c SubFile object by deserializing a @c fuSe chunk's @c value.
-     * @return The @c SubFile object that was encoded in the @c fuSe chunk
+     * Reads the table of subfiles from the header of the first chunk of a @c SOLID_FORMAT run.
+     * @param header The header of the run's first chunk, as returned by @c read_header()
+     * @return The segment size of the run, and the name, size, checksum, and offset of each subfile packed into it
      */
-    [[nodiscard]] inline SubFile to_subfile() const {
-        return SubFile::from_merged({value.data(), value.size()});
+    [[nodiscard]] static SolidTable read_table(const Header &header) {
+        using ImageImplementation::read_big_endian;
+        SolidTable table{header.segment_size, {}};
+        table.entries.reserve(header.entry_count);
+        std::uint64_t offset = 0;
+        // The table's bounds, and those of its entries within the run, were already checked by read_header()
+        for (auto entries = header.table; !entries.empty();) {
+            const auto name_length = read_big_endian<std::uint16_t>(&entries[12]);
+            const auto name = entries.subspan(14, name_length);
+            const auto size = read_big_endian<std::uint64_t>(&entries[0]);
+            table.entries.push_back({SubFileInfo{std::u8string{name.begin(), name.end()}, size, 0, read_big_endian<std::uint32_t>(&entries[8])}, offset});
+            offset += size;
+            entries = entries.subspan(14 + name_length);
+        }
+        return table;
+    }
+
+    /**
+     * Constructs a @c SubFile object from a @c fuSe chunk's @c name and @c value, taking ownership of them.
+     * @return The @c SubFile object that was encoded in the @c fuSe chunk, whose contents are viewed in place in @c value
+     */
+    [[nodiscard]] inline SubFile to_subfile() && {
+        return {std::move(name), std::move(value)};
+    }
+
+    /**
+     * Constructs a @c SubFile object by joining the segments held in a complete run of @c fuSe chunks.
+     * @param sequence The run of chunks holding a subfile, in sequence order. Their values are consumed
+     * @return The @c SubFile object that was encoded across the chunks in @p sequence
+     * @details A run of a single chunk is converted without copying its contents, as with @c to_subfile().
+     */
+    [[nodiscard]] static SubFile to_subfile(std::span<FuseChunk> sequence) {
+        auto sub_file = std::move(sequence.front()).to_subfile();
+        if (sequence.size() == 1)
+            return sub_file;
+        std::size_t total_size = sub_file.contents.size();
+        for (const auto &chunk : sequence.subspan(1))
+            total_size += chunk.value.size();
+        std::vector<unsigned char> contents;
+        contents.reserve(total_size);
+        contents.insert(contents.end(), sub_file.contents.begin(), sub_file.contents.end());
+        sub_file.contents = {};
+        for (auto &chunk : sequence.subspan(1)) {
+            contents.insert(contents.end(), chunk.value.begin(), chunk.value.end());
+            // Release each segment as soon as it has been copied to keep peak memory down
+            chunk.value = {};
+        }
+        sub_file.contents = std::move(contents);
+        return sub_file;
+    }
+
+    /**
+     * Counts the subfiles begun by one @c fuSe chunk, reading only its header.
+     * @param chunk A pointer to the beginning of an encoded PNG chunk's header for which @c FuseChunk::is_valid() is @c true
+     * @return The number of entries in the table of the first chunk of a @c SOLID_FORMAT run, 1 for the first chunk of any other run, and 0 otherwise
+     */
+    [[nodiscard]] static inline std::size_t sub_file_count(const unsigned char *chunk) {
+        constexpr std::size_t ENTRY_COUNT_OFFSET = key.size() + 1 + 1 + 1 + 4 + 4 + 4;
+        if (!is_sequence_start(chunk))
+            return 0;
+        const auto data = lodepng_chunk_data_const(chunk);
+        if (data[key.size() + 1] != SOLID_FORMAT)
+            return 1;
+        return lodepng_chunk_length(chunk) < ENTRY_COUNT_OFFSET + 4 ? 0 : ImageImplementation::read_big_endian<std::uint32_t>(data + ENTRY_COUNT_OFFSET);
+    }
+
+    /**
+     * Determines if subfiles encoded with the given settings record an @c INDEXED_FORMAT index in their first chunk.
+     * @param compression The settings with which the subfiles are compressed
+     * @return @c true if @p compression asks for an index or uses a codec other than zlib, @c false otherwise
+     * @details
+     *     Other subfiles keep the @c LEGACY_FORMAT layout when they fit in one chunk, and the @c SEGMENTED_FORMAT layout otherwise,
+     *     so that versions of PNGFuse that predate the index can still read them. Those versions cannot read other codecs either,
+     *     so a subfile compressed with one always records an index.
+     */
+    [[nodiscard]] static constexpr bool records_index(const Compression &compression) {
+        return compression.index || compression.codec->method != Codec::ZLIB_METHOD;
     }
 
     /**
@@ -118,6 +679,507 @@ struct FuseChunk final : public TextChunk<std::vector<unsigned char>> {
         return lodepng_chunk_type_equals(chunk, FuseChunk::type())
                && !std::memcmp(key.data(), lodepng_chunk_data_const(chunk), key.size());
     }
+
+    /**
+     * Determines if a valid @c fuSe chunk begins a new subfile, i.e. is not a continuation of a segmented run, without decompressing it.
+     * @param chunk A pointer to the beginning of an encoded PNG chunk's header for which @c FuseChunk::is_valid() is @c true
+     * @return @c false if @p chunk is a segmented chunk with a nonzero sequence index, @c true otherwise
+     */
+    [[nodiscard]] static inline bool is_sequence_start(const unsigned char *chunk) {
+        constexpr std::size_t INDEX_OFFSET = key.size() + 1 + 1 + 1;
+        const auto data = lodepng_chunk_data_const(chunk);
+        return lodepng_chunk_length(chunk) < INDEX_OFFSET + 4
+               || (data[key.size() + 1] != SEGMENTED_FORMAT && data[key.size() + 1] != INDEXED_FORMAT && data[key.size() + 1] != SOLID_FORMAT)
+               || ImageImplementation::read_big_endian<std::uint32_t>(data + INDEX_OFFSET) == 0;
+    }
+
+private:
+    /**
+     * Checks that a run of chunks, such as one read from a @c ChunkCache, holds a given subfile in the layout it would be encoded in.
+     * @param chunks An encoded run of PNG chunks with intact CRCs
+     * @param filename The UTF-8 encoded filename the run must record
+     * @param size The size of the contents the run must record
+     * @param checksum The CRC-32 of the contents the run must record
+     * @param indexed Whether the run must record an @c INDEXED_FORMAT index, as determined by @c records_index()
+     * @return @c true if the first chunk of @p chunks records @p filename, and with an index, @p size and @p checksum, @c false otherwise
+     * @details A run without an index records no size or checksum, so only the filename at the start of its first segment is decompressed.
+     */
+    static bool encodes(std::span<const unsigned char> chunks, std::u8string_view filename, std::uint64_t size, std::uint32_t checksum, bool indexed) {
+        if (chunks.size() < 12 || !is_valid(chunks.data()) || !is_sequence_start(chunks.data()))
+            return false;
+        try {
+            const auto header = read_header(chunks.data());
+            if (!indexed) {
+                if (header.info.has_value() || header.format == SOLID_FORMAT || header.method != Codec::ZLIB_METHOD)
+                    return false;
+                const auto summary = ImageImplementation::inspect_zlib(header.compressed, MAX_FILENAME_LENGTH, false);
+                return summary.prefix.has_value()
+                       && std::ranges::equal(summary.prefix.value(), filename, {}, {}, [] (char8_t c) { return static_cast<unsigned char>(c); });
+            }
+            return header.info.has_value() && header.info->name.u8string() == filename
+                   && header.info->size == size && header.info->checksum == checksum;
+        } catch (const std::runtime_error &) {
+            return false;
+        }
+    }
+
+    /**
+     * The size of the keyword and @c INDEXED_FORMAT header preceding the filename, in the first chunk of a run.
+     */
+    static constexpr std::size_t MAX_HEADER_SIZE = key.size() + 1 + 1 + 1 + 4 + 4 + 8 + 8 + 4 + 2;
+
+    /**
+     * A buffer large enough for the header of any chunk of a run, so that headers can be encoded without allocating.
+     */
+    using HeaderBuffer = std::array<unsigned char, MAX_HEADER_SIZE>;
+
+    /**
+     * The size of the keyword and header of one chunk of a run of @c fuSe chunks, excluding the filename.
+     * @param index The sequence index of the chunk
+     * @param count The number of chunks in the run
+     * @param indexed Whether the run records an @c INDEXED_FORMAT index
+     * @return The number of bytes written by @c FuseChunk::encode_header()
+     */
+    static constexpr std::size_t header_size(std::uint64_t index, std::uint64_t count, bool indexed) {
+        if (!indexed && count == 1)
+            return key.size() + 1 + 1;
+        return indexed && index == 0 ? MAX_HEADER_SIZE : MAX_HEADER_SIZE - (8 + 8 + 4 + 2);
+    }
+
+    /**
+     * Encodes the keyword and header of one chunk of a run of @c fuSe chunks.
+     * @param out The buffer into which to encode the header
+     * @param method The compression method byte of the codec used for the chunk's segment, which must be zlib's without an index
+     * @param index The sequence index of the chunk
+     * @param count The number of chunks in the run
+     * @param indexed Whether to encode an @c INDEXED_FORMAT header, rather than a @c LEGACY_FORMAT header for a run of one chunk
+     *     or a @c SEGMENTED_FORMAT header for a longer run
+     * @param filename_length The length of the UTF-8 encoded filename of the subfile, recorded in the first chunk
+     * @param size The size of the subfile's contents, recorded in the first chunk
+     * @param compressed_size The total size of the run's compressed segments, recorded in the first chunk
+     * @param checksum The CRC-32 of the subfile's contents, recorded in the first chunk
+     * @return The encoded part of @p out, which the filename follows in the first chunk, and the compressed segment in any chunk
+     */
+    static std::span<const unsigned char> encode_header(HeaderBuffer &out, unsigned char method, std::uint64_t index, std::uint64_t count, bool indexed,
+                                                        std::size_t filename_length, std::uint64_t size, std::uint64_t compressed_size, std::uint32_t checksum) {
+        using ImageImplementation::write_big_endian;
+        auto *end = std::ranges::copy(key, out.data()).out;
+        *end++ = '\0';
+        if (!indexed && count == 1) {
+            // As in a zTXt chunk, the format version occupies the compression method byte, which is 0 for zlib
+            *end++ = LEGACY_FORMAT;
+            return {out.data(), end};
+        }
+        *end++ = indexed ? INDEXED_FORMAT : SEGMENTED_FORMAT;
+        *end++ = method;
+        end = write_big_endian(end, static_cast<std::uint32_t>(index));
+        end = write_big_endian(end, static_cast<std::uint32_t>(count));
+        if (indexed && index == 0) {
+            end = write_big_endian(end, size);
+            end = write_big_endian(end, compressed_size);
+            end = write_big_endian(end, checksum);
+            end = write_big_endian(end, static_cast<std::uint16_t>(filename_length));
+        }
+        return {out.data(), end};
+    }
+
+    /**
+     * The size of the keyword and @c SOLID_FORMAT header of one chunk of a solid run, excluding the table of subfiles.
+     * @param index The sequence index of the chunk
+     * @return The number of bytes written by @c FuseChunk::encode_solid_header()
+     */
+    static constexpr std::size_t solid_header_size(std::uint64_t index) {
+        return header_size(1, 2, false) + (index == 0 ? 4 + 4 : 0);
+    }
+
+    /**
+     * Encodes the keyword and @c SOLID_FORMAT header of one chunk of a solid run of @c fuSe chunks.
+     * @param out The buffer into which to encode the header
+     * @param method The compression method byte of the codec used for the chunk's segment
+     * @param index The sequence index of the chunk
+     * @param count The number of chunks in the run
+     * @param entry_count The number of subfiles packed into the run, recorded in the first chunk
+     * @return The encoded part of @p out, which the table of subfiles follows in the first chunk, and the compressed segment in any chunk
+     */
+    static std::span<const unsigned char> encode_solid_header(HeaderBuffer &out, unsigned char method, std::uint64_t index, std::uint64_t count,
+                                                              std::uint32_t entry_count) {
+        using ImageImplementation::write_big_endian;
+        auto *end = std::ranges::copy(key, out.data()).out;
+        *end++ = '\0';
+        *end++ = SOLID_FORMAT;
+        *end++ = method;
+        end = write_big_endian(end, static_cast<std::uint32_t>(index));
+        end = write_big_endian(end, static_cast<std::uint32_t>(count));
+        if (index == 0) {
+            end = write_big_endian(end, static_cast<std::uint32_t>(SOLID_SEGMENT_SIZE));
+            end = write_big_endian(end, entry_count);
+        }
+        return {out.data(), end};
+    }
+};
+
+
+/**
+ * A handle to one subfile encoded in a run of @c fuSe chunks, which reads no more than the chunks' headers until it is asked for more.
+ * @details
+ *     Handles are produced by iterating a @c SubFileRange. A handle views the image data the range was found in,
+ *     so it is invalidated by any modification of that image, though not by the range itself going out of scope.\n
+ *     A handle to one of the subfiles packed into a @c FuseChunk::SOLID_FORMAT run shares the run's table with the handles to the others,
+ *     and decompresses only the segments of the run that hold its subfile.
+ */
+class SubFileHandle {
+public:
+    /**
+     * The most recently decompressed segment of a solid run, which handles to subfiles packed into the same run can share
+     * so that a segment holding several of them is only decompressed once.
+     */
+    struct SegmentCache {
+        /**
+         * The chunk holding the segment, or @c nullptr if no segment has been decompressed yet.
+         */
+        const unsigned char *chunk = nullptr;
+        /**
+         * The decompressed segment.
+         */
+        ImageImplementation::ByteBuffer value;
+    };
+
+    SubFileHandle() = default;
+
+    /**
+     * Creates a handle to the subfile held in a run of chunks.
+     * @param storage The shared list of chunk pointers that @p run views, which the handle keeps alive
+     * @param run Pointers to the chunks holding the subfile, in sequence order
+     */
+    SubFileHandle(std::shared_ptr<const std::vector<const unsigned char *>> storage, std::span<const unsigned char *const> run)
+            : storage(std::move(storage)), run(run) {}
+
+    /**
+     * Creates a handle to one of the subfiles packed into a @c FuseChunk::SOLID_FORMAT run of chunks.
+     * @param storage The shared list of chunk pointers that @p run views, which the handle keeps alive
+     * @param run Pointers to the chunks of the solid run, in sequence order
+     * @param table The table read from the first chunk of @p run, shared with the handles to the run's other subfiles
+     * @param entry The index of the subfile within @p table
+     */
+    SubFileHandle(std::shared_ptr<const std::vector<const unsigned char *>> storage, std::span<const unsigned char *const> run,
+                  std::shared_ptr<const FuseChunk::SolidTable> table, std::size_t entry)
+            : storage(std::move(storage)), run(run), table(std::move(table)), entry(entry) {}
+
+    /**
+     * The chunks holding the subfile.
+     * @return Pointers to the beginning of each chunk's header in the image data, in sequence order
+     */
+    [[nodiscard]] std::span<const unsigned char *const> chunks() const { return run; }
+
+    /**
+     * Determines if the subfile is packed into a @c FuseChunk::SOLID_FORMAT run together with others.
+     * @return @c true if the subfile shares the chunks of this handle with other subfiles, @c false otherwise
+     */
+    [[nodiscard]] bool is_solid() const { return table != nullptr; }
+
+    /**
+     * Reads the filename recorded for the subfile.
+     * @return The UTF-8 encoded filename of the subfile
+     * @throw @c std::runtime_error if the filename could not be read
+     * @details
+     *     The filename is read straight from the index of subfiles fused in @c FuseChunk::INDEXED_FORMAT.
+     *     For older subfiles, only as much of the first segment is decompressed as is needed to reach the end of the filename.
+     */
+    [[nodiscard]] std::u8string name() const {
+        if (is_solid())
+            return table->entries[entry].info.name.u8string();
+        auto header = FuseChunk::read_header(run.front());
+        if (header.info.has_value())
+            return header.info->name.u8string();
+        // Chunks without an index were only ever written with zlib, which can be decoded without being held in memory
+        if (header.method != Codec::ZLIB_METHOD)
+            throw std::runtime_error("Encountered fuSe chunk compressed with an unsupported codec");
+        const auto summary = ImageImplementation::inspect_zlib(header.compressed, FuseChunk::MAX_FILENAME_LENGTH, false);
+        if (!summary.prefix.has_value())
+            throw std::runtime_error("Encountered corrupt fuSe chunk");
+        return {summary.prefix->begin(), summary.prefix->end()};
+    }
+
+    /**
+     * Reads summary information about the subfile, without decompressing it into memory.
+     * @return The name, size, compressed size, and any recorded checksum of the subfile
+     * @throw @c std::runtime_error if the information could not be read
+     * @details
+     *     Subfiles fused in @c FuseChunk::INDEXED_FORMAT are described straight from their first chunk's header,
+     *     and subfiles packed into a @c FuseChunk::SOLID_FORMAT run from the run's table, with a compressed size of 0.
+     *     For older subfiles, the compressed data is walked to count its size and only the filename is decompressed.
+     */
+    [[nodiscard]] SubFileInfo info() const {
+        if (is_solid())
+            return table->entries[entry].info;
+        auto header = FuseChunk::read_header(run.front());
+        if (header.info.has_value())
+            return std::move(header.info.value());
+        SubFileInfo info{{}, 0, 0, std::nullopt};
+        for (std::size_t i = 0; i < run.size(); ++i) {
+            const auto segment = i == 0 ? header : FuseChunk::read_header(run[i]);
+            // Chunks without an index were only ever written with zlib, which can be measured without being held in memory
+            if (segment.method != Codec::ZLIB_METHOD)
+                throw std::runtime_error("Encountered fuSe chunk compressed with an unsupported codec");
+            if (i == 0) {
+                const auto summary = ImageImplementation::inspect_zlib(segment.compressed, FuseChunk::MAX_FILENAME_LENGTH);
+                if (!summary.prefix.has_value())
+                    throw std::runtime_error("Encountered corrupt fuSe chunk");
+                const auto &filename = summary.prefix.value();
+                info.name = std::u8string{filename.begin(), filename.end()};
+                info.size = summary.uncompressed_size - filename.size() - 1;
+            } else
+                info.size += ImageImplementation::inspect_zlib(segment.compressed, 0).uncompressed_size;
+            info.compressed_size += segment.compressed.size();
+        }
+        return info;
+    }
+
+    /**
+     * Estimates the size of the subfile without decompressing any of it, such as to bound how many subfiles are decompressed at once.
+     * @return The size recorded for the subfile, or for subfiles that record none, an upper bound on the size of each chunk written by this version
+     * @details
+     *     Unlike @c info(), this never walks the compressed data. A subfile whose header cannot be read counts as empty, to fail once decoded.\n
+     *     A chunk without a recorded size is counted as the most its compressed data could hold, up to @c FuseChunk::SEGMENT_SIZE bytes,
+     *     so that the estimate is never much smaller than the decompressed subfile. Chunks written by older versions may still hold more.
+     */
+    [[nodiscard]] std::uint64_t size_hint() const {
+        // DEFLATE encodes at most 258 bytes in a match of 2 bits
+        constexpr std::uint64_t MAX_DEFLATE_RATIO = 1032;
+        if (is_solid())
+            return table->entries[entry].info.size;
+        try {
+            if (const auto header = FuseChunk::read_header(run.front()); header.info.has_value())
+                return header.info->size;
+        } catch (const std::runtime_error &) {
+            return 0;
+        }
+        std::uint64_t size = 0;
+        for (const auto chunk : run)
+            size += std::min<std::uint64_t>(std::uint64_t{lodepng_chunk_length(chunk)} * MAX_DEFLATE_RATIO, FuseChunk::SEGMENT_SIZE);
+        return size;
+    }
+
+    /**
+     * Decompresses the subfile into memory.
+     * @param cache The segment to reuse if it holds part of a solid subfile, which is replaced by the last segment decompressed, if any
+     * @return The @c SubFile held in the chunks of this handle
+     * @details
+     *     A subfile held in a single chunk takes ownership of its decompressed buffer without copying it.
+     *     Otherwise, each segment is decompressed one at a time and appended to the joined contents,
+     *     so that no more than one segment is held in memory besides the subfile itself.
+     */
+    [[nodiscard]] SubFile decode(SegmentCache *cache=nullptr) const {
+        if (is_solid()) {
+            const auto &info = table->entries[entry].info;
+            std::vector<unsigned char> contents;
+            // Trust the recorded size only as far as the run's segments could possibly hold
+            contents.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(info.size, static_cast<std::uint64_t>(table->segment_size) * run.size())));
+            decode_to([&contents] (std::span<const unsigned char> slice) { contents.insert(contents.end(), slice.begin(), slice.end()); }, cache);
+            return {info.name, std::move(contents)};
+        }
+        auto sub_file = FuseChunk(run.front()).to_subfile();
+        if (run.size() == 1)
+            return sub_file;
+        const auto info = FuseChunk::read_header(run.front()).info;
+        std::vector<unsigned char> contents;
+        // Trust the recorded size only as far as the run's segments could possibly hold
+        contents.reserve(info.has_value()
+                         ? static_cast<std::size_t>(std::min<std::uint64_t>(info->size, run.size() * FuseChunk::SEGMENT_SIZE))
+                         : sub_file.contents.size());
+        contents.insert(contents.end(), sub_file.contents.begin(), sub_file.contents.end());
+        sub_file.contents = {};
+        decode_segments([&contents] (std::span<const unsigned char> segment) { contents.insert(contents.end(), segment.begin(), segment.end()); },
+                        1);
+        sub_file.contents = std::move(contents);
+        return sub_file;
+    }
+
+    /**
+     * Decompresses the contents of the subfile one segment at a time, passing each to @p sink in order.
+     * @tparam Sink A callable taking a <tt>std::span<const unsigned char></tt>
+     * @param sink The callable to which each decompressed segment of the contents is passed, excluding the filename
+     * @param cache The segment to reuse if it holds part of a solid subfile, which is replaced by the last segment decompressed, if any
+     * @throw @c std::runtime_error if a solid run's segments do not hold all of the subfile's recorded contents
+     * @details
+     *     No more than one segment, of at most @c FuseChunk::SEGMENT_SIZE bytes, is held in memory at once,
+     *     and the view passed to @p sink is only valid until it returns.
+     *     For a solid subfile, only the part of each segment holding the subfile is passed to @p sink.
+     */
+    template <std::invocable<std::span<const unsigned char>> Sink>
+    void decode_to(Sink &&sink, SegmentCache *cache=nullptr) const {
+        if (!is_solid()) {
+            decode_segments(sink, 0);
+            return;
+        }
+        const auto &[info, offset] = table->entries[entry];
+        if (info.size == 0)
+            return;
+        SegmentCache local;
+        if (!cache)
+            cache = &local;
+        const auto segment_size = table->segment_size;
+        const auto end = offset + info.size;
+        for (auto i = offset / segment_size; i <= (end - 1) / segment_size; ++i) {
+            if (i >= run.size())
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            if (cache->chunk != run[i]) {
+                cache->value = FuseChunk(run[i]).value;
+                cache->chunk = run[i];
+            }
+            const auto begin = i * segment_size;
+            const auto first = std::max(offset, begin) - begin, last = std::min<std::uint64_t>(end - begin, segment_size);
+            if (cache->value.size() < last || (cache->value.size() != segment_size && i + 1 < run.size()))
+                throw std::runtime_error("Encountered corrupt fuSe chunk");
+            sink(std::span<const unsigned char>(cache->value.data() + first, static_cast<std::size_t>(last - first)));
+        }
+    }
+
+    /**
+     * Decompresses the contents of the subfile into a buffer supplied by the caller, one segment at a time.
+     * @param buffer The buffer into which to decompress the contents, at least as large as the subfile's size in @c info()
+     * @return The number of bytes written to the beginning of @p buffer
+     * @throw @c std::runtime_error if the contents do not fit in @p buffer
+     */
+    std::size_t decode_into(std::span<unsigned char> buffer) const {
+        std::size_t written = 0;
+        decode_to([&buffer, &written] (std::span<const unsigned char> segment) {
+            if (segment.size() > buffer.size() - written)
+                throw std::runtime_error("Buffer is too small to hold the decompressed subfile.");
+            std::ranges::copy(segment, buffer.subspan(written).begin());
+            written += segment.size();
+        });
+        return written;
+    }
+
+private:
+    std::shared_ptr<const std::vector<const unsigned char *>> storage;
+    std::span<const unsigned char *const> run;
+    std::shared_ptr<const FuseChunk::SolidTable> table;
+    std::size_t entry = 0;
+
+    /**
+     * Decompresses the segments of a subfile that is not solid, passing each to @p sink in order, as in @c decode_to().
+     * @param sink The callable to which each decompressed segment of the contents is passed, excluding the filename
+     * @param first The sequence index of the first segment to decompress
+     */
+    template <std::invocable<std::span<const unsigned char>> Sink>
+    void decode_segments(Sink &&sink, std::size_t first) const {
+        for (const auto chunk : run.subspan(first)) {
+            const FuseChunk segment(chunk);
+            sink(std::span<const unsigned char>(segment.value.data(), segment.value.size()));
+        }
+    }
+};
+
+
+/**
+ * A lazy @c std::ranges view of the subfiles encoded in the @c fuSe chunks of an image, whose elements are @c SubFileHandles.
+ * @details
+ *     The view is created from the chunk index, and each run of chunks is grouped only as iteration reaches it, reading just their headers.
+ *     Nothing is decompressed unless a handle is asked for its subfile's name or contents.\n
+ *     Copies of a view share its list of chunks, so copying is cheap. As with its handles, a view is invalidated by any modification of its image.
+ */
+class SubFileRange : public std::ranges::view_interface<SubFileRange> {
+public:
+    /**
+     * A forward iterator over the subfiles in a @c SubFileRange, visiting each subfile packed into a solid run in turn.
+     * @throw @c std::runtime_error when advanced onto an incomplete run of segmented chunks
+     */
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = SubFileHandle;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const SubFileHandle *;
+        using reference = const SubFileHandle &;
+
+        iterator() = default;
+
+        reference operator*() const { return current; }
+        pointer operator->() const { return &current; }
+
+        iterator &operator++() {
+            if (table && ++entry < table->entries.size()) {
+                current = SubFileHandle(storage, current.chunks(), table, entry);
+                return *this;
+            }
+            rest = rest.subspan(current.chunks().size());
+            read_run();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            auto previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const iterator &other) const { return rest.data() == other.rest.data() && entry == other.entry; }
+
+    private:
+        friend class SubFileRange;
+
+        std::shared_ptr<const std::vector<const unsigned char *>> storage;
+        std::span<const unsigned char *const> rest;
+        SubFileHandle current;
+        std::shared_ptr<const FuseChunk::SolidTable> table;
+        std::size_t entry = 0;
+
+        iterator(std::shared_ptr<const std::vector<const unsigned char *>> storage, std::span<const unsigned char *const> rest)
+                : storage(std::move(storage)), rest(rest) {
+            read_run();
+        }
+
+        /**
+         * Groups the run of chunks at the beginning of @c rest into @c current, checking that the run is complete.
+         * @details The table of a solid run is read here once, and a solid run holding no subfiles is skipped.
+         */
+        void read_run() {
+            table = nullptr;
+            entry = 0;
+            for (;;) {
+                if (rest.empty()) {
+                    current = {};
+                    return;
+                }
+                const auto header = FuseChunk::read_header(rest.front());
+                const auto count = header.sequence_count;
+                if (header.sequence_index != 0 || count > rest.size())
+                    throw std::runtime_error("Encountered incomplete sequence of fuSe chunks");
+                for (std::uint32_t i = 1; i < count; ++i) {
+                    const auto header = FuseChunk::read_header(rest[i]);
+                    if (header.sequence_index != i || header.sequence_count != count)
+                        throw std::runtime_error("Encountered incomplete sequence of fuSe chunks");
+                }
+                if (header.format != FuseChunk::SOLID_FORMAT) {
+                    current = SubFileHandle(storage, rest.first(count));
+                    return;
+                }
+                if (header.entry_count != 0) {
+                    table = std::make_shared<const FuseChunk::SolidTable>(FuseChunk::read_table(header));
+                    current = SubFileHandle(storage, rest.first(count), table, 0);
+                    return;
+                }
+                rest = rest.subspan(count);
+            }
+        }
+    };
+
+    SubFileRange() = default;
+
+    /**
+     * Creates a view of the subfiles held in a list of chunks.
+     * @param chunks Pointers to the beginning of each valid @c fuSe chunk's header in the image data, in order
+     */
+    explicit SubFileRange(std::vector<const unsigned char *> chunks)
+            : storage(std::make_shared<const std::vector<const unsigned char *>>(std::move(chunks))) {}
+
+    [[nodiscard]] iterator begin() const { return {storage, *storage}; }
+    [[nodiscard]] iterator end()   const { return {storage, std::span(*storage).subspan(storage->size())}; }
+
+private:
+    std::shared_ptr<const std::vector<const unsigned char *>> storage = std::make_shared<const std::vector<const unsigned char *>>();
 };
 
 
@@ -128,46 +1190,1002 @@ struct FuseChunk final : public TextChunk<std::vector<unsigned char>> {
  *     and decompressing and deserializing @c fuSe chunks within an image into an enumeration of @c SubFile objects.
  */
 struct SubFileImage : public Image<FuseChunk> {
+    /**
+     * The default number of bytes of decompressed subfiles that extracting holds in memory at once, set by @c configure_in_flight().
+     */
+    static constexpr std::size_t DEFAULT_IN_FLIGHT = std::size_t{1} << 28;
+
+    /**
+     * Sets the number of bytes of decompressed subfiles that extracting may hold in memory at once, as in @c decode_in_order().
+     * @param bytes The limit, under which the subfile to be written next is still decompressed if it is larger on its own
+     */
+    static void configure_in_flight(std::size_t bytes) {
+        in_flight_limit = std::max<std::size_t>(bytes, 1);
+    }
+
     /**
      * Loads PNG image data from a file.
      * @param file The file from which to load the image data
      */
     explicit SubFileImage(const path &file) : Image(file) {}
 
+    /**
+     * Loads PNG image data viewed in place in memory owned by the caller.
+     * @param data The raw PNG image data, which must outlive the image and remain unchanged until the image is first modified
+     */
+    explicit SubFileImage(std::span<const unsigned char> data) : Image(data) {}
+
+    /**
+     * Loads PNG image data held in memory, taking ownership of it.
+     * @param data The raw PNG image data
+     */
+    explicit SubFileImage(std::vector<unsigned char> &&data) : Image(std::move(data)) {}
+
     /**
      * Loads the contents of @p file from the filesystem, serializes it into a @c fuSe chunk, and inserts it into the image data..
      * @param file A path to a file to load to create the @c fuSe chunk
+     * @param compression The settings with which to compress the file
      * @details This adds the new chunk immediately following the end of the last @c IDAT chunk.
      */
-    void add_sub_file(const path &file) {
-        add_chunk(FuseChunk(SubFile::from_file(file)));
+    void add_sub_file(const path &file, const Compression &compression={}) {
+        add_chunk(FuseChunk(SubFile::from_file(file), compression));
     }
 
     /**
      * Loads the contents of several files from the filesystem, serializing them into @c fuSe chunks in parallel, and inserting them into the image data.
      * @param files A vector of @c path objects to load to create the @c fuSe chunks
-     * @details This adds new chunks immediately following the end of the last @c IDAT chunk.
+     * @param compression The settings with which to compress the files
+     * @details
+     *     This adds new chunks immediately following the end of the last @c IDAT chunk, in the order of @p files.\n
+     *     Files are read ahead on the I/O pool while earlier files are compressed and encoded on the shared @c ThreadPool, as in @c encode_files(),
+     *     and a file's contents are released as soon as its chunk is encoded.
      */
-    void add_sub_file(const std::vector<path> &files) {
-        std::vector<FuseChunk> chunks;
-        chunks.reserve(files.size());
-        for (const auto &file : files)
-            chunks.emplace_back(FuseChunk(SubFile::from_file(file)));
-        add_chunk(chunks);
+    void add_sub_file(const std::vector<path> &files, const Compression &compression={}) {
+        std::vector<ImageImplementation::ManagedByteSpan> encoded;
+        encoded.reserve(files.size());
+        encode_files(files, compression, [&encoded] (ImageImplementation::ManagedByteSpan &&chunks) { encoded.push_back(std::move(chunks)); });
+        add_encoded_chunks(std::move(encoded));
+    }
+
+    /**
+     * Serializes several subfiles already held in memory into @c fuSe chunks in parallel, and inserts them into the image data.
+     * @param sub_files The subfiles to fuse, in order, each of whose contents is released as soon as its chunk is encoded
+     * @param compression The settings with which to compress the subfiles
+     * @details As with @c add_sub_file(), this adds new chunks immediately following the end of the last @c IDAT chunk.
+     */
+    void add_sub_files(std::vector<SubFile> &&sub_files, const Compression &compression={}) {
+        auto &pool = ThreadPool::shared();
+        std::vector<std::future<ImageImplementation::ManagedByteSpan>> futures;
+        futures.reserve(sub_files.size());
+        for (auto &sub_file : sub_files)
+            futures.emplace_back(pool.submit([&sub_file, &compression] { return FuseChunk(std::move(sub_file), compression).encode(); }));
+        add_encoded_chunks(pool.wait_all(futures));
+    }
+
+    /**
+     * Packs several subfiles already held in memory together into one solid run of @c fuSe chunks, and inserts it into the image data.
+     * @param sub_files The subfiles to pack into the run, in order
+     * @param compression The settings with which to compress the run
+     * @see @c FuseChunk::encode_solid()
+     */
+    void add_solid_sub_files(std::span<const SubFile> sub_files, const Compression &compression={}) {
+        std::vector<ImageImplementation::ManagedByteSpan> encoded;
+        encoded.push_back(FuseChunk::encode_solid(sub_files, compression));
+        add_encoded_chunks(std::move(encoded));
+    }
+
+    /**
+     * Loads the contents of several files from the filesystem, packing them together into one solid run of @c fuSe chunks inserted into the image data.
+     * @param files A vector of @c path objects to load and pack into the run, in order
+     * @param compression The settings with which to compress the run
+     * @details
+     *     This adds the new run immediately following the end of the last @c IDAT chunk, as with @c add_sub_file().
+     *     Files are read in parallel on the shared @c ThreadPool, and all of them are held in memory until the run is encoded.
+     * @see @c FuseChunk::encode_solid()
+     */
+    void add_solid_sub_files(const std::vector<path> &files, const Compression &compression={}) {
+        std::vector<ImageImplementation::ManagedByteSpan> encoded;
+        encoded.push_back(encode_solid_files(files, compression));
+        add_encoded_chunks(std::move(encoded));
+    }
+
+    /**
+     * Deletes all @c fuSe chunks found in the image data.
+     * @return The number of deleted subfiles, counting each run of segmented chunks once
+     */
+    std::size_t clear_sub_files() {
+        const auto sub_file_count = count_sub_files();
+        clear_chunks();
+        return sub_file_count;
+    }
+
+    /**
+     * Deletes all @c fuSe chunks directly from the file the image was loaded from, moving only the data that follows them.
+     * @return The number of deleted subfiles, counting each run of segmented chunks once
+     * @see @c Image<ChunkT>::clear_chunks_in_place()
+     */
+    std::size_t clear_sub_files_in_place() {
+        const auto sub_file_count = count_sub_files();
+        clear_chunks_in_place();
+        return sub_file_count;
+    }
+
+    /**
+     * Fuses several files into a copy of a PNG file, streaming all data through fixed-size buffers rather than loading any file whole.
+     * @param host A path to the PNG file into which to fuse the files
+     * @param files A vector of @c path objects to be fused into the copy of @p host
+     * @param out A path at which to write the result, which may be the same file as @p host
+     * @param compression The settings with which to compress the files
+     * @details
+     *     The new @c fuSe chunks are written immediately following the end of the last @c IDAT chunk, as with @c add_sub_file().
+     *     Peak memory is bounded by @c FuseChunk::SEGMENT_SIZE instead of by the size of the inputs.
+     *     If @p out refers to @p host, the result is written to a temporary file that then replaces @p host.
+     */
+    static void fuse_stream(const path &host, const std::vector<path> &files, const path &out, const Compression &compression={}) {
+        const bool in_place = std::filesystem::exists(out) && std::filesystem::equivalent(host, out);
+        path destination = out;
+        if (in_place)
+            destination += ".tmp";
+        try {
+            auto input = open_input(host);
+            const auto idat_end = ImageImplementation::find_idat_end(input, host);
+            input.clear();
+            input.seekg(0);
+            auto output = open_output(destination);
+            copy_stream(input, output, idat_end);
+            for (const auto &file : files) {
+                auto sub_file = open_input(file);
+                FuseChunk::encode_stream(file.filename().u8string(), sub_file, remaining_size(sub_file), output, compression);
+            }
+            copy_stream(input, output, remaining_size(input));
+            output.close();
+            if (!output)
+                throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + destination.native() + NATIVE_WIDTH('.'));
+        } catch (...) {
+            std::filesystem::remove(destination);
+            throw;
+        }
+        if (in_place)
+            std::filesystem::rename(destination, out);
+    }
+
+    /**
+     * Fuses several files into a PNG file in place, appending their @c fuSe chunks without rewriting the rest of the file.
+     * @param host A path to the PNG file into which to fuse the files
+     * @param files A vector of @c path objects to be fused into @p host
+     * @param compression The settings with which to compress the files
+     * @param stream Whether to stream each file through fixed-size buffers, as with @c fuse_stream(), instead of loading it whole
+     * @param solid Whether to pack the files together into one solid run, as with @c add_solid_sub_files(), which takes precedence over @p stream
+     * @details
+     *     The new @c fuSe chunks are written where the @c IEND chunk of @p host was, after any existing subfiles,
+     *     so the cost depends only on the size of the new files, however many subfiles @p host already holds.\n
+     *     Unless streaming, files are read and compressed in parallel, as in @c encode_files(),
+     *     and each is written and released in order as soon as it and the files before it are encoded.
+     */
+    static void append_sub_files(const path &host, const std::vector<path> &files, const Compression &compression={}, bool stream=false,
+                                 bool solid=false) {
+        if (solid) {
+            const auto chunks = encode_solid_files(files, compression);
+            ImageImplementation::insert_before_iend(host, [&host, &chunks] (std::ostream &out) {
+                if (!out.write(reinterpret_cast<const char *>(chunks.data().data()), static_cast<std::streamsize>(chunks.size())))
+                    throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + host.native() + NATIVE_WIDTH('.'));
+            });
+            return;
+        }
+        if (stream) {
+            ImageImplementation::insert_before_iend(host, [&files, &compression] (std::ostream &out) {
+                for (const auto &file : files) {
+                    auto sub_file = open_input(file);
+                    FuseChunk::encode_stream(file.filename().u8string(), sub_file, remaining_size(sub_file), out, compression);
+                }
+            });
+            return;
+        }
+
+        ImageImplementation::insert_before_iend(host, [&] (std::ostream &out) {
+            encode_files(files, compression, [&host, &out] (ImageImplementation::ManagedByteSpan &&chunks) {
+                if (!out.write(reinterpret_cast<const char *>(chunks.data().data()), static_cast<std::streamsize>(chunks.size())))
+                    throw native_runtime_error(NATIVE_WIDTH("Failed to write to file ") + host.native() + NATIVE_WIDTH('.'));
+            });
+        });
+    }
+
+    /**
+     * Fuses several files into a PNG image read from one stream, writing the result to another as the image is read, such as in a pipeline.
+     * @param host The stream from which to read the PNG image, which need not be seekable
+     * @param files A vector of @c path objects to be fused into the image
+     * @param out The stream to which to write the result, which must be seekable if @p stream is set
+     * @param compression The settings with which to compress the files
+     * @param stream Whether to stream each file through fixed-size buffers, as with @c fuse_stream(), instead of loading it whole
+     * @param solid Whether to pack the files together into one solid run, as with @c add_solid_sub_files(), which takes precedence over @p stream
+     * @throw @c std::runtime_error if @p host is not a valid PNG image with image data, or if @p out could not be written to
+     * @details
+     *     The image is read one chunk at a time through an @c ImageImplementation::ChunkReader, and each chunk is written out as soon as it is read,
+     *     so only one chunk of it is held in memory at a time. The new @c fuSe chunks are written immediately following the end of the last
+     *     @c IDAT chunk, as with @c add_sub_file(), and unless streaming or solid, the files are read and compressed in parallel as in @c encode_files().
+     */
+    static void fuse_pipe(std::istream &host, const std::vector<path> &files, std::ostream &out, const Compression &compression={},
+                          bool stream=false, bool solid=false) {
+        ImageImplementation::ChunkReader reader(host);
+        write_data(out, ImageImplementation::PNG_SIGNATURE);
+        bool idat_found = false, fused = false;
+        while (const auto chunk = reader.next()) {
+            const bool is_idat = lodepng_chunk_type_equals(chunk->data(), "IDAT");
+            if (idat_found && !is_idat && !fused) {
+                if (solid)
+                    write_data(out, encode_solid_files(files, compression).data());
+                else if (stream)
+                    for (const auto &file : files) {
+                        auto sub_file = open_input(file);
+                        FuseChunk::encode_stream(file.filename().u8string(), sub_file, remaining_size(sub_file), out, compression);
+                    }
+                else
+                    encode_files(files, compression, [&out] (ImageImplementation::ManagedByteSpan &&chunks) { write_data(out, chunks.data()); });
+                fused = true;
+            }
+            idat_found |= is_idat;
+            write_data(out, *chunk);
+        }
+        if (!fused)
+            throw std::runtime_error("Image data is not a valid PNG file.");
+    }
+
+    /**
+     * Removes every @c fuSe chunk from a PNG image read from one stream, writing the rest of the image to another as it is read.
+     * @param in The stream from which to read the PNG image, which need not be seekable
+     * @param out The stream to which to write the image without its @c fuSe chunks
+     * @return The number of removed subfiles, counting each run of segmented chunks once
+     * @throw @c std::runtime_error if @p in is not a valid PNG image, or if @p out could not be written to
+     * @details As with @c fuse_pipe(), only one chunk of the image is held in memory at a time.
+     */
+    static std::size_t clean_pipe(std::istream &in, std::ostream &out) {
+        ImageImplementation::ChunkReader reader(in);
+        write_data(out, ImageImplementation::PNG_SIGNATURE);
+        std::size_t removed = 0;
+        while (const auto chunk = reader.next()) {
+            if (FuseChunk::is_valid(chunk->data()))
+                removed += FuseChunk::sub_file_count(chunk->data());
+            else
+                write_data(out, *chunk);
+        }
+        return removed;
+    }
+
+    /**
+     * Decodes the subfiles of a PNG image read from one stream and encodes them again in another format, writing the result to another stream.
+     * @param in The stream from which to read the PNG image, which need not be seekable
+     * @param out The stream to which to write the repacked image
+     * @param compression The settings with which to compress the repacked subfiles
+     * @param solid Whether to pack the subfiles together into solid runs, as with @c add_solid_sub_files(), instead of encoding each on its own
+     * @return The number of subfiles repacked, and of those skipped
+     * @throw @c std::runtime_error if @p in is not a valid PNG image, a subfile could not be decompressed, or @p out could not be written to
+     * @details
+     *     The image is read chunk by chunk as in @c fuse_pipe(), and every run of @c fuSe chunks is decoded and encoded again in memory
+     *     by a task on the shared @c ThreadPool, while later runs are read. The results are written in order, in place of the runs they replace,
+     *     with up to two runs per job, and at most the bytes set by @c configure_in_flight(), being repacked at once.\n
+     *     A run already in the target format, as determined by @c in_target_format(), is passed through unchanged.
+     *     When @p solid is set, neighbouring runs not in the target format are packed together into one solid run,
+     *     up to the next chunk of another type or run already in the target format, so the order of the subfiles is kept.
+     */
+    static RepackResult repack_pipe(std::istream &in, std::ostream &out, const Compression &compression={}, bool solid=false) {
+        using ImageImplementation::ManagedByteSpan;
+        // Output waiting to be written in order: either chunks passed through as they were, or the runs being encoded to replace others
+        struct Pending {
+            std::vector<unsigned char> bytes;
+            std::future<std::vector<ManagedByteSpan>> encoded;
+            std::uint64_t size = 0;
+        };
+        auto &pool = ThreadPool::shared();
+        const auto lookahead = 2 * pool.jobs();
+        RepackResult result;
+        std::deque<Pending> pending;
+        std::size_t encoding = 0;
+        std::uint64_t in_flight = 0;
+        // Writes out the pending output that is ready, waiting on runs being encoded only while too many are in flight
+        const auto drain = [&] (std::size_t max_encoding) {
+            while (!pending.empty() && (!pending.front().encoded.valid() || encoding > max_encoding || in_flight > in_flight_limit)) {
+                auto &front = pending.front();
+                if (front.encoded.valid()) {
+                    for (const auto &chunks : pool.wait(front.encoded))
+                        write_data(out, chunks.data());
+                    --encoding;
+                    in_flight -= front.size;
+                } else
+                    write_data(out, front.bytes);
+                pending.pop_front();
+            }
+        };
+        const auto pass = [&] (std::span<const unsigned char> bytes) {
+            pending.push_back({{bytes.begin(), bytes.end()}, {}, 0});
+            drain(lookahead);
+        };
+        const auto submit = [&] (std::vector<std::vector<unsigned char>> &&chunks, std::vector<SubFileHandle> &&handles, bool pack) {
+            std::uint64_t size = 0;
+            for (const auto &handle : handles)
+                size += handle.size_hint();
+            result.repacked += handles.size();
+            // The task owns the chunks that the handles point into
+            pending.push_back({{}, pool.submit([chunks = std::move(chunks), handles = std::move(handles), &compression, pack] {
+                std::vector<ManagedByteSpan> encoded;
+                if (pack)
+                    encoded.push_back(FuseChunk::encode_solid(decode_handles(handles), compression));
+                else {
+                    SubFileHandle::SegmentCache cache;
+                    for (const auto &handle : handles)
+                        encoded.push_back(FuseChunk(handle.decode(&cache), compression).encode());
+                }
+                return encoded;
+            }), size});
+            ++encoding;
+            in_flight += size;
+            drain(lookahead);
+        };
+
+        // The chunks of the run being read, and when solid, those of the runs to be packed together next
+        std::vector<std::vector<unsigned char>> run, packed;
+        std::vector<SubFileHandle> packed_handles;
+        std::uint32_t run_length = 0;
+        const auto flush_packed = [&] {
+            if (!packed_handles.empty())
+                submit(std::move(packed), std::move(packed_handles), true);
+            packed.clear();
+            packed_handles.clear();
+        };
+        const auto finish_run = [&] {
+            std::vector<const unsigned char *> pointers;
+            pointers.reserve(run.size());
+            for (const auto &chunk : run)
+                pointers.push_back(chunk.data());
+            const SubFileRange range(pointers);
+            std::vector<SubFileHandle> handles(range.begin(), range.end());
+            if (in_target_format(pointers, compression, solid)) {
+                if (solid)
+                    flush_packed();
+                result.skipped += handles.size();
+                for (const auto &chunk : run)
+                    pass(chunk);
+            } else if (solid) {
+                std::ranges::move(run, std::back_inserter(packed));
+                std::ranges::move(handles, std::back_inserter(packed_handles));
+            } else
+                submit(std::move(run), std::move(handles), false);
+            run.clear();
+        };
+
+        try {
+            ImageImplementation::ChunkReader reader(in);
+            write_data(out, ImageImplementation::PNG_SIGNATURE);
+            while (const auto chunk = reader.next()) {
+                if (!FuseChunk::is_valid(chunk->data())) {
+                    if (solid)
+                        flush_packed();
+                    pass(*chunk);
+                    continue;
+                }
+                // An unfinished run is left for SubFileRange to report as incomplete
+                if (FuseChunk::is_sequence_start(chunk->data()) && !run.empty())
+                    finish_run();
+                if (run.empty())
+                    run_length = FuseChunk::read_header(chunk->data()).sequence_count;
+                run.emplace_back(chunk->begin(), chunk->end());
+                if (run.size() == run_length)
+                    finish_run();
+            }
+            if (!run.empty())
+                finish_run();
+            flush_packed();
+            drain(0);
+        } catch (...) {
+            // Let runs still being encoded finish before the settings they refer to go out of scope
+            for (auto &item : pending)
+                pool.settle(std::span(&item.encoded, 1));
+            throw;
+        }
+        return result;
+    }
+
+    /**
+     * Enumerates summary information about the subfiles encoded in @c fuSe chunks in the image, without decompressing them.
+     * @return A vector of @c SubFileInfo objects describing the subfiles in the image, in order
+     * @see @c SubFileHandle::info()
+     */
+    [[nodiscard]] std::vector<SubFileInfo> get_sub_file_info() const {
+        std::vector<SubFileInfo> infos;
+        for (const auto &handle : sub_files())
+            infos.push_back(handle.info());
+        return infos;
     }
 
     /**
      * Enumerates the @c SubFiles encoded in @c fuSe chunks in the image.
      * @return A vector of @c SubFile objects decoded from the @c fuSe chunks in the image
+     * @details
+     *     Subfiles are decompressed in parallel on the shared @c ThreadPool,
+     *     with neighbouring subfiles packed into the same solid run decompressed together by one task, as in @c batches().
      */
     [[nodiscard]] std::vector<SubFile> get_sub_files() const {
+        const auto range = sub_files();
+        return decode_handles(std::vector<SubFileHandle>(range.begin(), range.end()));
+    }
+
+    /**
+     * Enumerates only the @c SubFiles whose filenames match @p pattern, without decompressing any other subfile.
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match, as in @c matches_pattern()
+     * @return A vector of the matching @c SubFile objects, in order
+     * @details Matching subfiles are decompressed in parallel, as with @c get_sub_files().
+     */
+    [[nodiscard]] std::vector<SubFile> get_sub_files(std::u8string_view pattern) const {
+        return decode_handles(matching_handles(pattern));
+    }
+
+    /**
+     * Views the subfiles encoded in @c fuSe chunks in the image, without decompressing any of them.
+     * @return A lazy view of a @c SubFileHandle for each subfile in the image, in order, through which any of them may be decoded individually
+     * @details The view is invalidated by any modification of the image.
+     */
+    [[nodiscard]] SubFileRange sub_files() const {
+        std::vector<const unsigned char *> chunks;
+        for (const auto chunk : find_chunks(FuseChunk::type()))
+            if (FuseChunk::is_valid(chunk))
+                chunks.push_back(chunk);
+        return SubFileRange(std::move(chunks));
+    }
+
+    /**
+     * Determines if a subfile's filename matches a pattern, which is either an exact filename or a glob.
+     * @param name The UTF-8 encoded filename to match
+     * @param pattern The UTF-8 encoded pattern, in which @c * matches any run of characters and @c ? matches any single character
+     * @return @c true if @p pattern matches the whole of @p name, @c false otherwise
+     */
+    [[nodiscard]] static bool matches_pattern(std::u8string_view name, std::u8string_view pattern) {
+        // Advances past one UTF-8 encoded character, so that ? never matches part of one
+        const auto next_character = [name] (std::size_t i) {
+            do
+                ++i;
+            while (i < name.size() && (name[i] & 0xC0) == 0x80);
+            return i;
+        };
+        std::size_t n = 0, p = 0;
+        // The position in the pattern following the last *, and the position in the name it has matched up to
+        std::optional<std::pair<std::size_t, std::size_t>> star;
+        while (n < name.size()) {
+            if (p < pattern.size() && pattern[p] == u8'*')
+                star.emplace(++p, n);
+            else if (p < pattern.size() && pattern[p] == u8'?') {
+                ++p;
+                n = next_character(n);
+            } else if (p < pattern.size() && pattern[p] == name[n]) {
+                ++p;
+                ++n;
+            } else if (star.has_value()) {
+                // Let the last * match one more character, and retry the rest of the pattern from there
+                p = star->first;
+                n = star->second = next_character(star->second);
+            } else
+                return false;
+        }
+        while (p < pattern.size() && pattern[p] == u8'*')
+            ++p;
+        return p == pattern.size();
+    }
+
+    /**
+     * Decodes the @c SubFiles encoded in @c fuSe chunks in the image and saves each at the path stored in its @c name.
+     * @return The number of saved subfiles
+     * @details
+     *     Subfiles are decompressed in parallel on the shared @c ThreadPool, up to a few per job ahead of the one being saved,
+     *     so that decompression overlaps with disk writes while at most the bytes set by @c configure_in_flight() are held in memory
+     *     by subfiles being decompressed, and as many again by subfiles being written.\n
+     *     Subfiles are saved in the order they are stored, so a later subfile replaces an earlier one with the same name.
+     */
+    std::size_t save_sub_files() const {
+        const auto range = sub_files();
+        return save_handles(std::vector<SubFileHandle>(range.begin(), range.end()));
+    }
+
+    /**
+     * Decodes only the @c SubFiles whose filenames match @p pattern, and saves each at the path stored in its @c name.
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match to be saved, as in @c matches_pattern()
+     * @return The number of saved subfiles
+     * @details
+     *     Subfiles are matched by the filenames read through their @c SubFileHandle, so no other subfile is decompressed.
+     *     Matching subfiles are then saved as with @c save_sub_files().
+     */
+    std::size_t save_sub_files(std::u8string_view pattern) const {
+        return save_handles(matching_handles(pattern));
+    }
+
+    /**
+     * Decodes the @c SubFiles encoded in @c fuSe chunks in a PNG image read from a stream, handing each to @p sink as soon as its run has been read.
+     * @tparam Sink A callable taking each decoded subfile as an rvalue @c SubFile, called on the calling thread in the order they are stored
+     * @param in The stream from which to read the PNG image, which need not be seekable
+     * @param sink The callable to which to hand each decoded subfile
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match, as in @c matches_pattern(), or @c std::nullopt to decode all of them
+     * @return The number of subfiles handed to @p sink
+     * @throw @c std::runtime_error if @p in is not a valid PNG image or a subfile could not be decompressed
+     * @details
+     *     The image is read one chunk at a time through an @c ImageImplementation::ChunkReader, and only the chunks of the run being read are held,
+     *     so the image need never be loaded whole. The subfiles of a solid run are decompressed in parallel, as in @c decode_in_order().
+     */
+    template <class Sink>
+    static std::size_t extract_pipe(std::istream &in, Sink &&sink, std::optional<std::u8string_view> pattern=std::nullopt) {
+        ImageImplementation::ChunkReader reader(in);
+        // The chunks of the run being read, into which the handles decoded from them point
+        std::vector<std::vector<unsigned char>> run;
+        std::size_t extracted = 0;
+        const auto decode_run = [&] {
+            std::vector<const unsigned char *> chunks;
+            chunks.reserve(run.size());
+            for (const auto &chunk : run)
+                chunks.push_back(chunk.data());
+            std::vector<SubFileHandle> handles;
+            std::ranges::copy_if(SubFileRange(std::move(chunks)), std::back_inserter(handles), [pattern] (const SubFileHandle &handle) {
+                return !pattern.has_value() || matches_pattern(handle.name(), pattern.value());
+            });
+            decode_in_order(handles, [&sink, &extracted] (SubFile &&sub_file) {
+                sink(std::move(sub_file));
+                ++extracted;
+            });
+            run.clear();
+        };
+        while (const auto chunk = reader.next()) {
+            if (!FuseChunk::is_valid(chunk->data()))
+                continue;
+            if (FuseChunk::is_sequence_start(chunk->data()))
+                decode_run();
+            run.emplace_back(chunk->begin(), chunk->end());
+        }
+        decode_run();
+        return extracted;
+    }
+
+    /**
+     * Checks the integrity of every subfile encoded in @c fuSe chunks in the image, without holding any decompressed subfile in memory.
+     * @return A @c SubFileCheck for each subfile in the image, in order
+     * @details
+     *     Every segment is decompressed through a fixed-size window by its own task on the shared @c ThreadPool,
+     *     and its CRC-32 is combined with those of the other segments of its subfile.
+     *     Each zlib segment's Adler-32 trailer is checked against its contents,
+     *     and the size and CRC-32 recorded for subfiles fused in @c FuseChunk::INDEXED_FORMAT are checked against the decompressed data.
+     *     Subfiles fused without an index record no checksum, so only their compressed streams can be checked,
+     *     and their filenames and sizes are read by the same walk of their streams.
+     *     A subfile that cannot be read is reported as corrupt, with its filename left empty if it cannot be read either.\n
+     *     Subfiles packed into a solid run are instead checked in batches, as in @c batches(), each decompressing its segments once,
+     *     and a segment that fails to decompress marks every subfile of its batch as corrupt.
+     */
+    [[nodiscard]] std::vector<SubFileCheck> verify_sub_files() const {
+        using ImageImplementation::StreamDigest;
+        // The digest of one segment of a subfile that is not solid, or the problem that prevented it from being found
+        struct SegmentCheck {
+            StreamDigest digest{0, 0};
+            std::optional<std::string> error;
+            // For the first segment, the information recorded for the subfile, and whether its size must instead be measured from its digests
+            std::optional<SubFileInfo> info;
+            bool measured = false;
+        };
+        const auto range = sub_files();
+        const std::vector<SubFileHandle> sequences(range.begin(), range.end());
+        auto &pool = ThreadPool::shared();
+        const auto groups = batches(sequences);
+        std::vector<std::vector<std::future<SegmentCheck>>> futures(groups.size());
+        for (std::size_t g = 0; g < groups.size(); ++g) {
+            const auto &handle = groups[g].front();
+            if (handle.is_solid())
+                continue;
+            const auto chunks = handle.chunks();
+            for (std::size_t j = 0; j < chunks.size(); ++j)
+                futures[g].emplace_back(pool.submit([&handle, chunk = chunks[j], first = j == 0] {
+                    SegmentCheck check;
+                    try {
+                        auto header = FuseChunk::read_header(chunk);
+                        PNGFUSE_TRACE_SCOPE("digest", header.compressed.size());
+                        if (first && !header.info.has_value()) {
+                            // Chunks without an index were only ever written with zlib, whose filename is read by the same walk that checks it
+                            if (header.method != Codec::ZLIB_METHOD)
+                                throw std::runtime_error("Encountered fuSe chunk compressed with an unsupported codec");
+                            check.info = describe_unindexed(handle);
+                            const auto [filename, digest] = ImageImplementation::digest_zlib_prefixed(header.compressed, FuseChunk::MAX_FILENAME_LENGTH);
+                            check.info->name = std::u8string{filename.begin(), filename.end()};
+                            check.digest = digest;
+                            check.measured = true;
+                            return check;
+                        }
+                        const auto codec = Codec::find(header.method);
+                        if (!codec)
+                            throw std::runtime_error("Encountered fuSe chunk compressed with an unsupported codec");
+                        // The first segment begins with the filename and its null separator, which are not part of the contents
+                        const auto skip = first ? header.info->name.u8string().size() + 1 : 0;
+                        if (first)
+                            check.info = std::move(header.info);
+                        check.digest = codec->digest(header.compressed, skip);
+                    } catch (const std::runtime_error &e) {
+                        check.error = e.what();
+                        // A subfile whose filename cannot be checked may still have one that can be read
+                        if (first && !check.info.has_value())
+                            check.info = describe_unindexed(handle);
+                        if (first && check.info->name.empty()) {
+                            try {
+                                check.info->name = handle.name();
+                            } catch (const std::runtime_error &) {}
+                        }
+                    }
+                    return check;
+                }));
+        }
+        std::vector<std::future<std::vector<StreamDigest>>> solid_futures;
+        for (const auto group : groups)
+            if (group.front().is_solid())
+                solid_futures.emplace_back(pool.submit([group] {
+                    SubFileHandle::SegmentCache cache;
+                    std::vector<StreamDigest> digests;
+                    for (const auto &handle : group) {
+                        StreamDigest digest{0, 0};
+                        handle.decode_to([&digest] (std::span<const unsigned char> slice) {
+                            digest = {digest.size + slice.size(), ImageImplementation::crc32(slice, digest.crc)};
+                        }, &cache);
+                        digests.push_back(digest);
+                    }
+                    return digests;
+                }));
+
+        std::vector<SubFileCheck> checks;
+        checks.reserve(sequences.size());
+        const auto check_digest = [] (SubFileCheck &check, const StreamDigest &digest) {
+            if (digest.size != check.info.size)
+                check.error = "size does not match the recorded size";
+            else if (check.info.checksum.has_value() && digest.crc != check.info.checksum.value())
+                check.error = "checksum does not match the recorded checksum";
+        };
+        std::size_t solid_index = 0;
+        try {
+            for (std::size_t g = 0; g < groups.size(); ++g) {
+                if (!groups[g].front().is_solid()) {
+                    auto segments = pool.wait_all(futures[g]);
+                    auto &check = checks.emplace_back(SubFileCheck{std::move(segments.front().info.value()), std::nullopt});
+                    StreamDigest digest{0, 0};
+                    for (auto &segment : segments) {
+                        if (segment.error.has_value() && !check.error.has_value())
+                            check.error = std::move(segment.error);
+                        digest = {digest.size + segment.digest.size, ImageImplementation::crc32_combine(digest.crc, segment.digest.crc, segment.digest.size)};
+                    }
+                    if (check.error.has_value())
+                        continue;
+                    if (segments.front().measured)
+                        check.info.size = digest.size;
+                    check_digest(check, digest);
+                    continue;
+                }
+                const auto first = checks.size();
+                for (const auto &handle : groups[g])
+                    checks.push_back(SubFileCheck{handle.info(), std::nullopt});
+                const auto group_checks = std::span(checks).subspan(first);
+                try {
+                    const auto digests = pool.wait(solid_futures[solid_index++]);
+                    for (std::size_t i = 0; i < digests.size(); ++i)
+                        check_digest(group_checks[i], digests[i]);
+                } catch (const std::runtime_error &e) {
+                    for (auto &check : group_checks)
+                        check.error = e.what();
+                }
+            }
+        } catch (...) {
+            // Let tasks still in flight finish before the handles they read go out of scope
+            for (auto &group_futures : futures)
+                pool.settle(std::span(group_futures));
+            pool.settle(std::span(solid_futures));
+            throw;
+        }
+        return checks;
+    }
+
+private:
+    /**
+     * Describes a subfile fused without an index as far as its chunks' headers allow, without decompressing any of it.
+     * @param handle A handle to the subfile, which is not solid
+     * @return The compressed size of the subfile's readable chunks, with an empty name, a size of 0, and no checksum, to be filled in as they are found
+     */
+    [[nodiscard]] static SubFileInfo describe_unindexed(const SubFileHandle &handle) {
+        SubFileInfo info{{}, 0, 0, std::nullopt};
+        try {
+            for (const auto chunk : handle.chunks())
+                info.compressed_size += FuseChunk::read_header(chunk).compressed.size();
+        } catch (const std::runtime_error &) {}
+        return info;
+    }
+
+    /**
+     * Finds the subfiles whose filenames match a pattern, reading only their names.
+     * @param pattern The UTF-8 encoded filename or glob that subfiles must match, as in @c matches_pattern()
+     * @return Handles to the matching subfiles, in order
+     */
+    [[nodiscard]] std::vector<SubFileHandle> matching_handles(std::u8string_view pattern) const {
+        std::vector<SubFileHandle> matches;
+        std::ranges::copy_if(sub_files(), std::back_inserter(matches),
+                             [pattern] (const SubFileHandle &handle) { return matches_pattern(handle.name(), pattern); });
+        return matches;
+    }
+
+    /**
+     * Decodes subfiles in parallel on the shared @c ThreadPool, a batch at a time, as in @c batches().
+     * @param handles Handles to the subfiles to decode, in order
+     * @return The decoded subfiles, in the order of @p handles
+     */
+    [[nodiscard]] static std::vector<SubFile> decode_handles(std::span<const SubFileHandle> handles) {
+        auto &pool = ThreadPool::shared();
+        std::vector<std::future<std::vector<SubFile>>> futures;
+        for (const auto batch : batches(handles))
+            futures.emplace_back(pool.submit([batch] { return decode_batch(batch); }));
+        std::vector<SubFile> decoded;
+        decoded.reserve(handles.size());
+        for (auto &sub_files : pool.wait_all(futures))
+            std::ranges::move(sub_files, std::back_inserter(decoded));
+        return decoded;
+    }
+
+    /**
+     * Decodes subfiles in parallel on the shared @c ThreadPool, a batch at a time as in @c batches(), handing each to @p sink in order.
+     * @tparam Sink A callable taking each decoded subfile as an rvalue @c SubFile, called on the calling thread
+     * @param handles Handles to the subfiles to decode, in order
+     * @param sink The callable to which to hand each decoded subfile
+     * @details
+     *     Up to two batches per job are decompressed ahead of the one being handed over, as long as the batches decompressed or being decompressed,
+     *     and not yet handed over, hold at most the bytes set by @c configure_in_flight().
+     *     A batch is counted as estimated by @c SubFileHandle::size_hint() until it has been decompressed, and by its actual size from then on,
+     *     so a batch larger than its estimate holds back those after it.
+     *     The next batch is decompressed however large it is.
+     */
+    template <class Sink>
+    static void decode_in_order(std::span<const SubFileHandle> handles, Sink &&sink) {
+        auto &pool = ThreadPool::shared();
+        const auto lookahead = 2 * pool.jobs();
+        const auto groups = batches(handles);
+        std::vector<std::uint64_t> hints;
+        hints.reserve(groups.size());
+        for (const auto group : groups) {
+            std::uint64_t hint = 0;
+            for (const auto &handle : group)
+                hint += handle.size_hint();
+            hints.push_back(hint);
+        }
+        const auto decoded_size = [] (const std::vector<SubFile> &sub_files) {
+            std::uint64_t size = 0;
+            for (const auto &sub_file : sub_files)
+                size += sub_file.contents.size();
+            return size;
+        };
+        std::vector<std::future<std::vector<SubFile>>> futures;
+        futures.reserve(groups.size());
+        // Updated by each task as it finishes, replacing its batch's estimate with its actual size
+        std::atomic<std::uint64_t> in_flight = 0;
+        std::size_t consumed = 0;
+        try {
+            for (; consumed < groups.size(); ++consumed) {
+                while (futures.size() < std::min(consumed + lookahead, groups.size())
+                       && (futures.size() == consumed || in_flight + hints[futures.size()] <= in_flight_limit)) {
+                    const auto hint = hints[futures.size()];
+                    in_flight += hint;
+                    futures.emplace_back(pool.submit([batch = groups[futures.size()], hint, &in_flight, &decoded_size] {
+                        auto sub_files = decode_batch(batch);
+                        // Added before the estimate is taken away, so the count never drops below what is held
+                        in_flight += decoded_size(sub_files);
+                        in_flight -= hint;
+                        return sub_files;
+                    }));
+                }
+                auto sub_files = pool.wait(futures[consumed]);
+                const auto size = decoded_size(sub_files);
+                for (auto &sub_file : sub_files)
+                    sink(std::move(sub_file));
+                sub_files.clear();
+                in_flight -= size;
+            }
+        } catch (...) {
+            // Let tasks still in flight finish before the handles they read go out of scope, and before returning to the caller
+            pool.settle(std::span(futures).subspan(consumed));
+            throw;
+        }
+    }
+
+    /**
+     * Decodes subfiles and saves each at the path stored in its @c name.
+     * @param handles Handles to the subfiles to save, in order
+     * @return The number of saved subfiles
+     * @details
+     *     As in @c save_sub_files(), subfiles are decompressed ahead of the one being saved as in @c decode_in_order(),
+     *     and written on the I/O pool, with the subfiles being written also holding at most the bytes set by @c configure_in_flight().
+     */
+    static std::size_t save_handles(std::span<const SubFileHandle> handles) {
+        struct Write {
+            path name;
+            std::size_t size;
+            std::future<void> done;
+        };
+        auto &io = ThreadPool::io();
+        std::size_t saved = 0;
+        std::uint64_t writing = 0;
+        // Writes in flight, oldest first
+        std::deque<Write> writes;
+        const auto finish_write = [&] {
+            io.wait(writes.front().done);
+            writing -= writes.front().size;
+            writes.pop_front();
+            ++saved;
+        };
+        try {
+            decode_in_order(handles, [&] (SubFile &&sub_file) {
+                // Subfiles sharing a name are written in order, so that the last of them wins as when saving one at a time
+                while (!writes.empty() && (writes.size() >= 2 * io.jobs() || writing + sub_file.contents.size() > in_flight_limit
+                                           || std::ranges::any_of(writes, [&sub_file] (const Write &write) { return write.name == sub_file.name; })))
+                    finish_write();
+                const auto size = sub_file.contents.size();
+                auto name = sub_file.name;
+                writing += size;
+                writes.push_back({std::move(name), size, io.submit([sub_file = std::move(sub_file)] { sub_file.save(); })});
+            });
+            while (!writes.empty())
+                finish_write();
+        } catch (...) {
+            // Let writes still in flight finish before returning to the caller
+            for (auto &write : writes)
+                io.settle(std::span(&write.done, 1));
+            throw;
+        }
+        return saved;
+    }
+
+    /**
+     * Splits a list of subfile handles into batches to be decompressed by one task each.
+     * @param handles Handles to the subfiles to be decompressed, in order
+     * @return The batches, covering @p handles in order
+     * @details
+     *     Neighbouring handles to subfiles packed into the same solid run are batched together, up to @c FuseChunk::SEGMENT_SIZE bytes of contents,
+     *     so that the segments they share are decompressed only once. Any other handle is a batch of its own.
+     */
+    [[nodiscard]] static std::vector<std::span<const SubFileHandle>> batches(std::span<const SubFileHandle> handles) {
+        std::vector<std::span<const SubFileHandle>> groups;
+        for (std::size_t i = 0; i < handles.size();) {
+            auto end = i + 1;
+            if (handles[i].is_solid()) {
+                auto size = handles[i].info().size;
+                for (; end < handles.size() && handles[end].is_solid() && handles[end].chunks().data() == handles[i].chunks().data(); ++end) {
+                    const auto next_size = handles[end].info().size;
+                    if (size + next_size > FuseChunk::SEGMENT_SIZE)
+                        break;
+                    size += next_size;
+                }
+            }
+            groups.push_back(handles.subspan(i, end - i));
+            i = end;
+        }
+        return groups;
+    }
+
+    /**
+     * Decompresses a batch of subfiles, as returned by @c batches(), sharing decompressed segments between them.
+     * @param batch Handles to the subfiles to be decompressed, in order
+     * @return The decompressed subfiles, in the order of @p batch
+     */
+    [[nodiscard]] static std::vector<SubFile> decode_batch(std::span<const SubFileHandle> batch) {
+        SubFileHandle::SegmentCache cache;
         std::vector<SubFile> sub_files;
-        const auto chunks = get_chunks();
-        sub_files.reserve(chunks.size());
-        for (const auto &chunk : chunks)
-            sub_files.emplace_back(chunk.to_subfile());
+        sub_files.reserve(batch.size());
+        for (const auto &handle : batch)
+            sub_files.push_back(handle.decode(&cache));
         return sub_files;
     }
+
+    /**
+     * Loads several files from the filesystem in parallel on the I/O pool and packs them into one solid run.
+     * @param files Paths to the files to pack, in order
+     * @param compression The settings with which to compress the run
+     * @return The encoded run, as returned by @c FuseChunk::encode_solid()
+     */
+    [[nodiscard]] static ImageImplementation::ManagedByteSpan encode_solid_files(const std::vector<path> &files, const Compression &compression) {
+        auto &io = ThreadPool::io();
+        std::vector<std::future<SubFile>> futures;
+        futures.reserve(files.size());
+        for (const auto &file : files)
+            futures.emplace_back(io.submit([&file] { return SubFile::from_file(file); }));
+        return FuseChunk::encode_solid(io.wait_all(futures), compression);
+    }
+
+    /**
+     * Loads several files from the filesystem and encodes each into a run of @c fuSe chunks, handing the runs to @p sink in order.
+     * @param files Paths to the files to encode, in order
+     * @param compression The settings with which to compress the files
+     * @param sink A callable taking each encoded run as an rvalue @c ImageImplementation::ManagedByteSpan, called on the calling thread
+     * @details
+     *     Files are read on @c ThreadPool::io() and encoded on the shared @c ThreadPool, so that waiting on the filesystem
+     *     overlaps with compressing the files before, and each read file is handed over to be encoded as soon as it is ready.
+     *     At most as many files as the I/O depth plus the number of jobs are read or encoded ahead of @p sink,
+     *     bounding how many are held in memory at once.
+     */
+    template <class Sink>
+    static void encode_files(const std::vector<path> &files, const Compression &compression, Sink &&sink) {
+        auto &pool = ThreadPool::shared();
+        auto &io = ThreadPool::io();
+        const auto lookahead = io.jobs() + pool.jobs();
+        std::vector<std::future<SubFile>> reads;
+        std::vector<std::future<ImageImplementation::ManagedByteSpan>> encodes;
+        reads.reserve(files.size());
+        encodes.reserve(files.size());
+        try {
+            for (std::size_t consumed = 0; consumed < files.size(); ++consumed) {
+                const auto limit = std::min(consumed + lookahead, files.size());
+                while (reads.size() < limit)
+                    reads.emplace_back(io.submit([&file = files[reads.size()]] { return SubFile::from_file(file); }));
+                // Only the next file to be consumed is waited on, and any others are handed over once they have been read
+                while (encodes.size() < limit && (encodes.size() == consumed
+                                                  || reads[encodes.size()].wait_for(std::chrono::seconds(0)) == std::future_status::ready))
+                    encodes.emplace_back(pool.submit([sub_file = io.wait(reads[encodes.size()]), &compression] () mutable {
+                        return FuseChunk(std::move(sub_file), compression).encode();
+                    }));
+                sink(pool.wait(encodes[consumed]));
+            }
+        } catch (...) {
+            // Let tasks still in flight finish before the files and settings they refer to go out of scope
+            io.settle(std::span(reads));
+            pool.settle(std::span(encodes));
+            throw;
+        }
+    }
+
+    /**
+     * The number of bytes of decompressed subfiles that extracting may hold in memory at once, set by @c configure_in_flight().
+     */
+    static inline std::size_t in_flight_limit = DEFAULT_IN_FLIGHT;
+
+    /**
+     * Determines if a run of @c fuSe chunks is already in the format that @c repack_pipe() would encode it in, so that it can be skipped.
+     * @param run Pointers to the chunks of a complete run, in sequence order
+     * @param compression The settings with which the run would be repacked
+     * @param solid Whether the run would be repacked into a @c FuseChunk::SOLID_FORMAT run, rather than one subfile per run
+     * @return @c true if the run has the target format version and every segment is compressed with the target codec, @c false otherwise
+     * @details
+     *     Without @p solid, the target is a @c FuseChunk::INDEXED_FORMAT run if @c FuseChunk::records_index() is @c true for @p compression,
+     *     and a @c FuseChunk::LEGACY_FORMAT or @c FuseChunk::SEGMENTED_FORMAT run otherwise.\n
+     *     The compression level is not recorded, so it is only compared for segments stored without compression:
+     *     these are on target only when repacking at @c STORE_LEVEL, and are compressed again at any other level.
+     *     Segments that cannot be shrunk are then stored again, cheaply, by the entropy check in @c Compression::compress().
+     */
+    [[nodiscard]] static bool in_target_format(std::span<const unsigned char *const> run, const Compression &compression, bool solid) {
+        const bool indexed = FuseChunk::records_index(compression);
+        for (const auto chunk : run) {
+            const auto header = FuseChunk::read_header(chunk);
+            if (solid ? header.format != FuseChunk::SOLID_FORMAT
+                      : indexed ? header.format != FuseChunk::INDEXED_FORMAT
+                                : header.format != FuseChunk::LEGACY_FORMAT && header.format != FuseChunk::SEGMENTED_FORMAT)
+                return false;
+            // The first DEFLATE block header follows the 2-byte zlib header, with a block type of 0 for stored blocks
+            const bool stored = header.method == Codec::ZLIB_METHOD && header.compressed.size() > 2 && (header.compressed[2] >> 1 & 3) == 0;
+            if (stored ? compression.level != ImageImplementation::STORE_LEVEL : header.method != compression.codec->method)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Writes image data to a stream, such as while passing an image through in @c fuse_pipe().
+     * @param out The stream to which to write
+     * @param data The bytes to write
+     * @throw @c std::runtime_error if @p out could not be written to
+     */
+    static void write_data(std::ostream &out, std::span<const unsigned char> data) {
+        if (!out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size())))
+            throw std::runtime_error("Failed to write image data to stream.");
+    }
+
+    /**
+     * Counts the subfiles encoded in @c fuSe chunks in the image, reading only their headers.
+     * @return The number of valid @c fuSe chunks that begin a run, counting each subfile packed into a solid run
+     */
+    [[nodiscard]] std::size_t count_sub_files() const {
+        std::size_t sub_file_count = 0;
+        for (const auto chunk : find_chunks(FuseChunk::type()))
+            if (FuseChunk::is_valid(chunk))
+                sub_file_count += FuseChunk::sub_file_count(chunk);
+        return sub_file_count;
+    }
 };
 
 #endif //PNGFUSE_SUBFILEIMAGE_H
@@ -0,0 +1,140 @@
+#ifndef PNGFUSE_TARWRITER_H
+#define PNGFUSE_TARWRITER_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/**
+ * Writes files to a stream as a POSIX tar archive, so that subfiles extracted to standard output can be unpacked by @c tar.
+ * @details
+ *     Each file is written as a regular file in the @c ustar format as soon as it is added, so nothing is buffered.
+ *     A file whose name or size does not fit its @c ustar header is preceded by a @c pax extended header recording them in full.
+ */
+class TarWriter {
+public:
+    /**
+     * Begins an archive.
+     * @param out The stream to which to write the archive, which need not be seekable
+     */
+    explicit TarWriter(std::ostream &out) : out(out), modified(static_cast<std::uint64_t>(std::max<std::time_t>(std::time(nullptr), 0))) {}
+
+    /**
+     * Appends a regular file to the archive, stamped with the time the archive was begun.
+     * @param name The UTF-8 encoded name of the file
+     * @param contents The contents of the file
+     * @throw @c std::runtime_error if the stream could not be written to
+     */
+    void add(std::u8string_view name, std::span<const unsigned char> contents) {
+        const std::string_view narrow_name(reinterpret_cast<const char *>(name.data()), name.size());
+        const bool long_name = narrow_name.size() > NAME_SIZE, large = contents.size() > MAX_SIZE;
+        if (long_name || large) {
+            std::string records;
+            if (long_name)
+                records += pax_record("path", narrow_name);
+            if (large)
+                records += pax_record("size", std::to_string(contents.size()));
+            write_header("PaxHeader", 'x', records.size());
+            write_padded(std::span(reinterpret_cast<const unsigned char *>(records.data()), records.size()));
+        }
+        write_header(narrow_name.substr(0, NAME_SIZE), '0', large ? 0 : contents.size());
+        write_padded(contents);
+    }
+
+    /**
+     * Ends the archive with the two empty blocks that mark its end, and flushes the stream.
+     * @throw @c std::runtime_error if the stream could not be written to
+     */
+    void finish() {
+        const std::array<char, 2 * BLOCK_SIZE> end{};
+        if (!out.write(end.data(), end.size()) || !out.flush())
+            throw std::runtime_error("Failed to write archive data to stream.");
+    }
+
+private:
+    static constexpr std::size_t BLOCK_SIZE = 512;
+    /**
+     * The length of the name field of a @c ustar header, which need not be null-terminated.
+     */
+    static constexpr std::size_t NAME_SIZE = 100;
+    /**
+     * The largest size that fits the 11 octal digits of the size field of a @c ustar header.
+     */
+    static constexpr std::uint64_t MAX_SIZE = (std::uint64_t{1} << 33) - 1;
+
+    std::ostream &out;
+    std::uint64_t modified;
+
+    /**
+     * Formats one record of a @c pax extended header, which begins with its own length in decimal.
+     * @param key The keyword of the record
+     * @param value The UTF-8 encoded value of the record
+     * @return The record, as <tt>"[length] [key]=[value]\n"</tt>
+     */
+    static std::string pax_record(std::string_view key, std::string_view value) {
+        const auto rest = key.size() + value.size() + 3;
+        // Adding the digits of the length to itself may carry it into another digit
+        auto length = rest;
+        while (length != rest + std::to_string(length).size())
+            length = rest + std::to_string(length).size();
+        return std::to_string(length) + ' ' + std::string(key) + '=' + std::string(value) + '\n';
+    }
+
+    /**
+     * Writes a @c ustar header block.
+     * @param name The name of the entry, at most @c NAME_SIZE bytes
+     * @param type The type flag of the entry, i.e. @c '0' for a regular file or @c 'x' for a @c pax extended header
+     * @param size The number of bytes of data following the header
+     */
+    void write_header(std::string_view name, char type, std::uint64_t size) {
+        std::array<char, BLOCK_SIZE> header{};
+        std::ranges::copy(name, header.begin());
+        write_octal(header, 100, 8, 0644);  // mode
+        write_octal(header, 108, 8, 0);     // uid
+        write_octal(header, 116, 8, 0);     // gid
+        write_octal(header, 124, 12, size);
+        write_octal(header, 136, 12, modified);
+        header[156] = type;
+        std::ranges::copy(std::string_view("ustar\0" "00", 8), header.begin() + 257);
+        // The checksum is computed over the header with its own field filled with spaces
+        std::fill_n(header.begin() + 148, 8, ' ');
+        std::uint64_t checksum = 0;
+        for (const auto byte : header)
+            checksum += static_cast<unsigned char>(byte);
+        write_octal(header, 148, 7, checksum);
+        if (!out.write(header.data(), header.size()))
+            throw std::runtime_error("Failed to write archive data to stream.");
+    }
+
+    /**
+     * Writes the data of an entry, padded with zeros to a whole number of blocks.
+     * @param data The data to write
+     */
+    void write_padded(std::span<const unsigned char> data) {
+        const std::array<char, BLOCK_SIZE> padding{};
+        if (!out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()))
+            || !out.write(padding.data(), static_cast<std::streamsize>((BLOCK_SIZE - data.size() % BLOCK_SIZE) % BLOCK_SIZE)))
+            throw std::runtime_error("Failed to write archive data to stream.");
+    }
+
+    /**
+     * Writes a number into a header field as zero-padded octal digits followed by a null terminator.
+     * @param header The header block to write into
+     * @param offset The offset of the field in @p header
+     * @param width The width of the field, including its terminator
+     * @param value The number to write, which must fit in <tt>width - 1</tt> octal digits
+     */
+    static void write_octal(std::array<char, BLOCK_SIZE> &header, std::size_t offset, std::size_t width, std::uint64_t value) {
+        header[offset + width - 1] = '\0';
+        for (std::size_t i = width - 1; i-- > 0; value >>= 3)
+            header[offset + i] = static_cast<char>('0' + (value & 7));
+    }
+};
+
+#endif //PNGFUSE_TARWRITER_H
@@ -0,0 +1,258 @@
+#ifndef PNGFUSE_THREADPOOL_H
+#define PNGFUSE_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A fixed-size work-stealing thread pool shared by all parallel operations.
+ * @details
+ *     Each worker thread owns a queue of tasks. Workers take their newest task first, and when their own queue is empty,
+ *     steal the oldest task from another worker's queue. Tasks submitted from outside the pool are spread across the queues.
+ *     \n
+ *     Threads waiting on a task's result through @c ThreadPool::wait() run other queued tasks in the meantime,
+ *     so tasks may safely submit and wait on subtasks without exhausting the pool's threads.
+ *     For this reason, a pool configured for @c n jobs starts only <tt>n - 1</tt> worker threads,
+ *     counting on the thread that waits for the results as the last.
+ */
+class ThreadPool {
+public:
+    /**
+     * Starts a pool that runs up to @p jobs tasks at once, including the thread waiting on the results.
+     * @param jobs The total number of threads that should run tasks concurrently
+     */
+    explicit ThreadPool(std::size_t jobs) : queues(std::max<std::size_t>(jobs, 2) - 1) {
+        for (auto &queue : queues)
+            queue = std::make_unique<Queue>();
+        workers.reserve(std::max<std::size_t>(jobs, 1) - 1);
+        for (std::size_t i = 0; i + 1 < jobs; ++i)
+            workers.emplace_back([this, i] { work(i); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    /**
+     * Queues a task to be run on the pool.
+     * @param task A callable taking no arguments
+     * @return A future holding the result of @p task, or any exception it throws
+     */
+    template <class F>
+    auto submit(F &&task) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+        // Workers push to their own queue for locality; other threads spread tasks round-robin
+        const auto index = current_worker == std::nullopt || current_pool != this
+                           ? next_queue++ % queues.size()
+                           : current_worker.value();
+        {
+            std::lock_guard lock(queues[index]->mutex);
+            queues[index]->tasks.emplace_back([packaged] { (*packaged)(); });
+        }
+        {
+            std::lock_guard lock(sleep_mutex);
+            ++queued;
+        }
+        wake.notify_one();
+        return future;
+    }
+
+    /**
+     * Waits for the result of a task submitted to this pool, running other queued tasks while it is not yet ready.
+     * @param future A future returned by @c ThreadPool::submit()
+     * @return The result of the task, rethrowing any exception it threw
+     */
+    template <class T>
+    T wait(std::future<T> &future) {
+        const auto home = current_pool == this && current_worker.has_value() ? current_worker.value() : next_queue++ % queues.size();
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!run_one(home))
+                future.wait_for(std::chrono::microseconds(100));
+        }
+        return future.get();
+    }
+
+    /**
+     * Waits for the results of several tasks submitted to this pool, running other queued tasks while any are not yet ready.
+     * @param futures Futures returned by @c ThreadPool::submit()
+     * @return The results of the tasks, in the order of @p futures
+     * @details
+     *     Every task is waited on even if an earlier one fails, so that tasks referring to the caller's data never outlive it.
+     *     The first exception thrown by any task is then rethrown.
+     */
+    template <class T>
+    std::vector<T> wait_all(std::vector<std::future<T>> &futures) {
+        std::vector<T> results;
+        results.reserve(futures.size());
+        std::exception_ptr failure;
+        for (auto &future : futures) {
+            try {
+                results.emplace_back(wait(future));
+            } catch (...) {
+                if (!failure)
+                    failure = std::current_exception();
+            }
+        }
+        if (failure)
+            std::rethrow_exception(failure);
+        return results;
+    }
+
+    /**
+     * Waits for every task that has not yet been waited on to finish, running other queued tasks meanwhile and discarding the results.
+     * @param futures Futures returned by @c ThreadPool::submit(), of which those no longer valid are skipped
+     * @details
+     *     This lets tasks referring to the caller's data finish before an exception is rethrown,
+     *     even if no worker thread is free to run them.
+     */
+    template <class T>
+    void settle(std::span<std::future<T>> futures) noexcept {
+        for (auto &future : futures)
+            if (future.valid())
+                try {
+                    wait(future);
+                } catch (...) {}
+    }
+
+    /**
+     * The number of tasks this pool runs at once, including the thread waiting on the results.
+     * @return The number of concurrent jobs
+     */
+    [[nodiscard]] std::size_t jobs() const { return workers.size() + 1; }
+
+    /**
+     * Sets the number of jobs used by @c ThreadPool::shared(). Has no effect once the shared pool has been started.
+     * @param jobs The total number of threads that should run tasks concurrently
+     */
+    static void configure(std::size_t jobs) {
+        configured_jobs = std::max<std::size_t>(jobs, 1);
+    }
+
+    /**
+     * The pool shared by all parallel operations, started on first use.
+     * @return The shared pool, sized by @c ThreadPool::configure() or else to the hardware concurrency
+     */
+    static ThreadPool &shared() {
+        static ThreadPool pool(configured_jobs.value_or(std::max(std::thread::hardware_concurrency(), 1u)));
+        return pool;
+    }
+
+    /**
+     * The default number of blocking file operations that @c ThreadPool::io() runs at once.
+     */
+    static constexpr std::size_t DEFAULT_IO_DEPTH = 8;
+
+    /**
+     * Sets the number of blocking file operations run at once by @c ThreadPool::io(). Has no effect once the I/O pool has been started.
+     * @param depth The number of files that may be read or written concurrently
+     */
+    static void configure_io(std::size_t depth) {
+        configured_io_depth = std::max<std::size_t>(depth, 1);
+    }
+
+    /**
+     * The pool reserved for blocking file reads and writes, started on first use.
+     * @return The I/O pool, which runs @c ThreadPool::DEFAULT_IO_DEPTH operations at once unless set by @c ThreadPool::configure_io()
+     * @details
+     *     Files are read and written on threads of their own, so that waiting on a slow or networked filesystem overlaps with compression
+     *     instead of occupying the threads of @c ThreadPool::shared(). Its threads spend most of their time blocked,
+     *     so the pool runs one worker for each operation in flight, regardless of the number of CPU cores.
+     */
+    static ThreadPool &io() {
+        static ThreadPool pool(configured_io_depth.value_or(DEFAULT_IO_DEPTH) + 1);
+        return pool;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::size_t queued = 0;
+    bool stopping = false;
+
+    static inline std::optional<std::size_t> configured_jobs;
+    static inline std::optional<std::size_t> configured_io_depth;
+    static inline thread_local const ThreadPool *current_pool = nullptr;
+    static inline thread_local std::optional<std::size_t> current_worker;
+
+    /**
+     * Runs a single queued task, preferring the newest task in the queue at @p home, and otherwise stealing the oldest from another.
+     * @param home The index of the queue to check first
+     * @return @c true if a task was run, @c false if every queue was empty
+     */
+    bool run_one(std::size_t home) {
+        std::function<void()> task;
+        for (std::size_t offset = 0; offset < queues.size() && !task; ++offset) {
+            auto &queue = *queues[(home + offset) % queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (offset == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task)
+            return false;
+        {
+            std::lock_guard lock(sleep_mutex);
+            --queued;
+        }
+        task();
+        return true;
+    }
+
+    /**
+     * The main loop of a worker thread, which runs tasks until the pool is destroyed.
+     * @param index The index of the worker's own queue
+     */
+    void work(std::size_t index) {
+        current_pool = this;
+        current_worker = index;
+        while (true) {
+            if (run_one(index))
+                continue;
+            std::unique_lock lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+};
+
+#endif //PNGFUSE_THREADPOOL_H
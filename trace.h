@@ -0,0 +1,271 @@
+#ifndef PNGFUSE_TRACE_H
+#define PNGFUSE_TRACE_H
+
+/**
+ * Low-overhead instrumentation of the time spent in, and bytes handled by, each phase of PNGFuse's operations.
+ * @details
+ *     Instrumentation is only compiled in when @c PNGFUSE_TRACE is defined. Otherwise, @c PNGFUSE_TRACE_SCOPE() expands to nothing
+ *     and its arguments are never evaluated. Even when compiled in, nothing is recorded until @c Trace::enable() is called.
+ */
+
+#ifdef PNGFUSE_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * A process-wide recorder of timed phases, attributed to the thread that ran each one.
+ * @details
+ *     Each thread appends its events to a buffer of its own, so recording never contends with other threads.
+ *     Threads are numbered in the order they first record an event, counting the thread that called @c Trace::enable() as thread 0.
+ */
+class Trace {
+public:
+    /**
+     * One timed run of a phase.
+     */
+    struct Event {
+        /**
+         * The name of the phase, which must be a string literal.
+         */
+        const char *name;
+        /**
+         * The number of the thread that ran the phase.
+         */
+        std::uint32_t thread;
+        /**
+         * The time at which the phase began, in nanoseconds since tracing was enabled.
+         */
+        std::int64_t start;
+        /**
+         * The time the phase took, in nanoseconds.
+         */
+        std::int64_t duration;
+        /**
+         * The number of bytes the phase handled, or 0 if it does not count bytes.
+         */
+        std::uint64_t bytes;
+    };
+
+    /**
+     * Starts recording events on every thread, numbering the calling thread as thread 0.
+     */
+    static void enable() {
+        epoch() = std::chrono::steady_clock::now();
+        local();
+        enabled_flag().store(true, std::memory_order_release);
+    }
+
+    /**
+     * Determines if events are being recorded.
+     * @return @c true once @c Trace::enable() has been called, @c false otherwise
+     */
+    [[nodiscard]] static bool enabled() {
+        return enabled_flag().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The current time on the trace's clock.
+     * @return The number of nanoseconds since tracing was enabled
+     */
+    [[nodiscard]] static std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    /**
+     * Records a phase that ends now, on behalf of the calling thread.
+     * @param name The name of the phase, which must be a string literal
+     * @param start The time at which the phase began, as returned by @c Trace::now()
+     * @param bytes The number of bytes the phase handled
+     */
+    static void record(const char *name, std::int64_t start, std::uint64_t bytes) {
+        auto &buffer = local();
+        const std::scoped_lock lock(buffer.mutex);
+        buffer.events.push_back({name, buffer.thread, start, now() - start, bytes});
+    }
+
+    /**
+     * Gathers the events recorded so far on every thread.
+     * @return The events, ordered by the time they began
+     */
+    [[nodiscard]] static std::vector<Event> events() {
+        std::vector<Event> all;
+        const std::scoped_lock registry_lock(registry_mutex());
+        for (const auto &buffer : registry()) {
+            const std::scoped_lock lock(buffer->mutex);
+            all.insert(all.end(), buffer->events.begin(), buffer->events.end());
+        }
+        std::ranges::sort(all, {}, &Event::start);
+        return all;
+    }
+
+    /**
+     * Prints a table of the total time, bytes, and throughput of each phase, broken down by thread when several threads ran it.
+     * @param stream The stream to which to print the table
+     * @details
+     *     Nested phases are each counted in full, so the time of a phase includes the time of any phases it encloses,
+     *     and the times of phases run concurrently on several threads may add up to more than the elapsed time.
+     */
+    template <class Stream>
+    static void write_summary(Stream &stream) {
+        struct Total {
+            std::size_t calls = 0;
+            std::int64_t duration = 0;
+            std::uint64_t bytes = 0;
+        };
+        // Threads are keyed from 1, so that the totals for every thread, keyed 0, come first
+        std::map<std::string_view, std::map<std::uint32_t, Total>> totals;
+        for (const auto &event : events())
+            for (auto &total : {&totals[event.name][0], &totals[event.name][event.thread + 1]}) {
+                ++total->calls;
+                total->duration += event.duration;
+                total->bytes += event.bytes;
+            }
+
+        std::ostringstream table;
+        table << std::fixed << std::left << std::setw(16) << "phase" << std::setw(10) << "thread" << std::right
+              << std::setw(10) << "calls" << std::setw(12) << "seconds" << std::setw(16) << "bytes" << std::setw(12) << "MB/s" << '\n';
+        for (const auto &[name, threads] : totals)
+            for (const auto &[thread, total] : threads) {
+                // One thread's row would only repeat the totals
+                if (thread != 0 && threads.size() == 2)
+                    continue;
+                const auto seconds = static_cast<double>(total.duration) / 1e9;
+                table << std::left << std::setw(16) << name << std::setw(10) << (thread == 0 ? "all" : thread_name(thread - 1)) << std::right
+                      << std::setw(10) << total.calls << std::setw(12) << std::setprecision(3) << seconds << std::setw(16) << total.bytes
+                      << std::setw(12) << std::setprecision(1) << (total.bytes > 0 && seconds > 0 ? static_cast<double>(total.bytes) / seconds / 1e6 : 0.0)
+                      << '\n';
+            }
+        table << "elapsed: " << std::setprecision(3) << static_cast<double>(now()) / 1e9 << " s\n";
+        stream << table.str().c_str() << std::flush;
+    }
+
+    /**
+     * Writes every event in the Chrome trace event format, which can be viewed in chrome://tracing or Perfetto.
+     * @param stream The stream to which to write the JSON document
+     */
+    static void write_chrome_trace(std::ostream &stream) {
+        const auto all = events();
+        std::uint32_t thread_count = 0;
+        for (const auto &event : all)
+            thread_count = std::max(thread_count, event.thread + 1);
+        stream << R"({"displayTimeUnit":"ms","traceEvents":[)";
+        const char *separator = "\n";
+        for (std::uint32_t thread = 0; thread < thread_count; ++thread) {
+            stream << separator << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << thread
+                   << R"(,"args":{"name":")" << thread_name(thread) << R"("}})";
+            separator = ",\n";
+        }
+        for (const auto &event : all) {
+            stream << separator << R"({"name":")" << event.name << R"(","cat":"pngfuse","ph":"X","pid":1,"tid":)" << event.thread
+                   << R"(,"ts":)" << event.start / 1000 << '.' << std::setfill('0') << std::setw(3) << event.start % 1000
+                   << R"(,"dur":)" << event.duration / 1000 << '.' << std::setw(3) << event.duration % 1000 << std::setfill(' ')
+                   << R"(,"args":{"bytes":)" << event.bytes << "}}";
+            separator = ",\n";
+        }
+        stream << "\n]}\n";
+    }
+
+private:
+    struct Buffer {
+        std::uint32_t thread;
+        std::mutex mutex;
+        std::vector<Event> events;
+    };
+
+    static std::atomic<bool> &enabled_flag() {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    static std::chrono::steady_clock::time_point &epoch() {
+        static std::chrono::steady_clock::time_point time;
+        return time;
+    }
+
+    static std::mutex &registry_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    /**
+     * Every thread's buffer, which outlive their threads so that their events can still be gathered.
+     */
+    static std::vector<std::unique_ptr<Buffer>> &registry() {
+        static std::vector<std::unique_ptr<Buffer>> buffers;
+        return buffers;
+    }
+
+    /**
+     * The calling thread's buffer, registered the first time the thread records an event.
+     */
+    static Buffer &local() {
+        thread_local Buffer *const buffer = [] {
+            const std::scoped_lock lock(registry_mutex());
+            auto &buffers = registry();
+            buffers.push_back(std::make_unique<Buffer>());
+            buffers.back()->thread = static_cast<std::uint32_t>(buffers.size() - 1);
+            return buffers.back().get();
+        }();
+        return *buffer;
+    }
+
+    static std::string thread_name(std::uint32_t thread) {
+        return thread == 0 ? "main" : "worker " + std::to_string(thread);
+    }
+};
+
+
+/**
+ * Times the enclosing scope as one run of a phase, recording it to the @c Trace when the scope exits.
+ * @details Use through @c PNGFUSE_TRACE_SCOPE(), so that it compiles out when tracing is disabled.
+ */
+class TraceScope {
+public:
+    /**
+     * Begins timing a phase, if tracing is enabled.
+     * @param name The name of the phase, which must be a string literal
+     * @param bytes The number of bytes the phase handles
+     */
+    TraceScope(const char *name, std::uint64_t bytes) : name(name), bytes(bytes), start(Trace::enabled() ? Trace::now() : -1) {}
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    ~TraceScope() {
+        if (start >= 0)
+            Trace::record(name, start, bytes);
+    }
+
+private:
+    const char *name;
+    std::uint64_t bytes;
+    std::int64_t start;
+};
+
+#define PNGFUSE_TRACE_JOIN_(a, b) a##b
+#define PNGFUSE_TRACE_JOIN(a, b) PNGFUSE_TRACE_JOIN_(a, b)
+/**
+ * Times the rest of the enclosing scope as one run of the phase @p name, which handles @p bytes bytes.
+ */
+#define PNGFUSE_TRACE_SCOPE(name, bytes) const TraceScope PNGFUSE_TRACE_JOIN(trace_scope_, __LINE__)((name), static_cast<std::uint64_t>(bytes))
+
+#else
+
+#define PNGFUSE_TRACE_SCOPE(name, bytes) static_cast<void>(0)
+
+#endif
+
+#endif //PNGFUSE_TRACE_H